@@ -0,0 +1,668 @@
+/* needed by clock_gettime() when compiling in strict standard mode. */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef BQUE_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "bufferqueue.h"
+
+#define BENCH_EOL           "\n"
+
+#define BENCH_OPT_STR       "n:"
+
+#define BENCH_HELP_STR      "bque_bench [-n num] [workload ...]"                   BENCH_EOL   \
+                            "Measures the queue modes under several workloads."    BENCH_EOL   \
+                            "Workloads:"                                           BENCH_EOL   \
+                            "  pingpong  Enqueue and dequeue one buffer in turn"   BENCH_EOL   \
+                            "  burst     Fill the queue, then drain it"            BENCH_EOL   \
+                            "  item      Access random buffers by index"           BENCH_EOL   \
+                            "  insdrop   Insert and drop at random indexes"        BENCH_EOL   \
+                            "  sort      Sort 1K to 1M buffers"                    BENCH_EOL   \
+                            "  threads   Shared and sharded queues"                BENCH_EOL   \
+                            "Options:"                                             BENCH_EOL   \
+                            "  -n  Number of the operations per run (default 1M)"  BENCH_EOL
+
+/* number of the operations timed together, the percentiles are taken over
+   the average time of the operations of each batch, which keeps the clock
+   out of the measurement. */
+#define BENCH_BATCH         64
+
+/* queue sizes of the workloads. */
+#define BENCH_BURST_NUM     4096
+#define BENCH_ITEM_NUM      100000
+#define BENCH_INSDROP_NUM   10000
+
+/* number of the producers and of the consumers of BQUE_FLAG_MPMC, and of
+   the lanes of the sharded queue. */
+#define BENCH_THREAD_NUM    2
+
+typedef struct _bench_mode {
+    const char *name;
+    bque_u32_t flags;
+} bench_mode_t;
+
+static const bench_mode_t bench_modes[] = {
+    {"list",    0},
+    {"pool",    BQUE_FLAG_NODE_POOL},
+    {"ring",    BQUE_FLAG_RING},
+    {"indexed", BQUE_FLAG_INDEXED},
+    {"packed",  BQUE_FLAG_PACKED},
+};
+
+#define BENCH_MODE_NUM      (sizeof(bench_modes) / sizeof(bench_modes[0]))
+
+/* result of a run. */
+typedef struct _bench_res {
+    double *sample;
+    size_t sample_num;
+    bque_u64_t op_num;
+    bque_u64_t time;
+} bench_res_t;
+
+static bque_u64_t op_num_max = 1000000;
+
+static bque_u64_t alloc_num;
+
+static bque_u32_t rand_state = 2463534242U;
+
+static void *bench_alloc(void *user, size_t size) {
+    (void)user;
+    __atomic_fetch_add(&alloc_num, 1, __ATOMIC_RELAXED);
+
+    return malloc(size);
+}
+
+static void bench_dealloc(void *user, void *ptr) {
+    (void)user;
+    free(ptr);
+}
+
+static bque_u64_t bench_clock(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (bque_u64_t)ts.tv_sec * 1000000000U + (bque_u64_t)ts.tv_nsec;
+}
+
+static bque_u32_t bench_rand(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+
+    return rand_state;
+}
+
+static int bench_sample_cmp(const void *a, const void *b) {
+    double sample_a = *(const double *)a;
+    double sample_b = *(const double *)b;
+
+    return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+static bque_res_t bench_new(bque_ctx_t **ctx, bque_u32_t flags,
+                            bque_u32_t buff_num_max, bque_u32_t buff_size_max) {
+    bque_conf_t conf = {0};
+
+    conf.buff_num_max = buff_num_max;
+    conf.buff_size_max = buff_size_max;
+    conf.flags = flags;
+    conf.alloc_cb = bench_alloc;
+    conf.dealloc_cb = bench_dealloc;
+
+    return bque_new(ctx, &conf);
+}
+
+static void bench_begin(bench_res_t *res, size_t sample_max) {
+    res->sample = (double *)malloc(sizeof(double) * (sample_max != 0 ? sample_max : 1));
+    res->sample_num = 0;
+    res->op_num = 0;
+    res->time = 0;
+    alloc_num = 0;
+}
+
+static void bench_sample(bench_res_t *res, bque_u64_t op_num, bque_u64_t time) {
+    res->sample[res->sample_num++] = (double)time / (double)op_num;
+    res->op_num += op_num;
+    res->time += time;
+}
+
+static double bench_pct(bench_res_t *res, double pct) {
+    return res->sample[(size_t)(pct * (double)(res->sample_num - 1) + 0.5)];
+}
+
+static void bench_report(const char *workload, const char *mode, bque_u32_t size,
+                         bench_res_t *res) {
+    bque_u64_t allocs = __atomic_load_n(&alloc_num, __ATOMIC_RELAXED);
+
+    if (res->sample_num == 0 || res->time == 0) {
+        printf("%-10s %-8s %7lu %14s" BENCH_EOL, workload, mode, (unsigned long)size, "n/a");
+        free(res->sample);
+        return;
+    }
+
+    qsort(res->sample, res->sample_num, sizeof(double), bench_sample_cmp);
+    printf("%-10s %-8s %7lu %14.0f %9.1f %9.1f %9.1f %10.3f" BENCH_EOL,
+           workload, mode, (unsigned long)size,
+           (double)res->op_num * 1e9 / (double)res->time,
+           bench_pct(res, 0.5), bench_pct(res, 0.99), bench_pct(res, 0.999),
+           (double)allocs / (double)res->op_num);
+    free(res->sample);
+}
+
+static void bench_fail(const char *workload, const char *mode, bque_u32_t size,
+                       bench_res_t *res, bque_res_t err) {
+    printf("%-10s %-8s %7lu %14s %d" BENCH_EOL, workload, mode, (unsigned long)size,
+           "failed:", (int)err);
+    free(res->sample);
+}
+
+static bque_res_t bench_fill(bque_ctx_t *ctx, bque_u32_t num, bque_u32_t size) {
+    bque_u8_t buff[4096] = {0};
+    bque_res_t res;
+    bque_u32_t i;
+
+    for (i = 0; i < num; i++) {
+        memcpy(buff, &i, sizeof(i));
+        res = bque_enqueue(ctx, buff, size);
+        if (res != BQUE_OK) {
+            return res;
+        }
+    }
+
+    return BQUE_OK;
+}
+
+/* one operation is an enqueue followed by a dequeue. */
+static void bench_pingpong(const bench_mode_t *mode, bque_u32_t size) {
+    bque_u8_t buff[4096] = {0};
+    bque_u64_t batch_num = op_num_max / BENCH_BATCH;
+    bque_u32_t out_size;
+    bque_ctx_t *ctx;
+    bench_res_t res;
+    bque_res_t err;
+    bque_u64_t b;
+    bque_u32_t i;
+
+    bench_begin(&res, batch_num);
+    err = bench_new(&ctx, mode->flags, 1024, size);
+    if (err != BQUE_OK) {
+        bench_fail("pingpong", mode->name, size, &res, err);
+        return;
+    }
+
+    for (b = 0; b < batch_num; b++) {
+        bque_u64_t start = bench_clock();
+
+        for (i = 0; i < BENCH_BATCH; i++) {
+            bque_enqueue(ctx, buff, size);
+            bque_dequeue(ctx, buff, &out_size);
+        }
+        bench_sample(&res, BENCH_BATCH, bench_clock() - start);
+    }
+
+    bque_free(ctx);
+    bench_report("pingpong", mode->name, size, &res);
+}
+
+/* one operation is an enqueue or a dequeue. */
+static void bench_burst(const bench_mode_t *mode, bque_u32_t size) {
+    bque_u8_t buff[4096] = {0};
+    bque_u64_t round_num = op_num_max / (2 * BENCH_BURST_NUM);
+    bque_u32_t out_size;
+    bque_ctx_t *ctx;
+    bench_res_t res;
+    bque_res_t err;
+    bque_u64_t r;
+    bque_u32_t b;
+    bque_u32_t i;
+
+    bench_begin(&res, round_num * 2 * (BENCH_BURST_NUM / BENCH_BATCH));
+    err = bench_new(&ctx, mode->flags, BENCH_BURST_NUM, size);
+    if (err != BQUE_OK) {
+        bench_fail("burst", mode->name, size, &res, err);
+        return;
+    }
+
+    for (r = 0; r < round_num; r++) {
+        for (b = 0; b < BENCH_BURST_NUM / BENCH_BATCH; b++) {
+            bque_u64_t start = bench_clock();
+
+            for (i = 0; i < BENCH_BATCH; i++) {
+                bque_enqueue(ctx, buff, size);
+            }
+            bench_sample(&res, BENCH_BATCH, bench_clock() - start);
+        }
+        for (b = 0; b < BENCH_BURST_NUM / BENCH_BATCH; b++) {
+            bque_u64_t start = bench_clock();
+
+            for (i = 0; i < BENCH_BATCH; i++) {
+                bque_dequeue(ctx, buff, &out_size);
+            }
+            bench_sample(&res, BENCH_BATCH, bench_clock() - start);
+        }
+    }
+
+    bque_free(ctx);
+    bench_report("burst", mode->name, size, &res);
+}
+
+/* one operation is a bque_item() at a random index. */
+static void bench_item(const bench_mode_t *mode, bque_u32_t size) {
+    bque_u64_t batch_num = op_num_max / BENCH_BATCH;
+    bque_size_t out_size;
+    bque_ctx_t *ctx;
+    bench_res_t res;
+    bque_res_t err;
+    void *buff;
+    bque_u64_t b;
+    bque_u32_t i;
+
+    bench_begin(&res, batch_num);
+    err = bench_new(&ctx, mode->flags, BENCH_ITEM_NUM, size);
+    if (err == BQUE_OK) {
+        err = bench_fill(ctx, BENCH_ITEM_NUM, size);
+        if (err != BQUE_OK) {
+            bque_free(ctx);
+        }
+    }
+    if (err != BQUE_OK) {
+        bench_fail("item", mode->name, size, &res, err);
+        return;
+    }
+    alloc_num = 0;
+
+    for (b = 0; b < batch_num; b++) {
+        bque_u64_t start = bench_clock();
+
+        for (i = 0; i < BENCH_BATCH; i++) {
+            bque_item(ctx, (bque_s32_t)(bench_rand() % BENCH_ITEM_NUM), &buff, &out_size);
+        }
+        bench_sample(&res, BENCH_BATCH, bench_clock() - start);
+    }
+
+    bque_free(ctx);
+    bench_report("item", mode->name, size, &res);
+}
+
+/* one operation is a bque_insert() and a bque_drop() at random indexes. the
+   walks grow with the queue, so the runs are 10 times shorter. */
+static void bench_insdrop(const bench_mode_t *mode, bque_u32_t size) {
+    bque_u8_t buff[4096] = {0};
+    bque_u64_t batch_num = op_num_max / 10 / BENCH_BATCH;
+    bque_u32_t out_size;
+    bque_ctx_t *ctx;
+    bench_res_t res;
+    bque_res_t err;
+    bque_u64_t b;
+    bque_u32_t i;
+
+    bench_begin(&res, batch_num);
+    err = bench_new(&ctx, mode->flags, BENCH_INSDROP_NUM + 1, size);
+    if (err == BQUE_OK) {
+        err = bench_fill(ctx, BENCH_INSDROP_NUM, size);
+        if (err != BQUE_OK) {
+            bque_free(ctx);
+        }
+    }
+    if (err != BQUE_OK) {
+        bench_fail("insdrop", mode->name, size, &res, err);
+        return;
+    }
+    alloc_num = 0;
+
+    for (b = 0; b < batch_num; b++) {
+        bque_u64_t start = bench_clock();
+
+        for (i = 0; i < BENCH_BATCH; i++) {
+            bque_insert(ctx, bench_rand() % (BENCH_INSDROP_NUM + 1), buff, size);
+            bque_drop(ctx, bench_rand() % (BENCH_INSDROP_NUM + 1), buff, &out_size);
+        }
+        bench_sample(&res, BENCH_BATCH, bench_clock() - start);
+    }
+
+    bque_free(ctx);
+    bench_report("insdrop", mode->name, size, &res);
+}
+
+static bque_sort_res_t bench_sort_cb(const void *buff_a, bque_size_t size_a,
+                                     const void *buff_b, bque_size_t size_b) {
+    bque_u32_t key_a;
+    bque_u32_t key_b;
+
+    (void)size_a;
+    (void)size_b;
+    memcpy(&key_a, buff_a, sizeof(key_a));
+    memcpy(&key_b, buff_b, sizeof(key_b));
+
+    if (key_a < key_b) {
+        return BQUE_SORT_LESS;
+    } else if (key_a > key_b) {
+        return BQUE_SORT_GREATER;
+    } else {
+        return BQUE_SORT_EQUAL;
+    }
+}
+
+/* one operation is a buffer sorted, each sample is a whole sort. */
+static void bench_sort(const bench_mode_t *mode, bque_u32_t num) {
+    bque_u64_t rep_num = op_num_max / num != 0 ? op_num_max / num : 1;
+    bque_ctx_t *ctx;
+    bench_res_t res;
+    bque_res_t err;
+    bque_u64_t r;
+    bque_u32_t i;
+
+    bench_begin(&res, rep_num);
+    err = bench_new(&ctx, mode->flags, num, 8);
+    if (err != BQUE_OK) {
+        bench_fail("sort", mode->name, num, &res, err);
+        return;
+    }
+
+    for (r = 0; r < rep_num && err == BQUE_OK; r++) {
+        bque_u64_t start;
+
+        bque_empty(ctx);
+        for (i = 0; i < num && err == BQUE_OK; i++) {
+            bque_u32_t key[2];
+
+            key[0] = bench_rand();
+            key[1] = i;
+            err = bque_enqueue(ctx, key, sizeof(key));
+        }
+        alloc_num = 0;
+
+        start = bench_clock();
+        if (err == BQUE_OK) {
+            err = bque_sort(ctx, bench_sort_cb, BQUE_SORT_ASCENDING);
+        }
+        bench_sample(&res, num, bench_clock() - start);
+    }
+
+    bque_free(ctx);
+    if (err != BQUE_OK) {
+        bench_fail("sort", mode->name, num, &res, err);
+        return;
+    }
+    bench_report("sort", mode->name, num, &res);
+}
+
+#ifdef BQUE_THREADS
+
+/* thread of the shared queue workload, the sharded queue counts down the
+   buffers left to all consumers, since they steal from each other. */
+typedef struct _bench_thread {
+    bque_ctx_t *ctx;
+    bque_shard_t *shard;
+    bque_u32_t lane;
+    bque_u64_t *left;
+    bque_u64_t num;
+    bench_res_t *res;
+    pthread_t thread;
+} bench_thread_t;
+
+static void *bench_produce(void *arg) {
+    bench_thread_t *thread = (bench_thread_t *)arg;
+    bque_u64_t i;
+
+    for (i = 0; i < thread->num; i++) {
+        bque_enqueue_wait(thread->ctx, &i, sizeof(i), -1);
+    }
+
+    return NULL;
+}
+
+static void *bench_consume(void *arg) {
+    bench_thread_t *thread = (bench_thread_t *)arg;
+    bque_u64_t buff;
+    bque_u32_t out_size;
+    bque_u64_t i = 0;
+
+    while (i < thread->num) {
+        bque_u64_t start = bench_clock();
+        bque_u64_t n;
+
+        for (n = 0; n < BENCH_BATCH && i < thread->num; i++, n++) {
+            bque_dequeue_wait(thread->ctx, &buff, &out_size, -1);
+        }
+        if (thread->res != NULL) {
+            bench_sample(thread->res, n, bench_clock() - start);
+        }
+    }
+
+    return NULL;
+}
+
+static void *bench_shard_produce(void *arg) {
+    bench_thread_t *thread = (bench_thread_t *)arg;
+    bque_u64_t i;
+
+    for (i = 0; i < thread->num; i++) {
+        while (bque_shard_enqueue(thread->shard, thread->lane, &i, sizeof(i)) != BQUE_OK) {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void *bench_shard_consume(void *arg) {
+    bench_thread_t *thread = (bench_thread_t *)arg;
+    bque_u64_t buff;
+    bque_u32_t out_size;
+
+    while (__atomic_load_n(thread->left, __ATOMIC_RELAXED) > 0) {
+        bque_u64_t start = bench_clock();
+        bque_u64_t n = 0;
+
+        while (n < BENCH_BATCH && __atomic_load_n(thread->left, __ATOMIC_RELAXED) > 0) {
+            if (bque_shard_dequeue(thread->shard, thread->lane, &buff, &out_size) != BQUE_OK) {
+                sched_yield();
+                continue;
+            }
+            __atomic_fetch_sub(thread->left, 1, __ATOMIC_RELAXED);
+            n++;
+        }
+        if (thread->res != NULL && n > 0) {
+            bench_sample(thread->res, n, bench_clock() - start);
+        }
+    }
+
+    return NULL;
+}
+
+/* one operation is a buffer passed from a producer to a consumer, the
+   threads sleep while the queue is full or empty, and the samples are taken
+   by the first consumer. */
+static void bench_threads(const char *name, bque_u32_t flags, bque_u32_t thread_num) {
+    bench_thread_t prod[BENCH_THREAD_NUM];
+    bench_thread_t cons[BENCH_THREAD_NUM];
+    bque_u64_t per_thread = op_num_max / thread_num;
+    bque_ctx_t *ctx;
+    bench_res_t res;
+    bench_res_t all;
+    bque_u64_t start;
+    bque_res_t err;
+    bque_u32_t i;
+
+    bench_begin(&res, per_thread / BENCH_BATCH + 1);
+    err = bench_new(&ctx, flags, 1024, sizeof(bque_u64_t));
+    if (err != BQUE_OK) {
+        bench_fail("threads", name, sizeof(bque_u64_t), &res, err);
+        return;
+    }
+
+    start = bench_clock();
+    for (i = 0; i < thread_num; i++) {
+        prod[i].ctx = ctx;
+        prod[i].num = per_thread;
+        prod[i].res = NULL;
+        cons[i].ctx = ctx;
+        cons[i].num = per_thread;
+        cons[i].res = i == 0 ? &res : NULL;
+        pthread_create(&prod[i].thread, NULL, bench_produce, &prod[i]);
+        pthread_create(&cons[i].thread, NULL, bench_consume, &cons[i]);
+    }
+    for (i = 0; i < thread_num; i++) {
+        pthread_join(prod[i].thread, NULL);
+        pthread_join(cons[i].thread, NULL);
+    }
+
+    /* the rate covers all threads, the percentiles the first consumer. */
+    all = res;
+    all.op_num = per_thread * thread_num;
+    all.time = bench_clock() - start;
+
+    bque_free(ctx);
+    bench_report("threads", name, sizeof(bque_u64_t), &all);
+}
+
+/* the same with a sharded queue, each producer and consumer pair shares a
+   lane, and the consumers yield while all lanes are empty. */
+static void bench_shard(const char *name, bque_u32_t thread_num) {
+    bench_thread_t prod[BENCH_THREAD_NUM];
+    bench_thread_t cons[BENCH_THREAD_NUM];
+    bque_u64_t per_thread = op_num_max / thread_num;
+    bque_u64_t left = per_thread * thread_num;
+    bque_conf_t conf = {0};
+    bque_shard_t *shard;
+    bench_res_t res;
+    bench_res_t all;
+    bque_u64_t start;
+    bque_res_t err;
+    bque_u32_t i;
+
+    /* the first consumer may take any share of the buffers. */
+    bench_begin(&res, left / BENCH_BATCH + 1);
+    conf.buff_num_max = 1024;
+    conf.buff_size_max = sizeof(bque_u64_t);
+    conf.alloc_cb = bench_alloc;
+    conf.dealloc_cb = bench_dealloc;
+    err = bque_shard_new(&shard, thread_num, &conf);
+    if (err != BQUE_OK) {
+        bench_fail("threads", name, sizeof(bque_u64_t), &res, err);
+        return;
+    }
+
+    start = bench_clock();
+    for (i = 0; i < thread_num; i++) {
+        prod[i].shard = shard;
+        prod[i].lane = i;
+        prod[i].num = per_thread;
+        cons[i].shard = shard;
+        cons[i].lane = i;
+        cons[i].left = &left;
+        cons[i].res = i == 0 ? &res : NULL;
+        pthread_create(&prod[i].thread, NULL, bench_shard_produce, &prod[i]);
+        pthread_create(&cons[i].thread, NULL, bench_shard_consume, &cons[i]);
+    }
+    for (i = 0; i < thread_num; i++) {
+        pthread_join(prod[i].thread, NULL);
+        pthread_join(cons[i].thread, NULL);
+    }
+
+    /* the rate covers all threads, the percentiles the first consumer. */
+    all = res;
+    all.op_num = per_thread * thread_num;
+    all.time = bench_clock() - start;
+
+    bque_shard_free(shard);
+    bench_report("threads", name, sizeof(bque_u64_t), &all);
+}
+
+#endif
+
+static int bench_selected(int argc, char **argv, const char *workload) {
+    int i;
+
+    if (optind >= argc) {
+        return 1;
+    }
+    for (i = optind; i < argc; i++) {
+        if (strcmp(argv[i], workload) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static const bque_u32_t sizes[] = {8, 64, 512, 4096};
+    static const bque_u32_t sort_nums[] = {1000, 10000, 100000, 1000000};
+    bque_u32_t m;
+    bque_u32_t s;
+    char *endptr;
+    int opt;
+
+    /* Parse the command line arguments. */
+    while ((opt = getopt(argc, argv, BENCH_OPT_STR)) != -1) {
+        switch (opt) {
+            case 'n': {
+                op_num_max = strtoull(optarg, &endptr, 10);
+                if (*endptr != '\0' || op_num_max < BENCH_BATCH) {
+                    fprintf(stderr, "Invalid number: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+            } break;
+
+            default: {
+                fprintf(stderr, BENCH_HELP_STR);
+                exit(EXIT_FAILURE);
+            } break;
+        }
+    }
+
+    printf("%-10s %-8s %7s %14s %9s %9s %9s %10s" BENCH_EOL, "workload", "mode", "size",
+           "ops/s", "p50 ns", "p99 ns", "p99.9 ns", "allocs/op");
+
+    /* The packed mode only takes buffers up to 512 bytes. */
+    for (m = 0; m < BENCH_MODE_NUM; m++) {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            if ((bench_modes[m].flags & BQUE_FLAG_PACKED) && sizes[s] > 512) {
+                continue;
+            }
+            if (bench_selected(argc, argv, "pingpong")) {
+                bench_pingpong(&bench_modes[m], sizes[s]);
+            }
+            if (bench_selected(argc, argv, "burst")) {
+                bench_burst(&bench_modes[m], sizes[s]);
+            }
+        }
+        if (bench_selected(argc, argv, "item")) {
+            bench_item(&bench_modes[m], 8);
+        }
+        if (bench_selected(argc, argv, "insdrop")) {
+            bench_insdrop(&bench_modes[m], 8);
+        }
+    }
+
+    if (bench_selected(argc, argv, "sort")) {
+        for (s = 0; s < sizeof(sort_nums) / sizeof(sort_nums[0]); s++) {
+            for (m = 0; m < BENCH_MODE_NUM; m++) {
+                bench_sort(&bench_modes[m], sort_nums[s]);
+            }
+        }
+    }
+
+#ifdef BQUE_THREADS
+    if (bench_selected(argc, argv, "threads")) {
+        bench_threads("spsc", BQUE_FLAG_SPSC, 1);
+        bench_threads("mpmc", BQUE_FLAG_MPMC, BENCH_THREAD_NUM);
+        bench_shard("shard", BENCH_THREAD_NUM);
+    }
+#endif
+
+    return EXIT_SUCCESS;
+}
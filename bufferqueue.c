@@ -22,21 +22,188 @@
  * SOFTWARE.
  */
 
+/* needed by clock_gettime() and the file functions when compiling in strict
+   standard mode. */
+#if (defined(BQUE_THREADS) || defined(BQUE_FILE) || defined(BQUE_STATS)) && \
+    !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "bufferqueue.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef BQUE_THREADS
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+#ifdef BQUE_STATS
+#include <time.h>
+#endif
+
+#ifdef BQUE_FILE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /* node of the buffer queue. */
 typedef struct _bque_node   bque_node_t;
 
+/* block of the nodes created together by bque_deserialize(). */
+typedef struct _bque_slab   bque_slab_t;
+
+/* strictest alignment required by the buffers stored in the nodes. */
+typedef union _bque_align {
+    void *ptr;
+    long long int lli;
+    double dbl;
+} bque_align_t;
+
 struct _bque_node {
     bque_node_t *prev_node;
     bque_node_t *next_node;
+
+    /* start of the buffer, which moves forward when bque_consume_bytes()
+       trims the head buffer. */
     bque_u8_t *buff;
     bque_size_t size;
+
+    /* number of the bytes the buffer can hold. */
+    bque_size_t cap;
+
+    /* block the node was carved from, NULL for the nodes of their own. */
+    bque_slab_t *slab;
+
+#ifdef BQUE_STATS
+    /* time the buffer was added in nanoseconds, see stats_push(). */
+    bque_u64_t enq_time;
+#endif
+
+    /* the buffer is allocated together with the node, right after it. */
+    bque_align_t data[];
+};
+
+/* block of the nodes created together by bque_deserialize(), the nodes
+   point to it, so it can go with them to another queue. */
+struct _bque_slab {
+
+    /* end of the nodes carved so far, and the number of them still alive,
+       the block is freed with the last one. */
+    bque_u8_t *end;
+    bque_u32_t node_num;
+
+    bque_align_t data[];
+};
+
+/* tower of the index, linking a node to the farther towers. */
+typedef struct _bque_tower  bque_tower_t;
+
+struct _bque_tower {
+    bque_node_t *node;
+
+    /* links of the levels above the nodes, the span is the index distance
+       to the next tower, or to the end of the queue for the last one. */
+    struct _bque_tower_link {
+        bque_tower_t *next;
+        bque_u32_t span;
+    } link[];
 };
 
+/* size of a chunk of the packed mode. */
+#define BQUE_CHUNK_SIZE             2048
+
+/* maximum size of the buffers of the packed mode. */
+#define BQUE_CHUNK_BUFF_SIZE_MAX    512
+
+/* chunk of the packed mode, stored in the buffer of a node. the entries grow
+   from the start of the chunk and list the buffers in queue order, the
+   buffers grow from the end in any order, each at an aligned offset unless
+   its head was consumed by bque_consume_bytes(). the chunks of a fixed
+   buffer size have no entries, their buffers are stored in queue order in
+   aligned slots after the header. */
+typedef struct _bque_chunk {
+    bque_u16_t entry_num;
+
+    /* start of the written data, and the bytes taken by the listed buffers
+       without the holes left by the removed ones. with a fixed buffer size,
+       the slot of the first buffer, and unused. */
+    bque_u16_t data_offs;
+    bque_u16_t data_used;
+
+    /* fixed size of the buffers, 0 means the buffers are listed by the
+       entries. */
+    bque_u16_t elem_size;
+
+    struct _bque_chunk_entry {
+        bque_u16_t offs;
+        bque_u16_t size;
+    } entry[];
+} bque_chunk_t;
+
+#ifdef BQUE_FILE
+
+/* magic number of the files of BQUE_FLAG_FILE, "BQUEFIL1" in little endian. */
+#define BQUE_FILE_MAGIC             0x314C494645555142ULL
+
+/* the file starts with two headers, followed by the records. */
+#define BQUE_FILE_HDR_SIZE          256
+#define BQUE_FILE_DATA_OFFS         (2 * BQUE_FILE_HDR_SIZE)
+
+/* size of the record marking the end of the records before the file end. */
+#define BQUE_FILE_WRAP              0xFFFFFFFFU
+
+/* initial value of the checksums of the file backend. */
+#define BQUE_FILE_SUM_INIT          2166136261U
+
+/* header of a file, recording the queue at a sync. */
+typedef struct _bque_file_hdr {
+    bque_u64_t magic;
+    bque_u64_t gen;
+    bque_u64_t size;
+    bque_u64_t head;
+    bque_u64_t head_seq;
+    bque_u64_t tail;
+    bque_u64_t tail_seq;
+    bque_u64_t buff_bytes;
+    bque_u32_t sum;
+} bque_file_hdr_t;
+
+/* record of a buffer in a file, followed by the buffer padded to 8 bytes.
+   the records are numbered in queue order, and the checksum covers the
+   number, the size and the buffer. */
+typedef struct _bque_file_rec {
+    bque_u64_t seq;
+    bque_u32_t size;
+    bque_u32_t sum;
+} bque_file_rec_t;
+
+/* get the size taken by the record of a buffer. */
+#define file_rec_size(size)         (sizeof(bque_file_rec_t) + \
+                                     (((bque_u64_t)(size) + 7) & ~(bque_u64_t)7))
+
+#endif
+
+/* number of the fingers in the fast indexing cache. */
+#define BQUE_FINGER_NUM             4
+
+/* maximum number of the index levels above the nodes. */
+#define BQUE_INDEX_LEVEL_MAX        16
+
+/* number of the size classes of the node cache, class k holds the nodes
+   whose buffers can hold from 2^k to 2^(k+1) - 1 bytes. */
+#define BQUE_RECYCLE_CLASS_NUM      16
+
 /* context of the buffer queue. */
 struct _bque_ctx {
     bque_node_t *head_node;
@@ -45,859 +212,7186 @@ struct _bque_ctx {
         bque_u32_t node_num_max;
         bque_u32_t buff_size_max;
         bque_free_buff_cb_t free_buff_cb;
+        bque_u32_t elem_size;
+        bque_u32_t flags;
+        bque_sort_cb_t prio_cb;
+        bque_sort_order_t prio_order;
+        bque_u64_t total_bytes_max;
     } conf;
+    struct _bque_ctx_mem {
+        bque_alloc_cb_t alloc_cb;
+        bque_dealloc_cb_t dealloc_cb;
+        void *user;
+
+        /* built-in node pool, free nodes are linked through next_node. */
+        struct _bque_ctx_mem_pool {
+            bque_u8_t *base;
+            bque_u8_t *end;
+            bque_size_t slot_size;
+            bque_node_t *free_node;
+        } pool;
+
+        /* node cache of the recently destroyed nodes by size class, linked
+           through next_node. */
+        struct _bque_ctx_mem_recycle {
+            bque_node_t *free_node[BQUE_RECYCLE_CLASS_NUM];
+            bque_u32_t node_num;
+            bque_u32_t node_num_max;
+        } recycle;
+
+        /* nodes removed with BQUE_FLAG_DEFER_FREE, waiting for bque_reclaim(),
+           linked through next_node. a retired node keeps its buffer pointer
+           only when the buffer is still to be released with the freeing
+           callback. */
+        bque_node_t *retire_node;
+        bque_u32_t retire_num;
+    } mem;
     struct _bque_ctx_cache {
         bque_u32_t node_num;
 
-        /* fast indexing cache to access the last indexed node. */
-        struct _bque_ctx_cache_last {
+        /* number of the buffers dropped by BQUE_FLAG_OVERWRITE. */
+        bque_u64_t drop_num;
+
+        /* bytes held by the linked buffers and taken by their nodes. */
+        bque_u64_t buff_bytes;
+        bque_u64_t mem_bytes;
+
+        /* fast indexing cache of the recently indexed nodes, the most
+           recently used finger comes first. */
+        struct _bque_ctx_cache_finger {
             bque_node_t *node;
             bque_u32_t node_idx;
-        } last;
+        } finger[BQUE_FINGER_NUM];
     } cache;
+
+    /* ring of the nodes in queue order, only used by the ring backend. the
+       slots point at the pool nodes, which keep their links, so the other
+       functions work on this backend unchanged. */
+    struct _bque_ctx_ring {
+        bque_node_t **slot;
+        bque_u32_t slot_num;
+        bque_u32_t head;
+    } ring;
+
+    /* skip list over the nodes, only used by BQUE_FLAG_INDEXED. positions
+       are ranked from 1, the header tower takes rank 0. */
+    struct _bque_ctx_index {
+        bque_tower_t *head;
+        bque_tower_t *last[BQUE_INDEX_LEVEL_MAX];
+        bque_u32_t last_rank[BQUE_INDEX_LEVEL_MAX];
+        bque_u32_t level;
+        bque_u32_t seed;
+    } index;
+
+    /* node reserved by bque_reserve(), waiting for bque_commit(). */
+    bque_node_t *resv_node;
+
+#ifdef BQUE_STATS
+    /* counters of BQUE_STATS, see bque_stat_t. the threads of a shared queue
+       update them with relaxed atomics. */
+    struct _bque_ctx_stats {
+        bque_u64_t enq_num;
+        bque_u64_t deq_num;
+        bque_u64_t full_num;
+        bque_u64_t find_num;
+        bque_u64_t finger_hit_num;
+        bque_u64_t walk_num;
+        bque_u64_t dwell_num[BQUE_STATS_DWELL_NUM];
+        bque_u32_t peak_num;
+    } stats;
+#endif
+
+#ifdef BQUE_FILE
+    /* mapped file of BQUE_FLAG_FILE, the offsets are taken from its start.
+       the space from the head at the last sync on is kept until the next
+       sync, so a crash always finds the records covered by a header. */
+    struct _bque_ctx_file {
+        int fd;
+        bque_u8_t *base;
+        bque_u64_t size;
+        bque_u64_t head;
+        bque_u64_t head_seq;
+        bque_u64_t tail;
+        bque_u64_t tail_seq;
+        bque_u64_t sync_head;
+        bque_u64_t sync_head_seq;
+        bque_u64_t dirty_lo;
+        bque_u64_t dirty_hi;
+        bque_u64_t gen;
+        bque_u32_t sync_num;
+        bque_u32_t op_num;
+    } file;
+#endif
+
+#ifdef BQUE_THREADS
+    /* blocking state of a shared queue, consumers of BQUE_FLAG_MPMC also
+       take turns on the lock. */
+    struct _bque_ctx_sync {
+        pthread_mutex_t lock;
+        pthread_cond_t not_empty;
+        pthread_cond_t not_full;
+        bque_u32_t deq_wait_num;
+        bque_u32_t enq_wait_num;
+
+        /* notification of BQUE_FLAG_NOTIFY, read from the first fd and
+           written to the second, which are the same eventfd on Linux. it's
+           written once until bque_notify_ack() clears the pending flag. */
+        int notify_fd[2];
+        bque_u32_t notify_pend;
+    } sync;
+#endif
+};
+
+#ifdef BQUE_THREADS
+
+/* size the lanes of a sharded queue are padded to, so two threads working on
+   their own lanes don't share cache lines. */
+#define BQUE_CACHE_LINE_SIZE        64
+
+/* lane of a sharded queue, taking its own lock. */
+typedef struct _bque_lane {
+    pthread_mutex_t lock;
+    bque_ctx_t *ctx;
+
+    /* number of the buffers at the last unlock, read without the lock to
+       skip the empty lanes. */
+    bque_u32_t buff_num;
+
+    bque_u8_t pad[BQUE_CACHE_LINE_SIZE];
+} bque_lane_t;
+
+/* sharded queue. */
+struct _bque_shard {
+    bque_dealloc_cb_t dealloc_cb;
+    void *user;
+    bque_u32_t lane_num;
+    bque_lane_t lane[];
 };
 
+#endif
+
 /* default maximum number of the node in a queue. */
 #define BQUE_DEF_NODE_NUM_MAX       1024
 
 /* default maximum number of the node in a queue. */
 #define BQUE_DEF_BUFF_SIZE_MAX      1024
 
-/* get absolute difference of two unsigned integers. */
-#define bque_abs_diff(a, b)         ((a) > (b) ? (a) - (b) : (b) - (a))
+/* default maximum number of the nodes in the node cache. */
+#define BQUE_DEF_RECYCLE_NUM_MAX    16
 
-/**
- * @brief create a queue.
- * 
- * @param ctx the address of the context pointer.
- * @param conf configuration pointer.
-*/
-bque_res_t bque_new(bque_ctx_t **ctx, bque_conf_t *conf) {
-    bque_ctx_t *alloc_ctx;
+/* default size of a new file of BQUE_FLAG_FILE. */
+#define BQUE_DEF_FILE_SIZE          (16 * 1024 * 1024)
 
-    BQUE_ASSERT(ctx != NULL);
+/* number of the descriptors handed to a chunked iterating callback at most. */
+#define BQUE_ITER_VEC_NUM           64
 
-    /* allocate context. */
-    alloc_ctx = (bque_ctx_t *)malloc(sizeof(bque_ctx_t));
-    if (alloc_ctx == NULL)
-    {
-        return BQUE_ERR_NO_MEM;
-    }
+/* number of the buffers a partition of the parallel sorting takes at least. */
+#define BQUE_SORT_PART_SIZE_MIN     4096
 
-    /* initialize context. */
-    memset(alloc_ctx, 0, sizeof(bque_ctx_t));
+/* magic number starting a serialized queue, "BQS1" in little endian. */
+#define BQUE_SERIAL_MAGIC           0x31535142
 
-    /* configure context. */
-    if (conf != NULL) {
-        alloc_ctx->conf.node_num_max = conf->buff_num_max;
-        alloc_ctx->conf.buff_size_max = conf->buff_size_max;
-        alloc_ctx->conf.free_buff_cb = conf->free_buff_cb;
-    } else {
-        alloc_ctx->conf.node_num_max = BQUE_DEF_NODE_NUM_MAX;
-        alloc_ctx->conf.buff_size_max = BQUE_DEF_BUFF_SIZE_MAX;
-        alloc_ctx->conf.free_buff_cb = NULL;
-    }
+/* size of the serialized header, a magic number and the number of the
+   buffers, followed by a length of each buffer, all little endian. */
+#define BQUE_SERIAL_HDR_SIZE        8
 
-    *ctx = alloc_ctx;
+/* get absolute difference of two unsigned integers. */
+#define bque_abs_diff(a, b)         ((a) > (b) ? (a) - (b) : (b) - (a))
 
-    return BQUE_OK;
-}
+/* get the node which the buffer belongs to. */
+#define buff_to_node(buff)          ((bque_node_t *)((bque_u8_t *)(buff) - \
+                                     offsetof(bque_node_t, data)))
+
+/* get the memory taken by a node, the header included. */
+#define node_mem_size(node)         (sizeof(bque_node_t) + (node)->cap)
+
+/* round up a size to the alignment of the node buffer. */
+#define bque_align_up(size)         (((size) + sizeof(bque_align_t) - 1) & \
+                                     ~(sizeof(bque_align_t) - 1))
+
+/* flags of the modes which let several threads use the queue. */
+#define BQUE_SYNC_FLAGS             (BQUE_FLAG_SPSC | BQUE_FLAG_MPMC)
+
+/* check whether the queue is shared between threads. */
+#define bque_is_sync(ctx)           (((ctx)->conf.flags & BQUE_SYNC_FLAGS) != 0)
+
+/* check whether the queue raises its notification fd. */
+#define bque_is_notify(ctx)         (((ctx)->conf.flags & BQUE_FLAG_NOTIFY) != 0)
+
+/* check whether the queue packs its buffers into chunks. */
+#define bque_is_packed(ctx)         (((ctx)->conf.flags & BQUE_FLAG_PACKED) != 0)
+
+/* check whether the queue keeps its buffers in a file. */
+#define bque_is_file(ctx)           (((ctx)->conf.flags & BQUE_FLAG_FILE) != 0)
+
+/* the fixed buffer size is the maximum one as well. */
+#ifdef BQUE_CONF_BUFF_SIZE
+#define BQUE_CONF_BUFF_SIZE_MAX     BQUE_CONF_BUFF_SIZE
+#endif
+
+/* get the limits and the freeing callback of the queue, which are constants
+   when they're fixed at compile time. */
+#ifdef BQUE_CONF_BUFF_NUM_MAX
+#define conf_node_num_max(ctx)      ((bque_u32_t)(BQUE_CONF_BUFF_NUM_MAX))
+#else
+#define conf_node_num_max(ctx)      ((ctx)->conf.node_num_max)
+#endif
+
+#ifdef BQUE_CONF_BUFF_SIZE_MAX
+#define conf_buff_size_max(ctx)     ((bque_u32_t)(BQUE_CONF_BUFF_SIZE_MAX))
+#else
+#define conf_buff_size_max(ctx)     ((ctx)->conf.buff_size_max)
+#endif
+
+#ifdef BQUE_CONF_BUFF_SIZE
+#define conf_elem_size(ctx)         ((bque_u32_t)(BQUE_CONF_BUFF_SIZE))
+#else
+#define conf_elem_size(ctx)         ((ctx)->conf.elem_size)
+#endif
+
+#ifdef BQUE_CONF_FREE_BUFF_CB
+static bque_free_buff_cb_t const conf_free_buff = BQUE_CONF_FREE_BUFF_CB;
+#define conf_free_buff_cb(ctx)      (conf_free_buff)
+#else
+#define conf_free_buff_cb(ctx)      ((ctx)->conf.free_buff_cb)
+#endif
+
+/* get the chunk stored in a node of the packed mode. */
+#define node_to_chunk(node)         ((bque_chunk_t *)(node)->buff)
+
+/* get the start of the slots of a chunk of a fixed buffer size. */
+#define BQUE_CHUNK_SLOT_START       bque_align_up(sizeof(bque_chunk_t))
+
+/* get the size of a slot of a chunk of a fixed buffer size. */
+#define chunk_slot_size(chunk)      bque_align_up((chunk)->elem_size)
+
+/* get the number of the slots of a chunk of a fixed buffer size. */
+#define chunk_slot_num(chunk)       ((BQUE_CHUNK_SIZE - BQUE_CHUNK_SLOT_START) / \
+                                     chunk_slot_size(chunk))
+
+/* get a buffer stored in a chunk. */
+#define chunk_buff(chunk, pos)      ((bque_u8_t *)(chunk) + ((chunk)->elem_size != 0 ? \
+                                     BQUE_CHUNK_SLOT_START + chunk_slot_size(chunk) * \
+                                     ((chunk)->data_offs + (size_t)(pos)) : \
+                                     (chunk)->entry[pos].offs))
+
+/* get the size of a buffer stored in a chunk. */
+#define chunk_size(chunk, pos)      ((chunk)->elem_size != 0 ? (chunk)->elem_size : \
+                                     (chunk)->entry[pos].size)
+
+/* get the end of the entries of a chunk holding a number of buffers. */
+#define chunk_entry_end(num)        (sizeof(bque_chunk_t) + \
+                                     sizeof(struct _bque_chunk_entry) * (num))
+
+#ifdef BQUE_THREADS
+
+/* atomic operations on the fields shared between threads. */
+#define bque_atomic_load(ptr)           __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define bque_atomic_store(ptr, val)     __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define bque_atomic_xchg(ptr, val)      __atomic_exchange_n(ptr, val, __ATOMIC_ACQ_REL)
+#define bque_atomic_cas(ptr, exp, val)  __atomic_compare_exchange_n(ptr, exp, val, 0, \
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define bque_atomic_add(ptr, val)       __atomic_fetch_add(ptr, val, __ATOMIC_ACQ_REL)
+#define bque_atomic_sub(ptr, val)       __atomic_fetch_sub(ptr, val, __ATOMIC_ACQ_REL)
+
+#endif
+
+#ifdef BQUE_STATS
+
+/* add to or get a counter of BQUE_STATS. */
+#ifdef BQUE_THREADS
+#define stats_add(ctx, field, val)  do { \
+                                        if (bque_is_sync(ctx)) { \
+                                            __atomic_fetch_add(&(ctx)->stats.field, val, \
+                                                               __ATOMIC_RELAXED); \
+                                        } else { \
+                                            (ctx)->stats.field += (val); \
+                                        } \
+                                    } while (0)
+#define stats_get(ctx, field)       __atomic_load_n(&(ctx)->stats.field, __ATOMIC_RELAXED)
+#else
+#define stats_add(ctx, field, val)  ((ctx)->stats.field += (val))
+#define stats_get(ctx, field)       ((ctx)->stats.field)
+#endif
 
 /**
- * @brief Free all allocated memory in the queue.
+ * @brief get the time of BQUE_STATS.
  * 
- * @param ctx Context pointer.
- */
-bque_res_t bque_free(bque_ctx_t *ctx) {
-    BQUE_ASSERT(ctx != NULL);
-
-    /* empty the queue. */
-    bque_empty(ctx);
+ * @return monotonic time in nanoseconds.
+*/
+static bque_u64_t stats_now(void) {
+    struct timespec ts;
 
-    /* free context. */
-    free(ctx);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    return BQUE_OK;
+    return (bque_u64_t)ts.tv_sec * 1000000000U + (bque_u64_t)ts.tv_nsec;
 }
 
 /**
- * @brief get the status of the queue.
+ * @brief count a buffer added to the queue.
  * 
  * @param ctx context pointer.
- * @param stat status pointer.
+ * @param node node of the buffer, NULL for the buffers without nodes, which
+ *             aren't timed.
+ * @param now time from stats_now(), not used without the node.
 */
-bque_res_t bque_stat(bque_ctx_t *ctx, bque_stat_t *stat) {
-    BQUE_ASSERT(ctx != NULL);
-    BQUE_ASSERT(stat != NULL);
+static void stats_push(bque_ctx_t *ctx, bque_node_t *node, bque_u64_t now) {
+    bque_u32_t node_num;
 
-    stat->buff_num = ctx->cache.node_num;
+    stats_add(ctx, enq_num, 1);
+    if (node != NULL) {
+        node->enq_time = now;
+    }
 
-    return BQUE_OK;
+    /* the places of a shared queue are taken before linking. */
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        bque_u32_t peak_num = __atomic_load_n(&ctx->stats.peak_num, __ATOMIC_RELAXED);
+
+        node_num = __atomic_load_n(&ctx->cache.node_num, __ATOMIC_RELAXED);
+        while (node_num > peak_num &&
+               !__atomic_compare_exchange_n(&ctx->stats.peak_num, &peak_num, node_num, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+
+        return;
+    }
+#endif
+    node_num = ctx->cache.node_num;
+    if (node_num > ctx->stats.peak_num) {
+        ctx->stats.peak_num = node_num;
+    }
 }
 
 /**
- * @brief create a new node.
+ * @brief count a buffer taken from the queue, and the time it stayed there.
  * 
- * @param node the address of the node pointer.
- * @param size buffer size.
+ * @param ctx context pointer.
+ * @param node node of the buffer, NULL for the buffers without nodes.
 */
-static bque_res_t create_node(bque_node_t **node, bque_u32_t size) {
-    bque_node_t *alloc_node;
-    bque_u8_t *alloc_buff;
+static void stats_pop(bque_ctx_t *ctx, bque_node_t *node) {
+    bque_u64_t dwell;
+    bque_u32_t k = 0;
 
-    BQUE_ASSERT(node != NULL);
+    stats_add(ctx, deq_num, 1);
+    if (node == NULL) {
+        return;
+    }
 
-    /* allocate buffer. */
-    alloc_buff = (bque_u8_t *)malloc(size);
-    if (alloc_buff == NULL) {
-        return BQUE_ERR_NO_MEM;
+    /* bucket k counts from 2^k to 2^(k+1) - 1 microseconds. */
+    dwell = (stats_now() - node->enq_time) / 1000;
+    while (dwell >> (k + 1) != 0 && k + 1 < BQUE_STATS_DWELL_NUM) {
+        k++;
     }
+    stats_add(ctx, dwell_num[k], 1);
+}
 
-    /* allocate node. */
-    alloc_node = (bque_node_t *)malloc(sizeof(bque_node_t));
-    if (alloc_node == NULL) {
-        free(alloc_buff);
+#else
 
-        return BQUE_ERR_NO_MEM;
-    }
+/* the counters are compiled away without BQUE_STATS. */
+#define stats_add(ctx, field, val)  ((void)0)
+#define stats_now()                 0
+#define stats_push(ctx, node, now)  ((void)0)
+#define stats_pop(ctx, node)        ((void)0)
 
-    /* initialize node. */
-    memset(alloc_node, 0, sizeof(bque_node_t));
-    alloc_node->buff = alloc_buff;
-    alloc_node->size = size;
+#endif
 
-    /* return node. */
-    *node = alloc_node;
+/**
+ * @brief allocate memory with the allocator of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param size memory size.
+*/
+static void *mem_alloc(bque_ctx_t *ctx, size_t size) {
+    if (ctx->mem.alloc_cb != NULL) {
+        return ctx->mem.alloc_cb(ctx->mem.user, size);
+    }
 
-    return BQUE_OK;
+    return malloc(size);
 }
 
 /**
- * @brief append a buffer to the tail of the queue.
+ * @brief free memory allocated by mem_alloc().
  * 
  * @param ctx context pointer.
- * @param buff buffer pointer, can be NULL, which means the function will not
- *             copy the buffer.
- * @param size buffer size.
+ * @param ptr memory pointer.
 */
-bque_res_t bque_enqueue(bque_ctx_t *ctx, const void *buff, bque_u32_t size) {
-    bque_node_t *new_node;
-    bque_res_t res;
+static void mem_free(bque_ctx_t *ctx, void *ptr) {
+    if (ctx->mem.dealloc_cb != NULL) {
+        ctx->mem.dealloc_cb(ctx->mem.user, ptr);
+    } else {
+        free(ptr);
+    }
+}
 
-    BQUE_ASSERT(ctx != NULL);
+/**
+ * @brief create the built-in node pool.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t create_pool(bque_ctx_t *ctx) {
+    bque_size_t slot_size;
+    bque_u32_t slot_num;
+    bque_u8_t *base;
+    bque_u32_t i;
 
-    /* check whether the queue is full. */
-    if (ctx->conf.node_num_max != 0 &&
-        ctx->cache.node_num + 1 > ctx->conf.node_num_max) {
-        return BQUE_ERR_FULL_QUE;
+    slot_num = conf_node_num_max(ctx);
+    if (slot_num == 0 || conf_buff_size_max(ctx) == 0) {
+        return BQUE_ERR_BAD_SIZE;
     }
 
-    /* check whether the size is invalid. */
-    if (size == 0 || (ctx->conf.buff_size_max != 0 &&
-                      size > ctx->conf.buff_size_max)) {
+    /* check whether the pool size overflows. */
+    slot_size = bque_align_up(sizeof(bque_node_t) + conf_buff_size_max(ctx));
+    if (slot_size < conf_buff_size_max(ctx) ||
+        (size_t)slot_num > (size_t)-1 / slot_size) {
         return BQUE_ERR_BAD_SIZE;
     }
 
-    /* create a new node. */
-    res = create_node(&new_node, size);
-    if (res != BQUE_OK) {
-        return res;
+    base = (bque_u8_t *)mem_alloc(ctx, (size_t)slot_num * slot_size);
+    if (base == NULL) {
+        return BQUE_ERR_NO_MEM;
     }
 
-    /* if necessary, copy the buffer. */
-    if (buff != NULL) {
-        memcpy(new_node->buff, buff, size);
-    }
+    /* link all the slots to the free list. */
+    ctx->mem.pool.free_node = NULL;
+    for (i = slot_num; i > 0; i--) {
+        bque_node_t *slot_node;
 
-    /* append the node. */
-    if (ctx->tail_node == NULL) {
-        ctx->head_node = new_node;
-        ctx->tail_node = new_node;
-        ctx->cache.node_num = 1;
-    } else {
-        new_node->prev_node = ctx->tail_node;
-        ctx->tail_node->next_node = new_node;
-        ctx->tail_node = new_node;
-        ctx->cache.node_num++;
+        slot_node = (bque_node_t *)(base + (size_t)(i - 1) * slot_size);
+        slot_node->next_node = ctx->mem.pool.free_node;
+        ctx->mem.pool.free_node = slot_node;
     }
 
+    ctx->mem.pool.base = base;
+    ctx->mem.pool.end = base + (size_t)slot_num * slot_size;
+    ctx->mem.pool.slot_size = slot_size;
+
     return BQUE_OK;
 }
 
 /**
- * @brief append a buffer to the head of the queue.
+ * @brief create the ring of the ring backend.
  * 
  * @param ctx context pointer.
- * @param buff buffer pointer, can be NULL, which means the function will not
- *             copy the buffer.
- * @param size buffer size.
 */
-bque_res_t bque_preempt(bque_ctx_t *ctx, const void *buff, bque_u32_t size) {
-    bque_node_t *new_node;
-    bque_res_t res;
-
-    BQUE_ASSERT(ctx != NULL);
+static bque_res_t create_ring(bque_ctx_t *ctx) {
+    bque_u32_t slot_num;
 
-    /* check whether the queue is full. */
-    if (ctx->conf.node_num_max != 0 &&
-        ctx->cache.node_num + 1 > ctx->conf.node_num_max) {
-        return BQUE_ERR_FULL_QUE;
+    slot_num = conf_node_num_max(ctx);
+    if (slot_num == 0 || conf_buff_size_max(ctx) == 0) {
+        return BQUE_ERR_BAD_SIZE;
     }
-
-    /* check whether the size is invalid. */
-    if (size == 0 || (ctx->conf.buff_size_max != 0 &&
-                      size > ctx->conf.buff_size_max)) {
+    if ((size_t)slot_num * sizeof(bque_node_t *) / sizeof(bque_node_t *) !=
+        slot_num) {
         return BQUE_ERR_BAD_SIZE;
     }
 
-    /* create a new node. */
-    res = create_node(&new_node, size);
-    if (res != BQUE_OK) {
-        return res;
+    ctx->ring.slot = (bque_node_t **)mem_alloc(ctx, sizeof(bque_node_t *) *
+                                                    (size_t)slot_num);
+    if (ctx->ring.slot == NULL) {
+        return BQUE_ERR_NO_MEM;
     }
+    ctx->ring.slot_num = slot_num;
+    ctx->ring.head = 0;
 
-    /* if necessary, copy the buffer. */
-    if (buff != NULL) {
-        memcpy(new_node->buff, buff, size);
-    }
+    return BQUE_OK;
+}
 
-    /* append the node. */
-    if (ctx->head_node == NULL) {
-        ctx->head_node = new_node;
-        ctx->tail_node = new_node;
-        ctx->cache.node_num = 1;
-    } else {
-        new_node->next_node = ctx->head_node;
-        ctx->head_node->prev_node = new_node;
-        ctx->head_node = new_node;
-        ctx->cache.node_num++;
-    }
+/**
+ * @brief get the slot position of a node in the ring.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the node.
+*/
+static inline bque_u32_t ring_pos(bque_ctx_t *ctx, bque_u32_t idx) {
+    bque_u32_t pos;
 
-    /* update the fast indexing cache. */
-    if (ctx->cache.last.node != NULL) {
-        ctx->cache.last.node_idx++;
+    pos = ctx->ring.head + idx;
+    if (pos >= ctx->ring.slot_num) {
+        pos -= ctx->ring.slot_num;
     }
 
-    return BQUE_OK;
+    return pos;
 }
 
 /**
- * @brief insert a buffer to the queue.
+ * @brief put a node into the ring, the nodes from the index on move back.
  * 
- * @note the buffer will be inserted to the specified index.
+ * @note the shorter side of the ring is shifted.
  * 
  * @param ctx context pointer.
- * @param idx index of the inserted buffer.
- * @param buff buffer pointer.
- * @param size buffer size.
+ * @param node node pointer.
+ * @param idx index of the node, the node number must not be updated yet.
 */
-bque_res_t bque_insert(bque_ctx_t *ctx, bque_u32_t idx, const void *buff, bque_u32_t size) {
-    bque_node_t *new_node;
-    bque_res_t res;
+static void ring_insert(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t idx) {
+    bque_node_t **slot = ctx->ring.slot;
+    bque_u32_t node_num = ctx->cache.node_num;
     bque_u32_t i;
 
-    BQUE_ASSERT(ctx != NULL);
-
-    /* check whether the queue is full. */
-    if (ctx->conf.node_num_max != 0 &&
-        ctx->cache.node_num + 1 > ctx->conf.node_num_max) {
-        return BQUE_ERR_FULL_QUE;
-    }
-
-    /* check whether the size is invalid. */
-    if (size == 0 || (ctx->conf.buff_size_max != 0 &&
-                      size > ctx->conf.buff_size_max)) {
-        return BQUE_ERR_BAD_SIZE;
-    }
+    if (idx < node_num - idx) {
 
-    /* check whether the idx is invalid. */
-    if (idx > ctx->cache.node_num) {
-        return BQUE_ERR_BAD_OFFS;
-    }
+        /* move the nodes before the index one slot forward. */
+        ctx->ring.head = ctx->ring.head == 0 ? ctx->ring.slot_num - 1 :
+                                                ctx->ring.head - 1;
+        for (i = 0; i < idx; i++) {
+            slot[ring_pos(ctx, i)] = slot[ring_pos(ctx, i + 1)];
+        }
+    } else {
 
-    /* create a new node. */
-    res = create_node(&new_node, size);
-    if (res != BQUE_OK) {
-        return res;
+        /* move the nodes from the index one slot backward. */
+        for (i = node_num; i > idx; i--) {
+            slot[ring_pos(ctx, i)] = slot[ring_pos(ctx, i - 1)];
+        }
     }
+    slot[ring_pos(ctx, idx)] = node;
+}
 
-    /* copy the buffer. */
-    if (buff != NULL) {
-        memcpy(new_node->buff, buff, size);
-    }
+/**
+ * @brief take a node out of the ring, the nodes after the index move forward.
+ * 
+ * @note the shorter side of the ring is shifted.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the node, the node number must not be updated yet.
+*/
+static void ring_remove(bque_ctx_t *ctx, bque_u32_t idx) {
+    bque_node_t **slot = ctx->ring.slot;
+    bque_u32_t node_num = ctx->cache.node_num;
+    bque_u32_t i;
 
-    /* insert the node. */
-    if (idx == 0) {
+    if (idx < node_num - 1 - idx) {
 
-        /* insert to the head. */
-        if (ctx->head_node == NULL) {
-            ctx->head_node = new_node;
-            ctx->tail_node = new_node;
-        } else {
-            new_node->next_node = ctx->head_node;
-            ctx->head_node->prev_node = new_node;
-            ctx->head_node = new_node;
+        /* move the nodes before the index one slot backward. */
+        for (i = idx; i > 0; i--) {
+            slot[ring_pos(ctx, i)] = slot[ring_pos(ctx, i - 1)];
         }
-    } else if (idx == ctx->cache.node_num) {
-
-        /* insert to the tail. */
-        new_node->prev_node = ctx->tail_node;
-        ctx->tail_node->next_node = new_node;
-        ctx->tail_node = new_node;
+        ctx->ring.head = ring_pos(ctx, 1);
     } else {
 
-        /* insert to the middle. */
-        bque_node_t *curt_node = ctx->head_node;
-
-        for (i = 0; i < idx; i++) {
-            curt_node = curt_node->next_node;
+        /* move the nodes after the index one slot forward. */
+        for (i = idx; i + 1 < node_num; i++) {
+            slot[ring_pos(ctx, i)] = slot[ring_pos(ctx, i + 1)];
         }
-        new_node->prev_node = curt_node->prev_node;
-        new_node->next_node = curt_node;
-        curt_node->prev_node->next_node = new_node;
-        curt_node->prev_node = new_node;
     }
+}
 
-    /* update the node number. */
-    ctx->cache.node_num++;
+/**
+ * @brief refill the ring from the linked nodes.
+ * 
+ * @param ctx context pointer.
+*/
+static void ring_rebuild(bque_ctx_t *ctx) {
+    bque_node_t *curt_node;
+    bque_u32_t i = 0;
 
-    /* update the fast indexing cache. */
-    if (ctx->cache.last.node != NULL) {
-        if (ctx->cache.last.node_idx >= idx) {
-            ctx->cache.last.node_idx++;
-        }
+    for (curt_node = ctx->head_node; curt_node != NULL;
+         curt_node = curt_node->next_node) {
+        ctx->ring.slot[i++] = curt_node;
+    }
+    ctx->ring.head = 0;
+}
+
+/**
+ * @brief create the header tower of the index.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t create_index(bque_ctx_t *ctx) {
+    ctx->index.head = (bque_tower_t *)mem_alloc(ctx, sizeof(bque_tower_t) +
+        sizeof(struct _bque_tower_link) * BQUE_INDEX_LEVEL_MAX);
+    if (ctx->index.head == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+    ctx->index.head->node = NULL;
+    ctx->index.level = 0;
+    ctx->index.seed = 0x9E3779B9u ^ (bque_u32_t)(size_t)ctx;
+    if (ctx->index.seed == 0) {
+        ctx->index.seed = 1;
     }
 
     return BQUE_OK;
 }
 
 /**
- * @brief detach a buffer from the head of the queue.
+ * @brief pick the number of levels of a new tower.
+ * 
+ * @note each level is taken with a probability of 1/4, so most nodes get no
+ *       tower at all.
  * 
  * @param ctx context pointer.
- * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
- * @param size size pointer, when it's NULL, the size won't be copied.
 */
-bque_res_t bque_dequeue(bque_ctx_t *ctx, void *buff, bque_u32_t *size) {
-    BQUE_ASSERT(ctx != NULL);
-
-    /* check whether the queue is empty. */
-    if (ctx->cache.node_num == 0) {
-        return BQUE_ERR_EMPTY_QUE;
+static bque_u32_t index_level(bque_ctx_t *ctx) {
+    bque_u32_t x = ctx->index.seed;
+    bque_u32_t level = 0;
+
+    /* xorshift32. */
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ctx->index.seed = x;
+
+    while ((x & 3) == 0 && level < BQUE_INDEX_LEVEL_MAX) {
+        level++;
+        x >>= 2;
     }
 
-    /* if necessary, output the buffer and buffer size of the head node. */
-    if (buff != NULL) {
-        memcpy(buff, ctx->head_node->buff, ctx->head_node->size);
-    }
-    if (size != NULL) {
-        *size = ctx->head_node->size;
-    }
-
-    /* remove the node. */
-    if (ctx->cache.node_num == 1) {
-        free(ctx->head_node->buff);
-        free(ctx->head_node);
-        ctx->head_node = NULL;
-        ctx->tail_node = NULL;
-        ctx->cache.node_num = 0;
-    } else {
-        bque_node_t *curt_node;
-
-        curt_node = ctx->head_node;
-        ctx->head_node = curt_node->next_node;
-        ctx->head_node->prev_node = NULL;
-        free(curt_node->buff);
-        free(curt_node);
-        ctx->cache.node_num--;
-    }
+    return level;
+}
 
-    /* update the fast indexing cache. */
-    if (ctx->cache.last.node != NULL) {
-        if (ctx->cache.last.node_idx == 0) {
-            ctx->cache.last.node = NULL;
-            ctx->cache.last.node_idx = 0;
-        } else {
-            ctx->cache.last.node_idx--;
+/**
+ * @brief find the last tower before a rank on every level.
+ * 
+ * @param ctx context pointer.
+ * @param rank rank to stop before.
+ * @param update the last tower before the rank on every level.
+ * @param update_rank ranks of the towers.
+*/
+static void index_search(bque_ctx_t *ctx, bque_u32_t rank,
+                         bque_tower_t **update, bque_u32_t *update_rank) {
+    bque_tower_t *curt_tower = ctx->index.head;
+    bque_u32_t curt_rank = 0;
+    bque_u32_t l;
+
+    for (l = ctx->index.level; l-- > 0;) {
+        while (curt_tower->link[l].next != NULL &&
+               curt_rank + curt_tower->link[l].span < rank) {
+            curt_rank += curt_tower->link[l].span;
+            curt_tower = curt_tower->link[l].next;
         }
+        update[l] = curt_tower;
+        update_rank[l] = curt_rank;
     }
-
-    return BQUE_OK;
 }
 
 /**
- * @brief detach a buffer from the tail of the queue.
+ * @brief find a node by index through the index.
  * 
  * @param ctx context pointer.
- * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
- * @param size size pointer, when it's NULL, the size won't be copied.
+ * @param idx valid index of the node.
 */
-bque_res_t bque_forfeit(bque_ctx_t *ctx, void *buff, bque_u32_t *size) {
-    BQUE_ASSERT(ctx != NULL);
-
-    /* check whether the queue is empty. */
-    if (ctx->cache.node_num == 0) {
-        return BQUE_ERR_EMPTY_QUE;
-    }
-
-    /* if necessary, output the buffer and buffer size of the head node. */
-    if (buff != NULL) {
-        memcpy(buff, ctx->tail_node->buff, ctx->tail_node->size);
-    }
-    if (size != NULL) {
-        *size = ctx->tail_node->size;
+static bque_node_t *index_find(bque_ctx_t *ctx, bque_u32_t idx) {
+    bque_tower_t *curt_tower = ctx->index.head;
+    bque_node_t *curt_node;
+    bque_u32_t curt_rank = 0;
+    bque_u32_t rank = idx + 1;
+    bque_u32_t l;
+
+    for (l = ctx->index.level; l-- > 0;) {
+        while (curt_tower->link[l].next != NULL &&
+               curt_rank + curt_tower->link[l].span <= rank) {
+            curt_rank += curt_tower->link[l].span;
+            curt_tower = curt_tower->link[l].next;
+        }
     }
 
-    /* remove the node. */
-    if (ctx->cache.node_num == 1) {
-        free(ctx->tail_node->buff);
-        free(ctx->tail_node);
-        ctx->head_node = NULL;
-        ctx->tail_node = NULL;
-        ctx->cache.node_num = 0;
+    /* walk the rest of the way on the nodes. */
+    if (curt_rank == 0) {
+        curt_node = ctx->head_node;
+        curt_rank = 1;
     } else {
-        bque_node_t *curt_node;
-
-        curt_node = ctx->tail_node;
-        ctx->tail_node = curt_node->prev_node;
-        ctx->tail_node->next_node = NULL;
-        free(curt_node->buff);
-        free(curt_node);
-        ctx->cache.node_num--;
+        curt_node = curt_tower->node;
     }
-
-    /* update the fast indexing cache. */
-    if (ctx->cache.last.node != NULL) {
-        if (ctx->cache.last.node_idx == ctx->cache.node_num) {
-            ctx->cache.last.node = NULL;
-            ctx->cache.last.node_idx = 0;
-        }
+    while (curt_rank < rank) {
+        curt_node = curt_node->next_node;
+        curt_rank++;
     }
 
-    return BQUE_OK;
+    return curt_node;
 }
 
 /**
- * @brief detach a buffer from the queue by index.
+ * @brief add a node to the index.
+ * 
+ * @note the last towers are used directly when appending. when the tower
+ *       can't be allocated the node is just left out of the upper levels.
  * 
  * @param ctx context pointer.
- * @param idx index of the buffer to be detached.
- * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
- * @param size size pointer, when it's NULL, the size won't be copied.
+ * @param node node pointer.
+ * @param idx index of the node, the node number must not be updated yet.
 */
-bque_res_t bque_drop(bque_ctx_t *ctx, bque_u32_t idx, void *buff, bque_u32_t *size) {
-    bque_node_t *curt_node;
-    bque_u32_t curt_idx;
-
-    BQUE_ASSERT(ctx != NULL);
-
-    /* check whether the queue is empty. */
-    if (ctx->cache.node_num == 0) {
-        return BQUE_ERR_EMPTY_QUE;
-    }
-
-    /* check whether the index is valid. */
-    if (idx >= ctx->cache.node_num) {
-        return BQUE_ERR_BAD_IDX;
+static void index_insert(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t idx) {
+    bque_tower_t *update[BQUE_INDEX_LEVEL_MAX];
+    bque_u32_t update_rank[BQUE_INDEX_LEVEL_MAX];
+    bque_tower_t *new_tower = NULL;
+    bque_u32_t rank = idx + 1;
+    bque_u32_t level;
+    bque_u32_t l;
+
+    /* create the tower of the node. */
+    level = index_level(ctx);
+    if (level > 0) {
+        new_tower = (bque_tower_t *)mem_alloc(ctx, sizeof(bque_tower_t) +
+            sizeof(struct _bque_tower_link) * level);
+        if (new_tower == NULL) {
+            level = 0;
+        } else {
+            new_tower->node = node;
+        }
     }
 
-    /* find the node. */
-    curt_node = ctx->head_node;
-    curt_idx = 0;
-    while (curt_idx < idx) {
-        curt_node = curt_node->next_node;
-        curt_idx++;
+    /* find the towers before the node. */
+    if (idx == ctx->cache.node_num) {
+        for (l = 0; l < ctx->index.level; l++) {
+            update[l] = ctx->index.last[l];
+            update_rank[l] = ctx->index.last_rank[l];
+        }
+    } else {
+        index_search(ctx, rank, update, update_rank);
     }
 
-    /* if necessary, output the buffer and buffer size of the node. */
-    if (buff != NULL) {
-        memcpy(buff, curt_node->buff, curt_node->size);
+    /* open the new levels. */
+    for (l = ctx->index.level; l < level; l++) {
+        ctx->index.head->link[l].next = NULL;
+        ctx->index.head->link[l].span = ctx->cache.node_num + 1;
+        ctx->index.last[l] = ctx->index.head;
+        ctx->index.last_rank[l] = 0;
+        update[l] = ctx->index.head;
+        update_rank[l] = 0;
     }
-    if (size != NULL) {
-        *size = curt_node->size;
+    if (level > ctx->index.level) {
+        ctx->index.level = level;
     }
 
-    /* remove the node. */
-    if (ctx->cache.node_num == 1) {
-        free(curt_node->buff);
-        free(curt_node);
-        ctx->head_node = NULL;
-        ctx->tail_node = NULL;
-        ctx->cache.node_num = 0;
-    } else {
-        if (curt_node == ctx->head_node) {
-            ctx->head_node = curt_node->next_node;
-            ctx->head_node->prev_node = NULL;
-        } else if (curt_node == ctx->tail_node) {
-            ctx->tail_node = curt_node->prev_node;
-            ctx->tail_node->next_node = NULL;
+    /* link the tower, the spans over the node grow by one. */
+    for (l = 0; l < ctx->index.level; l++) {
+        if (l < level) {
+            new_tower->link[l].next = update[l]->link[l].next;
+            new_tower->link[l].span = update_rank[l] + update[l]->link[l].span +
+                                      1 - rank;
+            update[l]->link[l].next = new_tower;
+            update[l]->link[l].span = rank - update_rank[l];
         } else {
-            curt_node->prev_node->next_node = curt_node->next_node;
-            curt_node->next_node->prev_node = curt_node->prev_node;
+            update[l]->link[l].span++;
         }
-        free(curt_node->buff);
-        free(curt_node);
-        ctx->cache.node_num--;
-    }
 
-    /* update the fast indexing cache. */
-    if (ctx->cache.last.node != NULL) {
-        if (ctx->cache.last.node_idx == idx) {
-            ctx->cache.last.node = NULL;
-            ctx->cache.last.node_idx = 0;
-        } else if (ctx->cache.last.node_idx > idx) {
-            ctx->cache.last.node_idx--;
+        /* update the last towers. */
+        if (ctx->index.last_rank[l] >= rank) {
+            ctx->index.last_rank[l]++;
+        }
+        if (l < level && new_tower->link[l].next == NULL) {
+            ctx->index.last[l] = new_tower;
+            ctx->index.last_rank[l] = rank;
         }
     }
-
-    return BQUE_OK;
 }
 
 /**
- * @brief empty the queue.
+ * @brief remove a node from the index.
  * 
  * @param ctx context pointer.
+ * @param idx index of the node.
 */
-bque_res_t bque_empty(bque_ctx_t *ctx) {
-    bque_node_t *curt_node;
-    bque_node_t *next_node;
-
-    BQUE_ASSERT(ctx != NULL);
+static void index_remove(bque_ctx_t *ctx, bque_u32_t idx) {
+    bque_tower_t *update[BQUE_INDEX_LEVEL_MAX];
+    bque_u32_t update_rank[BQUE_INDEX_LEVEL_MAX];
+    bque_tower_t *old_tower = NULL;
+    bque_tower_t *next_tower;
+    bque_u32_t rank = idx + 1;
+    bque_u32_t l;
+
+    index_search(ctx, rank, update, update_rank);
+
+    /* unlink the tower of the node, the spans over the node shrink by one. */
+    for (l = 0; l < ctx->index.level; l++) {
+        next_tower = update[l]->link[l].next;
+        if (next_tower != NULL &&
+            update_rank[l] + update[l]->link[l].span == rank) {
+            update[l]->link[l].span += next_tower->link[l].span - 1;
+            update[l]->link[l].next = next_tower->link[l].next;
+            old_tower = next_tower;
+        } else {
+            update[l]->link[l].span--;
+        }
 
-    /* check whether the queue is empty. */
-    if (ctx->cache.node_num == 0) {
-        return BQUE_OK;
+        /* update the last towers. */
+        if (ctx->index.last_rank[l] == rank) {
+            ctx->index.last[l] = update[l];
+            ctx->index.last_rank[l] = update_rank[l];
+        } else if (ctx->index.last_rank[l] > rank) {
+            ctx->index.last_rank[l]--;
+        }
+    }
+    if (old_tower != NULL) {
+        mem_free(ctx, old_tower);
     }
 
-    /* remove all nodes. */
-    curt_node = ctx->head_node;
-    if (ctx->conf.free_buff_cb != NULL) {
-        bque_free_buff_cb_t free_buff_cb;
-
-        free_buff_cb = ctx->conf.free_buff_cb;
-        while (curt_node != NULL) {
-            next_node = curt_node->next_node;
-            free_buff_cb(curt_node->buff, curt_node->size);
-            free(curt_node->buff);
-            free(curt_node);
-            curt_node = next_node;
-        }
-    } else {
-        while (curt_node != NULL) {
-            next_node = curt_node->next_node;
-            free(curt_node->buff);
-            free(curt_node);
-            curt_node = next_node;
-        }
+    /* close the empty levels. */
+    while (ctx->index.level > 0 &&
+           ctx->index.head->link[ctx->index.level - 1].next == NULL) {
+        ctx->index.level--;
     }
+}
 
-    /* reset context. */
-    ctx->head_node = NULL;
-    ctx->tail_node = NULL;
-    ctx->cache.node_num = 0;
+/**
+ * @brief remove all towers from the index.
+ * 
+ * @param ctx context pointer.
+*/
+static void index_clear(bque_ctx_t *ctx) {
+    bque_tower_t *curt_tower;
+    bque_tower_t *next_tower;
 
-    /* update the fast indexing cache. */
-    if (ctx->cache.last.node != NULL) {
-        ctx->cache.last.node = NULL;
-        ctx->cache.last.node_idx = 0;
+    if (ctx->index.level == 0) {
+        return;
     }
-
-    return BQUE_OK;
+    curt_tower = ctx->index.head->link[0].next;
+    while (curt_tower != NULL) {
+        next_tower = curt_tower->link[0].next;
+        mem_free(ctx, curt_tower);
+        curt_tower = next_tower;
+    }
+    ctx->index.level = 0;
 }
 
 /**
- * @brief Get buffer in the queue by index.
+ * @brief rebuild the index from the linked nodes.
  * 
- * @note Parameters `buff` and `size` must not be NULL at the same time.
- * 
- * @param ctx The context pointer.
- * @param idx The buffer index, 0 and the positive value indicates forward
- *            indexing and the negative value indicates backward indexing.
- * @param buff The buffer pointer.
- * @param size The buffer size pointer.
- */
-bque_res_t bque_item(bque_ctx_t *ctx, bque_s32_t idx,
-                     void **buff, bque_size_t *size) {
-    bque_iter_order_t iter_order = BQUE_ITER_FORWARD;
-    bque_u32_t node_num;
-    bque_u32_t node_idx_max;
-    bque_u32_t forward_node_idx;
-    bque_u32_t curt_node_idx;
-    bque_u32_t temp_node_idx_diff;
-    bque_u32_t node_idx_diff = 0xFFFFFFFF;
+ * @param ctx context pointer.
+*/
+static void index_rebuild(bque_ctx_t *ctx) {
     bque_node_t *curt_node;
 
-    BQUE_ASSERT(ctx != NULL);
-    BQUE_ASSERT(buff != NULL ||
-                size != NULL);
+    index_clear(ctx);
 
-    /* check whether the queue is empty. */
-    node_num = ctx->cache.node_num;
-    if (node_num == 0) {
-        return BQUE_ERR_EMPTY_QUE;
+    /* append the nodes one by one, counting them again. */
+    ctx->cache.node_num = 0;
+    for (curt_node = ctx->head_node; curt_node != NULL;
+         curt_node = curt_node->next_node) {
+        index_insert(ctx, curt_node, ctx->cache.node_num);
+        ctx->cache.node_num++;
     }
+}
 
-    /* check whether the index is valid. */
-    node_idx_max = node_num - 1;
-    if (idx >= 0) {
-        forward_node_idx = (bque_u32_t)idx;
-        if (forward_node_idx > node_idx_max) {
-            return BQUE_ERR_BAD_IDX;
-        }
-    } else {
-        bque_u32_t temp;
-
-        temp = (bque_u32_t)(-idx);
-        if (temp > node_num) {
-            return BQUE_ERR_BAD_IDX;
-        }
+#ifdef BQUE_THREADS
 
-        forward_node_idx = node_num - temp;
+/**
+ * @brief close the notification fd of a shared queue.
+ * 
+ * @param ctx context pointer.
+*/
+static void notify_close(bque_ctx_t *ctx) {
+    close(ctx->sync.notify_fd[0]);
+    if (ctx->sync.notify_fd[1] != ctx->sync.notify_fd[0]) {
+        close(ctx->sync.notify_fd[1]);
     }
+}
 
-    /* if fast indexing is available, check whether the last indexed node is
-       closer. */
-    if (ctx->cache.last.node != NULL) {
-        if (forward_node_idx > ctx->cache.last.node_idx) {
-            node_idx_diff = forward_node_idx - ctx->cache.last.node_idx;
-            iter_order = BQUE_ITER_FORWARD;
-        } else if (forward_node_idx < ctx->cache.last.node_idx) {
-            node_idx_diff = ctx->cache.last.node_idx - forward_node_idx;
-            iter_order = BQUE_ITER_BACKWARD;
-        } else {
-            if (buff != NULL) {
-                *buff = ctx->cache.last.node->buff;
-            }
-            if (size != NULL) {
-                *size = ctx->cache.last.node->size;
-            }
+/**
+ * @brief create the notification fd of a shared queue.
+ * 
+ * @note Linux gets an eventfd, the other systems get a pipe. both ends are
+ *       non-blocking.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t notify_open(bque_ctx_t *ctx) {
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-            return BQUE_OK;
-        }
-        curt_node = ctx->cache.last.node;
-        curt_node_idx = ctx->cache.last.node_idx;
+    if (fd < 0) {
+        return BQUE_ERR;
     }
+    ctx->sync.notify_fd[0] = fd;
+    ctx->sync.notify_fd[1] = fd;
+#else
+    int i;
 
-    /* check whether the head node is closer. */
-    temp_node_idx_diff = bque_abs_diff(forward_node_idx, 0);
-    if (temp_node_idx_diff < node_idx_diff) {
-        node_idx_diff = temp_node_idx_diff;
-        curt_node = ctx->head_node;
-        curt_node_idx = 0;
-        iter_order = BQUE_ITER_FORWARD;
+    if (pipe(ctx->sync.notify_fd) != 0) {
+        return BQUE_ERR;
     }
+    for (i = 0; i < 2; i++) {
+        int fd = ctx->sync.notify_fd[i];
+        int fl = fcntl(fd, F_GETFL);
 
-    /* check whether the tail node is closer. */
-    temp_node_idx_diff = bque_abs_diff(forward_node_idx, node_idx_max);
-    if (temp_node_idx_diff < node_idx_diff) {
-        node_idx_diff = temp_node_idx_diff;
-        curt_node = ctx->tail_node;
-        curt_node_idx = node_idx_max;
-        iter_order = BQUE_ITER_BACKWARD;
-    }
+        if (fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0 ||
+            fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+            notify_close(ctx);
 
-    /* find the node indexed by forward_node_idx. */
-    if (iter_order == BQUE_ITER_FORWARD) {
-        while (curt_node_idx != forward_node_idx) {
-            curt_node = curt_node->next_node;
-            curt_node_idx++;
-        }
-    } else {
-        while (curt_node_idx != forward_node_idx) {
-            curt_node = curt_node->prev_node;
-            curt_node_idx--;
+            return BQUE_ERR;
         }
     }
-
-    /* update the cache. */
-    ctx->cache.last.node = curt_node;
-    ctx->cache.last.node_idx = curt_node_idx;
-
-    /* copy the buffer information. */
-    if (buff != NULL) {
-        *buff = curt_node->buff;
-    }
-    if (size != NULL) {
-        *size = curt_node->size;
-    }
+#endif
 
     return BQUE_OK;
 }
 
 /**
- * @brief sort the buffer queue.
- * 
- * @note this function will sort the queue in specified order, and the callback
- *       function will be called to compare two buffers, the callback function
- *       should return BQUE_SORT_EQUAL if the two buffers are equal, and return
- *       BQUE_SORT_GREATER if the first buffer is greater than the second one,
- *       and return BQUE_SORT_LESS if the first buffer is less than the second
- *       one.
+ * @brief raise the notification fd of a shared queue, unless it's pending.
  * 
  * @param ctx context pointer.
- * @param cb sorting callback, used to compare two buffers.
- * @param order sorting order, BQUE_SORT_ASCENDING or BQUE_SORT_DESCENDING.
 */
-bque_res_t bque_sort(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order) {
-    bque_sort_res_t sort_res;
-    bque_node_t **node_array;
-    bque_node_t *curt_node;
-    bque_node_t *temp_node;
-    bque_u32_t node_num;
-    bque_u32_t node_idx;
+static void notify_raise(bque_ctx_t *ctx) {
+    bque_u64_t val = 1;
 
-    BQUE_ASSERT(ctx != NULL);
-    BQUE_ASSERT(cb != NULL);
-    BQUE_ASSERT(order == BQUE_SORT_ASCENDING ||
-                order == BQUE_SORT_DESCENDING);
+    /* pairs with the swap of bque_notify_ack(), so either the change before
+       this is seen after the acknowledgement, or the fd is written. */
+    if (__atomic_exchange_n(&ctx->sync.notify_pend, 1, __ATOMIC_SEQ_CST) != 0) {
+        return;
+    }
 
-    /* check whether the queue is empty. */
-    node_num = ctx->cache.node_num;
-    if (node_num == 0) {
-        return BQUE_ERR_EMPTY_QUE;
-    } else if (node_num == 1) {
-        return BQUE_OK;
+    /* a full pipe is readable already. */
+    while (write(ctx->sync.notify_fd[1], &val, sizeof(val)) < 0 && errno == EINTR) {
     }
+}
 
-    /* allocate memory for the node array. */
-    node_array = (bque_node_t **)malloc(sizeof(bque_node_t *) * node_num);
-    if (node_array == NULL) {
-        return BQUE_ERR_NO_MEM;
+/**
+ * @brief initialize the blocking state of a shared queue.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t sync_init(bque_ctx_t *ctx) {
+    pthread_condattr_t cond_attr;
+
+    if (pthread_condattr_init(&cond_attr) != 0) {
+        return BQUE_ERR;
     }
 
-    /* copy all the pointers of all nodes to the array. */
-    curt_node = ctx->head_node;
-    node_idx = 0;
-    do {
-        node_array[node_idx] = curt_node;
-        curt_node = curt_node->next_node;
-        node_idx++;
-    } while (curt_node != NULL);
+    /* time out against the monotonic clock. */
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
 
-    /* sort the node array by the specified order using bubble sort. */
-    if (order == BQUE_SORT_ASCENDING) {
-        for (bque_u32_t i = 0; i < node_num - 1; i++) {
-            for (bque_u32_t j = 0; j < node_num - i - 1; j++) {
-                bque_node_t *node_a;
-                bque_node_t *node_b;
-
-                node_a = node_array[j];
-                node_b = node_array[j + 1];
-                sort_res = cb(node_a->buff, node_a->size, node_b->buff, node_b->size);
-                if (sort_res == BQUE_SORT_GREATER) {
-                    temp_node = node_array[j];
-                    node_array[j] = node_array[j + 1];
-                    node_array[j + 1] = temp_node;
-                }
-            }
-        }
-    } else {
-        for (bque_u32_t i = 0; i < node_num - 1; i++) {
-            for (bque_u32_t j = 0; j < node_num - i - 1; j++) {
-                bque_node_t *node_a;
-                bque_node_t *node_b;
+    if (pthread_mutex_init(&ctx->sync.lock, NULL) != 0) {
+        pthread_condattr_destroy(&cond_attr);
 
-                node_a = node_array[j];
-                node_b = node_array[j + 1];
-                sort_res = cb(node_a->buff, node_a->size, node_b->buff, node_b->size);
-                if (sort_res == BQUE_SORT_LESS) {
-                    temp_node = node_array[j];
-                    node_array[j] = node_array[j + 1];
-                    node_array[j + 1] = temp_node;
-                }
-            }
-        }
+        return BQUE_ERR;
     }
+    if (pthread_cond_init(&ctx->sync.not_empty, &cond_attr) != 0) {
+        pthread_mutex_destroy(&ctx->sync.lock);
+        pthread_condattr_destroy(&cond_attr);
 
-    /* link all the nodes in the array. */
-    for (bque_u32_t i = 0; i < node_num; i++) {
-        if (i == 0) {
-            ctx->head_node = node_array[0];
-            node_array[0]->prev_node = NULL;
-            node_array[0]->next_node = node_array[1];
-        } else if (i == node_num - 1) {
-            ctx->tail_node = node_array[i];
-            node_array[i]->prev_node = node_array[i - 1];
-            node_array[i]->next_node = NULL;
-        } else {
-            node_array[i]->prev_node = node_array[i - 1];
-            node_array[i]->next_node = node_array[i + 1];
-        }
+        return BQUE_ERR;
+    }
+    if (pthread_cond_init(&ctx->sync.not_full, &cond_attr) != 0) {
+        pthread_cond_destroy(&ctx->sync.not_empty);
+        pthread_mutex_destroy(&ctx->sync.lock);
+        pthread_condattr_destroy(&cond_attr);
+
+        return BQUE_ERR;
     }
+    pthread_condattr_destroy(&cond_attr);
 
-    /* free the node array. */
-    free(node_array);
+    if (bque_is_notify(ctx) && notify_open(ctx) != BQUE_OK) {
+        pthread_cond_destroy(&ctx->sync.not_full);
+        pthread_cond_destroy(&ctx->sync.not_empty);
+        pthread_mutex_destroy(&ctx->sync.lock);
 
-    /* update the fast indexing cache. */
-    if (ctx->cache.last.node != NULL) {
-        ctx->cache.last.node = NULL;
-        ctx->cache.last.node_idx = 0;
+        return BQUE_ERR;
     }
 
     return BQUE_OK;
 }
 
+#endif
+
 /**
- * @brief iterate through the queue in specified order.
+ * @brief get the size class of the node cache for a buffer size.
  * 
- * @note this function will call the callback function for each buffer, note
- *       that the callback function should return BQUE_OK to continue iterating,
- *       then after all buffers are iterated, this function will return BQUE_OK,
- *       or the callback function may return BQUE_ERR_ITER_STOP to stop
+ * @param size buffer size.
+*/
+static bque_u32_t recycle_class(bque_u32_t size) {
+    bque_u32_t k = 0;
+
+    while (size >> (k + 1) != 0) {
+        k++;
+    }
+
+    return k;
+}
+
+/**
+ * @brief take a node which can hold a buffer from the node cache.
+ * 
+ * @note only the class of the size and the class above it are looked at, the
+ *       nodes of the latter always fit.
+ * 
+ * @param ctx context pointer.
+ * @param size buffer size.
+*/
+static bque_node_t *recycle_take(bque_ctx_t *ctx, bque_u32_t size) {
+    bque_node_t **free_node;
+    bque_node_t *curt_node;
+    bque_u32_t k;
+
+    if (ctx->mem.recycle.node_num == 0) {
+        return NULL;
+    }
+
+    k = recycle_class(size);
+    if (k >= BQUE_RECYCLE_CLASS_NUM) {
+        return NULL;
+    }
+    free_node = &ctx->mem.recycle.free_node[k];
+    if (*free_node == NULL || (*free_node)->cap < size) {
+        if (k + 1 >= BQUE_RECYCLE_CLASS_NUM ||
+            ctx->mem.recycle.free_node[k + 1] == NULL) {
+            return NULL;
+        }
+        free_node = &ctx->mem.recycle.free_node[k + 1];
+    }
+
+    curt_node = *free_node;
+    *free_node = curt_node->next_node;
+    ctx->mem.recycle.node_num--;
+
+    return curt_node;
+}
+
+/**
+ * @brief put a destroyed node into the node cache.
+ * 
+ * @note 0 is returned when the node cache is full or the node is too large.
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer.
+*/
+static int recycle_put(bque_ctx_t *ctx, bque_node_t *node) {
+    bque_u32_t k;
+
+    if (ctx->mem.recycle.node_num >= ctx->mem.recycle.node_num_max) {
+        return 0;
+    }
+
+    k = recycle_class(node->cap);
+    if (k >= BQUE_RECYCLE_CLASS_NUM) {
+        return 0;
+    }
+    node->next_node = ctx->mem.recycle.free_node[k];
+    ctx->mem.recycle.free_node[k] = node;
+    ctx->mem.recycle.node_num++;
+
+    return 1;
+}
+
+/**
+ * @brief free the nodes of the node cache until a number of them is left.
+ * 
+ * @param ctx context pointer.
+ * @param num number of the nodes to keep.
+*/
+static void recycle_trim(bque_ctx_t *ctx, bque_u32_t num) {
+    bque_node_t *curt_node;
+    bque_u32_t k;
+
+    /* the largest nodes go first. */
+    for (k = BQUE_RECYCLE_CLASS_NUM; k-- > 0 && ctx->mem.recycle.node_num > num;) {
+        while (ctx->mem.recycle.free_node[k] != NULL &&
+               ctx->mem.recycle.node_num > num) {
+            curt_node = ctx->mem.recycle.free_node[k];
+            ctx->mem.recycle.free_node[k] = curt_node->next_node;
+            ctx->mem.recycle.node_num--;
+            mem_free(ctx, curt_node);
+        }
+    }
+}
+
+/**
+ * @brief give back a node carved from a node block.
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer, its block must be set.
+*/
+static void slab_put(bque_ctx_t *ctx, bque_node_t *node) {
+    bque_slab_t *slab = node->slab;
+
+    if (--slab->node_num == 0) {
+        mem_free(ctx, slab);
+    }
+}
+
+/**
+ * @brief carve a new node from a node block.
+ * 
+ * @note the block must have been allocated with room for the node.
+ * 
+ * @param slab block pointer.
+ * @param size buffer size.
+*/
+static bque_node_t *slab_take(bque_slab_t *slab, bque_u32_t size) {
+    bque_node_t *node = (bque_node_t *)slab->end;
+
+    slab->end += bque_align_up(sizeof(bque_node_t) + size);
+    slab->node_num++;
+
+    memset(node, 0, sizeof(bque_node_t));
+    node->buff = (bque_u8_t *)node->data;
+    node->size = size;
+    node->cap = size;
+    node->slab = slab;
+
+    return node;
+}
+
+/**
+ * @brief create a new node.
+ * 
+ * @note the node is taken from the node pool or the node cache if possible,
+ *       otherwise it's allocated by the allocator of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param node the address of the node pointer.
+ * @param size buffer size.
+*/
+static bque_res_t create_node(bque_ctx_t *ctx, bque_node_t **node, bque_u32_t size) {
+    bque_node_t *alloc_node;
+    bque_size_t cap;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(node != NULL);
+
+    if (ctx->mem.pool.free_node != NULL &&
+        sizeof(bque_node_t) + size <= ctx->mem.pool.slot_size) {
+
+        /* take a node from the pool. */
+        alloc_node = ctx->mem.pool.free_node;
+        ctx->mem.pool.free_node = alloc_node->next_node;
+        cap = ctx->mem.pool.slot_size - sizeof(bque_node_t);
+    } else if ((alloc_node = recycle_take(ctx, size)) != NULL) {
+
+        /* reuse a node from the node cache. */
+        cap = alloc_node->cap;
+    } else {
+
+        /* allocate node and buffer in one block. */
+        alloc_node = (bque_node_t *)mem_alloc(ctx, sizeof(bque_node_t) + size);
+        if (alloc_node == NULL) {
+            return BQUE_ERR_NO_MEM;
+        }
+        cap = size;
+    }
+
+    /* initialize node. */
+    memset(alloc_node, 0, sizeof(bque_node_t));
+    alloc_node->buff = (bque_u8_t *)alloc_node->data;
+    alloc_node->size = size;
+    alloc_node->cap = cap;
+
+    /* return node. */
+    *node = alloc_node;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief destroy a node created by create_node().
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer.
+*/
+static void destroy_node(bque_ctx_t *ctx, bque_node_t *node) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(node != NULL);
+
+    /* give the node back to the pool if it came from there. */
+    if ((bque_u8_t *)node >= ctx->mem.pool.base &&
+        (bque_u8_t *)node < ctx->mem.pool.end) {
+        node->next_node = ctx->mem.pool.free_node;
+        ctx->mem.pool.free_node = node;
+
+        return;
+    }
+
+    /* a node carved from a block goes with the block. */
+    if (node->slab != NULL) {
+        slab_put(ctx, node);
+
+        return;
+    }
+
+    /* keep the node for reuse if the node cache has room. */
+    if (recycle_put(ctx, node)) {
+        return;
+    }
+
+    /* the buffer lives in the same block as the node. */
+    mem_free(ctx, node);
+}
+
+/**
+ * @brief destroy a node removed from the queue, or retire it for
+ *        bque_reclaim() with BQUE_FLAG_DEFER_FREE.
+ * 
+ * @note the consumers of a shared queue retire their nodes concurrently, the
+ *       list is only ever pushed to and taken as a whole, so it's lock-free.
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer, already detached.
+ * @param release whether the buffer is discarded with the node, rather than
+ *                copied out or owned by the caller, in which case it's
+ *                released with the freeing callback.
+*/
+static void retire_node(bque_ctx_t *ctx, bque_node_t *node, int release) {
+    if (!(ctx->conf.flags & BQUE_FLAG_DEFER_FREE)) {
+        if (release && conf_free_buff_cb(ctx) != NULL) {
+            conf_free_buff_cb(ctx)(node->buff, node->size);
+        }
+        destroy_node(ctx, node);
+
+        return;
+    }
+
+    if (!release) {
+        node->buff = NULL;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        bque_node_t *next_node = bque_atomic_load(&ctx->mem.retire_node);
+
+        /* count the node before publishing it, so bque_reclaim() taking it
+           right away can't make the count drop below zero. */
+        bque_atomic_add(&ctx->mem.retire_num, 1);
+        do {
+            node->next_node = next_node;
+        } while (!bque_atomic_cas(&ctx->mem.retire_node, &next_node, node));
+
+        return;
+    }
+#endif
+
+    node->next_node = ctx->mem.retire_node;
+    ctx->mem.retire_node = node;
+    ctx->mem.retire_num++;
+}
+
+#ifdef BQUE_FILE
+
+/**
+ * @brief update a checksum of the file backend with some bytes.
+ * 
+ * @note this is FNV-1a taking 4 bytes at a time, it only has to catch the
+ *       records torn by a crash.
+ * 
+ * @param sum checksum so far, BQUE_FILE_SUM_INIT at first.
+ * @param data bytes pointer.
+ * @param size number of the bytes.
+*/
+static bque_u32_t file_sum(bque_u32_t sum, const void *data, size_t size) {
+    const bque_u8_t *byte = (const bque_u8_t *)data;
+    bque_u32_t word;
+
+    for (; size >= sizeof(word); size -= sizeof(word), byte += sizeof(word)) {
+        memcpy(&word, byte, sizeof(word));
+        sum = (sum ^ word) * 16777619U;
+    }
+    for (; size > 0; size--, byte++) {
+        sum = (sum ^ *byte) * 16777619U;
+    }
+
+    return sum;
+}
+
+/**
+ * @brief get the checksum of a record.
+ * 
+ * @param seq sequence of the record.
+ * @param size buffer size, or BQUE_FILE_WRAP.
+ * @param buff buffer pointer, not used by BQUE_FILE_WRAP.
+*/
+static bque_u32_t file_rec_sum(bque_u64_t seq, bque_u32_t size, const void *buff) {
+    bque_u32_t sum;
+
+    sum = file_sum(BQUE_FILE_SUM_INIT, &seq, sizeof(seq));
+    sum = file_sum(sum, &size, sizeof(size));
+    if (size != BQUE_FILE_WRAP) {
+        sum = file_sum(sum, buff, size);
+    }
+
+    return sum;
+}
+
+/**
+ * @brief get the record at an offset, following the end of the records.
+ * 
+ * @note the records continue from the start when there is no room for a
+ *       record header before the end of the file, or a BQUE_FILE_WRAP record
+ *       says so.
+ * 
+ * @param ctx context pointer.
+ * @param offs offset of the record.
+*/
+static bque_u64_t file_skip_wrap(bque_ctx_t *ctx, bque_u64_t offs) {
+    if (ctx->file.size - offs < sizeof(bque_file_rec_t) ||
+        ((bque_file_rec_t *)(ctx->file.base + offs))->size == BQUE_FILE_WRAP) {
+        return BQUE_FILE_DATA_OFFS;
+    }
+
+    return offs;
+}
+
+/**
+ * @brief remember a range of the file to write back on the next sync.
+ * 
+ * @param ctx context pointer.
+ * @param offs start of the range.
+ * @param size size of the range.
+*/
+static void file_dirty(bque_ctx_t *ctx, bque_u64_t offs, bque_u64_t size) {
+    if (offs < ctx->file.dirty_lo) {
+        ctx->file.dirty_lo = offs;
+    }
+    if (offs + size > ctx->file.dirty_hi) {
+        ctx->file.dirty_hi = offs + size;
+    }
+}
+
+/**
+ * @brief write the file back to the disk.
+ * 
+ * @note the records are written back first, then a header recording the
+ *       queue, so a crash at any time finds either header complete with
+ *       every record it covers. the headers take turns, the older one gets
+ *       overwritten.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t file_sync(bque_ctx_t *ctx) {
+    bque_u64_t page = (bque_u64_t)sysconf(_SC_PAGESIZE);
+    bque_file_hdr_t hdr;
+    bque_u64_t lo;
+
+    if (ctx->file.dirty_lo < ctx->file.dirty_hi) {
+        lo = ctx->file.dirty_lo / page * page;
+        if (msync(ctx->file.base + lo, (size_t)(ctx->file.dirty_hi - lo), MS_SYNC) != 0) {
+            return BQUE_ERR;
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BQUE_FILE_MAGIC;
+    hdr.gen = ctx->file.gen + 1;
+    hdr.size = ctx->file.size;
+    hdr.head = ctx->file.head;
+    hdr.head_seq = ctx->file.head_seq;
+    hdr.tail = ctx->file.tail;
+    hdr.tail_seq = ctx->file.tail_seq;
+    hdr.buff_bytes = ctx->cache.buff_bytes;
+    hdr.sum = file_sum(BQUE_FILE_SUM_INIT, &hdr, offsetof(bque_file_hdr_t, sum));
+    memcpy(ctx->file.base + (hdr.gen % 2) * BQUE_FILE_HDR_SIZE, &hdr, sizeof(hdr));
+    if (msync(ctx->file.base, BQUE_FILE_DATA_OFFS, MS_SYNC) != 0) {
+        return BQUE_ERR;
+    }
+
+    /* the space of the taken buffers can be reused from now on. */
+    ctx->file.gen = hdr.gen;
+    ctx->file.sync_head = ctx->file.head;
+    ctx->file.sync_head_seq = ctx->file.head_seq;
+    ctx->file.dirty_lo = ctx->file.size;
+    ctx->file.dirty_hi = 0;
+    ctx->file.op_num = 0;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief count the buffers added or taken, syncing the file every
+ *        `file_sync_num` of them.
+ * 
+ * @param ctx context pointer.
+ * @param num number of the buffers.
+*/
+static bque_res_t file_count_op(bque_ctx_t *ctx, bque_u32_t num) {
+    ctx->file.op_num += num;
+    if (ctx->file.sync_num != 0 && ctx->file.op_num >= ctx->file.sync_num) {
+        return file_sync(ctx);
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief find the room for the next record at the tail.
+ * 
+ * @note the space from the head at the last sync on is kept, except when
+ *       the queue was empty then. the records continue from the start of the
+ *       file when they don't fit before its end.
+ * 
+ * @param ctx context pointer.
+ * @param tail tail pointer, moved past the record.
+ * @param head pointer of the start of the kept space.
+ * @param empty pointer of whether no space is kept, cleared by the record.
+ * @param size size of the record.
+*/
+static bque_u64_t file_place(bque_ctx_t *ctx, bque_u64_t *tail, bque_u64_t *head,
+                             int *empty, bque_u64_t size) {
+    bque_u64_t offs;
+
+    if (*empty || *tail > *head) {
+        if (ctx->file.size - *tail >= size) {
+            offs = *tail;
+        } else if (BQUE_FILE_DATA_OFFS + size <= (*empty ? ctx->file.size : *head)) {
+            offs = BQUE_FILE_DATA_OFFS;
+        } else {
+            return 0;
+        }
+    } else if (*head - *tail >= size) {
+        offs = *tail;
+    } else {
+        return 0;
+    }
+
+    if (*empty) {
+        *head = offs;
+        *empty = 0;
+    }
+    *tail = offs + size;
+
+    return offs;
+}
+
+/**
+ * @brief append buffers to the file, either all of them or none.
+ * 
+ * @note when the buffers don't fit, the file is synced first if that frees
+ *       the space of the taken buffers.
+ * 
+ * @param ctx context pointer.
+ * @param vec buffers, a NULL base is written as zeros.
+ * @param num number of the buffers.
+*/
+static bque_res_t file_push(bque_ctx_t *ctx, const bque_vec_t *vec, bque_u32_t num) {
+    bque_file_rec_t *rec;
+    bque_u64_t tail;
+    bque_u64_t head;
+    bque_u64_t offs;
+    bque_u32_t size;
+    int empty;
+    bque_u32_t i;
+    bque_res_t res;
+
+    /* check whether the records fit. */
+    for (;;) {
+        tail = ctx->file.tail;
+        head = ctx->file.sync_head;
+        empty = ctx->file.sync_head_seq == ctx->file.tail_seq;
+        for (i = 0; i < num; i++) {
+            if (file_place(ctx, &tail, &head, &empty,
+                           file_rec_size(vec[i].size)) == 0) {
+                break;
+            }
+        }
+        if (i == num) {
+            break;
+        }
+
+        if (ctx->file.sync_head_seq == ctx->file.head_seq) {
+            stats_add(ctx, full_num, 1);
+
+            return BQUE_ERR_FULL_QUE;
+        }
+        res = file_sync(ctx);
+        if (res != BQUE_OK) {
+            return res;
+        }
+    }
+
+    /* write the records. */
+    empty = ctx->file.sync_head_seq == ctx->file.tail_seq;
+    for (i = 0; i < num; i++) {
+        size = (bque_u32_t)vec[i].size;
+        tail = ctx->file.tail;
+        offs = file_place(ctx, &ctx->file.tail, &ctx->file.sync_head, &empty,
+                          file_rec_size(size));
+
+        /* mark the end of the records when they continue from the start,
+           unless there is no room for it. */
+        if (offs != tail && ctx->file.size - tail >= sizeof(bque_file_rec_t)) {
+            rec = (bque_file_rec_t *)(ctx->file.base + tail);
+            rec->seq = ctx->file.tail_seq;
+            rec->size = BQUE_FILE_WRAP;
+            rec->sum = file_rec_sum(rec->seq, rec->size, NULL);
+            file_dirty(ctx, tail, sizeof(bque_file_rec_t));
+        }
+
+        rec = (bque_file_rec_t *)(ctx->file.base + offs);
+        if (vec[i].base != NULL) {
+            memcpy(rec + 1, vec[i].base, size);
+        } else {
+            memset(rec + 1, 0, size);
+        }
+        rec->seq = ctx->file.tail_seq;
+        rec->size = size;
+        rec->sum = file_rec_sum(rec->seq, size, rec + 1);
+        file_dirty(ctx, offs, file_rec_size(size));
+
+        ctx->file.tail_seq++;
+        ctx->cache.node_num++;
+        ctx->cache.buff_bytes += size;
+        stats_push(ctx, NULL, 0);
+    }
+
+    return file_count_op(ctx, num);
+}
+
+/**
+ * @brief take the head buffer from the file.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+static bque_res_t file_pop(bque_ctx_t *ctx, void *buff, bque_u32_t *size) {
+    bque_file_rec_t *rec;
+    bque_u64_t offs;
+
+    offs = file_skip_wrap(ctx, ctx->file.head);
+    rec = (bque_file_rec_t *)(ctx->file.base + offs);
+    if (buff != NULL) {
+        memcpy(buff, rec + 1, rec->size);
+    }
+    if (size != NULL) {
+        *size = rec->size;
+    }
+
+    ctx->file.head = offs + file_rec_size(rec->size);
+    ctx->file.head_seq++;
+    ctx->cache.node_num--;
+    ctx->cache.buff_bytes -= rec->size;
+    stats_pop(ctx, NULL);
+
+    return file_count_op(ctx, 1);
+}
+
+/**
+ * @brief find the record of a buffer by walking from the head.
+ * 
+ * @param ctx context pointer.
+ * @param idx valid index of the buffer.
+*/
+static bque_file_rec_t *file_find(bque_ctx_t *ctx, bque_u32_t idx) {
+    bque_file_rec_t *rec;
+    bque_u64_t offs = ctx->file.head;
+
+    for (;;) {
+        offs = file_skip_wrap(ctx, offs);
+        rec = (bque_file_rec_t *)(ctx->file.base + offs);
+        if (idx-- == 0) {
+            return rec;
+        }
+        offs += file_rec_size(rec->size);
+    }
+}
+
+/**
+ * @brief take all buffers from the file.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t file_clear(bque_ctx_t *ctx) {
+    ctx->file.head = ctx->file.tail;
+    ctx->file.head_seq = ctx->file.tail_seq;
+    ctx->cache.node_num = 0;
+    ctx->cache.buff_bytes = 0;
+
+    return file_count_op(ctx, 1);
+}
+
+/**
+ * @brief load the queue held by a file.
+ * 
+ * @note the newest valid header gives the queue at the last sync, then the
+ *       records added after it which made it to the disk are taken as well,
+ *       up to the first one missing or torn. the buffers taken after the
+ *       last sync come back.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t file_load(bque_ctx_t *ctx) {
+    bque_file_hdr_t hdr[2];
+    bque_file_hdr_t *last = NULL;
+    bque_file_rec_t *rec;
+    bque_u64_t offs;
+    int k;
+
+    for (k = 0; k < 2; k++) {
+        memcpy(&hdr[k], ctx->file.base + k * BQUE_FILE_HDR_SIZE, sizeof(hdr[k]));
+        if (hdr[k].magic != BQUE_FILE_MAGIC || hdr[k].size != ctx->file.size ||
+            hdr[k].sum != file_sum(BQUE_FILE_SUM_INIT, &hdr[k],
+                                   offsetof(bque_file_hdr_t, sum)) ||
+            hdr[k].head < BQUE_FILE_DATA_OFFS || hdr[k].head > hdr[k].size ||
+            hdr[k].tail < BQUE_FILE_DATA_OFFS || hdr[k].tail > hdr[k].size ||
+            hdr[k].tail_seq - hdr[k].head_seq > 0xFFFFFFFFU) {
+            continue;
+        }
+        if (last == NULL || hdr[k].gen > last->gen) {
+            last = &hdr[k];
+        }
+    }
+
+    /* a file which never got a header was created by a crashed process. */
+    if (last == NULL) {
+        if (hdr[0].magic == 0 && hdr[1].magic == 0) {
+            return file_sync(ctx);
+        }
+
+        return BQUE_ERR;
+    }
+
+    ctx->file.gen = last->gen;
+    ctx->file.head = last->head;
+    ctx->file.head_seq = last->head_seq;
+    ctx->file.tail = last->tail;
+    ctx->file.tail_seq = last->tail_seq;
+    ctx->file.sync_head = last->head;
+    ctx->file.sync_head_seq = last->head_seq;
+    ctx->cache.node_num = (bque_u32_t)(last->tail_seq - last->head_seq);
+    ctx->cache.buff_bytes = last->buff_bytes;
+
+    /* pick up the records added after the sync. */
+    offs = ctx->file.tail;
+    while (ctx->cache.node_num < 0xFFFFFFFFU) {
+        if (ctx->file.size - offs < sizeof(bque_file_rec_t)) {
+            offs = BQUE_FILE_DATA_OFFS;
+        }
+        rec = (bque_file_rec_t *)(ctx->file.base + offs);
+        if (rec->seq != ctx->file.tail_seq) {
+            break;
+        }
+        if (rec->size == BQUE_FILE_WRAP) {
+            if (rec->sum != file_rec_sum(rec->seq, rec->size, NULL)) {
+                break;
+            }
+            offs = BQUE_FILE_DATA_OFFS;
+            continue;
+        }
+        if (file_rec_size(rec->size) > ctx->file.size - offs ||
+            rec->sum != file_rec_sum(rec->seq, rec->size, rec + 1)) {
+            break;
+        }
+
+        offs += file_rec_size(rec->size);
+        ctx->file.tail = offs;
+        ctx->file.tail_seq++;
+        ctx->cache.node_num++;
+        ctx->cache.buff_bytes += rec->size;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief open or create the file of a queue.
+ * 
+ * @param ctx context pointer.
+ * @param path file path.
+ * @param size size of a new file, rounded up to whole pages.
+*/
+static bque_res_t file_open(bque_ctx_t *ctx, const char *path, bque_u64_t size) {
+    bque_u64_t page = (bque_u64_t)sysconf(_SC_PAGESIZE);
+    struct stat st;
+    void *base;
+    int fd;
+    bque_res_t res;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return BQUE_ERR;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+
+        return BQUE_ERR;
+    }
+
+    /* a new file gets its size, an existing one keeps its own. */
+    if (st.st_size == 0) {
+        if (size == 0) {
+            size = BQUE_DEF_FILE_SIZE;
+        }
+        size = (size + page - 1) / page * page;
+        if (ftruncate(fd, (off_t)size) != 0) {
+            close(fd);
+
+            return BQUE_ERR;
+        }
+    } else {
+        size = (bque_u64_t)st.st_size;
+        if (size <= BQUE_FILE_DATA_OFFS) {
+            close(fd);
+
+            return BQUE_ERR;
+        }
+    }
+
+    base = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+
+        return BQUE_ERR;
+    }
+
+    ctx->file.fd = fd;
+    ctx->file.base = (bque_u8_t *)base;
+    ctx->file.size = size;
+    ctx->file.head = BQUE_FILE_DATA_OFFS;
+    ctx->file.tail = BQUE_FILE_DATA_OFFS;
+    ctx->file.sync_head = BQUE_FILE_DATA_OFFS;
+    ctx->file.dirty_lo = size;
+    ctx->file.dirty_hi = 0;
+    ctx->cache.mem_bytes = size;
+
+    res = file_load(ctx);
+    if (res != BQUE_OK) {
+        munmap(base, (size_t)size);
+        close(fd);
+        memset(&ctx->file, 0, sizeof(ctx->file));
+
+        return res;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief sync and close the file of a queue.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_res_t file_close(bque_ctx_t *ctx) {
+    bque_res_t res;
+
+    res = file_sync(ctx);
+    munmap(ctx->file.base, (size_t)ctx->file.size);
+    close(ctx->file.fd);
+
+    return res;
+}
+
+#endif
+
+/**
+ * @brief create a queue.
+ * 
+ * @param ctx the address of the context pointer.
+ * @param conf configuration pointer.
+*/
+BQUE_API bque_res_t bque_new(bque_ctx_t **ctx, bque_conf_t *conf) {
+    bque_ctx_t *alloc_ctx;
+    bque_res_t res;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(conf == NULL ||
+                (conf->alloc_cb == NULL) == (conf->dealloc_cb == NULL));
+
+    /* allocate context. */
+    if (conf != NULL && conf->alloc_cb != NULL) {
+        alloc_ctx = (bque_ctx_t *)conf->alloc_cb(conf->alloc_user,
+                                                 sizeof(bque_ctx_t));
+    } else {
+        alloc_ctx = (bque_ctx_t *)malloc(sizeof(bque_ctx_t));
+    }
+    if (alloc_ctx == NULL)
+    {
+        return BQUE_ERR_NO_MEM;
+    }
+
+    /* initialize context. */
+    memset(alloc_ctx, 0, sizeof(bque_ctx_t));
+
+    /* configure context. */
+    if (conf != NULL) {
+        alloc_ctx->conf.node_num_max = conf->buff_num_max;
+        alloc_ctx->conf.buff_size_max = conf->buff_size_max;
+        alloc_ctx->conf.free_buff_cb = conf->free_buff_cb;
+        alloc_ctx->conf.elem_size = conf->elem_size;
+        alloc_ctx->conf.flags = conf->flags;
+        alloc_ctx->conf.prio_cb = conf->prio_cb;
+        alloc_ctx->conf.prio_order = conf->prio_order;
+        alloc_ctx->conf.total_bytes_max = conf->total_bytes_max;
+        alloc_ctx->mem.alloc_cb = conf->alloc_cb;
+        alloc_ctx->mem.dealloc_cb = conf->dealloc_cb;
+        alloc_ctx->mem.user = conf->alloc_user;
+    } else {
+        alloc_ctx->conf.node_num_max = BQUE_DEF_NODE_NUM_MAX;
+        alloc_ctx->conf.buff_size_max = BQUE_DEF_BUFF_SIZE_MAX;
+        alloc_ctx->conf.free_buff_cb = NULL;
+        alloc_ctx->conf.flags = 0;
+    }
+
+    /* the settings fixed at compile time replace the configured ones. */
+#ifdef BQUE_CONF_BUFF_NUM_MAX
+    alloc_ctx->conf.node_num_max = conf_node_num_max(alloc_ctx);
+#endif
+#ifdef BQUE_CONF_BUFF_SIZE_MAX
+    alloc_ctx->conf.buff_size_max = conf_buff_size_max(alloc_ctx);
+#endif
+#ifdef BQUE_CONF_BUFF_SIZE
+    alloc_ctx->conf.elem_size = conf_elem_size(alloc_ctx);
+#endif
+#ifdef BQUE_CONF_FREE_BUFF_CB
+    alloc_ctx->conf.free_buff_cb = conf_free_buff_cb(alloc_ctx);
+#endif
+
+    /* a fixed buffer size is the maximum one as well. */
+    if (conf_elem_size(alloc_ctx) != 0) {
+        alloc_ctx->conf.buff_size_max = conf_elem_size(alloc_ctx);
+    }
+
+    /* the index is not thread-safe, and the ring backend needs no index. */
+    if ((alloc_ctx->conf.flags & BQUE_FLAG_INDEXED) &&
+        (alloc_ctx->conf.flags & (BQUE_FLAG_RING | BQUE_SYNC_FLAGS))) {
+        mem_free(alloc_ctx, alloc_ctx);
+
+        return BQUE_ERR_BAD_OPT;
+    }
+
+    /* the packed mode keeps its own layout, and its buffers must fit into
+       a chunk. */
+    if (bque_is_packed(alloc_ctx)) {
+        if (alloc_ctx->conf.flags & (BQUE_FLAG_NODE_POOL | BQUE_FLAG_RING |
+                                     BQUE_FLAG_INDEXED | BQUE_SYNC_FLAGS)) {
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return BQUE_ERR_BAD_OPT;
+        }
+        if (conf_buff_size_max(alloc_ctx) == 0 ||
+            conf_buff_size_max(alloc_ctx) > BQUE_CHUNK_BUFF_SIZE_MAX) {
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return BQUE_ERR_BAD_SIZE;
+        }
+    }
+
+    /* the file backend keeps its own layout and only counts the buffers. */
+    if (bque_is_file(alloc_ctx)) {
+#ifdef BQUE_FILE
+        if (alloc_ctx->conf.flags != BQUE_FLAG_FILE || conf->file_path == NULL ||
+            alloc_ctx->conf.prio_cb != NULL || conf_free_buff_cb(alloc_ctx) != NULL) {
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return BQUE_ERR_BAD_OPT;
+        }
+
+        res = file_open(alloc_ctx, conf->file_path, conf->file_size);
+        if (res != BQUE_OK) {
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return res;
+        }
+        alloc_ctx->file.sync_num = conf->file_sync_num;
+#else
+        mem_free(alloc_ctx, alloc_ctx);
+
+        return BQUE_ERR_BAD_OPT;
+#endif
+    }
+
+    /* only the nodes of their own are retired, the pool and the chunks give
+       their memory back at once. */
+    if ((alloc_ctx->conf.flags & BQUE_FLAG_DEFER_FREE) &&
+        (alloc_ctx->conf.flags & (BQUE_FLAG_NODE_POOL | BQUE_FLAG_RING |
+                                  BQUE_FLAG_PACKED | BQUE_FLAG_FILE))) {
+        mem_free(alloc_ctx, alloc_ctx);
+
+        return BQUE_ERR_BAD_OPT;
+    }
+
+    /* the shared queues can only add buffers to the tail, and the producers
+       can't take the head. */
+    if ((alloc_ctx->conf.prio_cb != NULL || alloc_ctx->conf.total_bytes_max != 0 ||
+         (alloc_ctx->conf.flags & BQUE_FLAG_OVERWRITE)) && bque_is_sync(alloc_ctx)) {
+        mem_free(alloc_ctx, alloc_ctx);
+
+        return BQUE_ERR_BAD_OPT;
+    }
+
+    /* only the shared queues are watched by other threads. */
+    if (bque_is_notify(alloc_ctx) && !bque_is_sync(alloc_ctx)) {
+        mem_free(alloc_ctx, alloc_ctx);
+
+        return BQUE_ERR_BAD_OPT;
+    }
+
+    /* the node pool is not thread-safe. */
+    if (bque_is_sync(alloc_ctx)) {
+#ifdef BQUE_THREADS
+        if (alloc_ctx->conf.flags & (BQUE_FLAG_NODE_POOL | BQUE_FLAG_RING)) {
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return BQUE_ERR_BAD_OPT;
+        }
+
+        res = sync_init(alloc_ctx);
+        if (res != BQUE_OK) {
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return res;
+        }
+#else
+        mem_free(alloc_ctx, alloc_ctx);
+
+        return BQUE_ERR_BAD_OPT;
+#endif
+    }
+
+    /* the threads of a shared queue create and destroy nodes concurrently,
+       so only the other queues have a node cache. */
+    if (!bque_is_sync(alloc_ctx)) {
+        alloc_ctx->mem.recycle.node_num_max = BQUE_DEF_RECYCLE_NUM_MAX;
+    }
+
+    /* the ring backend keeps its nodes in the pool. */
+    if (alloc_ctx->conf.flags & BQUE_FLAG_RING) {
+        alloc_ctx->conf.flags |= BQUE_FLAG_NODE_POOL;
+    }
+
+    /* if necessary, create the node pool. */
+    if (alloc_ctx->conf.flags & BQUE_FLAG_NODE_POOL) {
+        res = create_pool(alloc_ctx);
+        if (res != BQUE_OK) {
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return res;
+        }
+    }
+
+    /* if necessary, create the ring. */
+    if (alloc_ctx->conf.flags & BQUE_FLAG_RING) {
+        res = create_ring(alloc_ctx);
+        if (res != BQUE_OK) {
+            mem_free(alloc_ctx, alloc_ctx->mem.pool.base);
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return res;
+        }
+    }
+
+    /* if necessary, create the index. */
+    if (alloc_ctx->conf.flags & BQUE_FLAG_INDEXED) {
+        res = create_index(alloc_ctx);
+        if (res != BQUE_OK) {
+            if (alloc_ctx->mem.pool.base != NULL) {
+                mem_free(alloc_ctx, alloc_ctx->mem.pool.base);
+            }
+            mem_free(alloc_ctx, alloc_ctx);
+
+            return res;
+        }
+    }
+
+    *ctx = alloc_ctx;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief Free all allocated memory in the queue.
+ * 
+ * @param ctx Context pointer.
+ */
+BQUE_API bque_res_t bque_free(bque_ctx_t *ctx) {
+    BQUE_ASSERT(ctx != NULL);
+
+#ifdef BQUE_FILE
+    /* the buffers of the file backend stay in the file. */
+    if (bque_is_file(ctx)) {
+        bque_res_t res;
+
+        res = file_close(ctx);
+        mem_free(ctx, ctx);
+
+        return res;
+    }
+#endif
+
+    /* empty the queue, and free the retired nodes. */
+    bque_empty(ctx);
+    if (ctx->conf.flags & BQUE_FLAG_DEFER_FREE) {
+        bque_reclaim(ctx, NULL);
+    }
+
+    /* discard the pending reservation. */
+    if (ctx->resv_node != NULL) {
+        destroy_node(ctx, ctx->resv_node);
+    }
+
+    /* free the node cache. */
+    recycle_trim(ctx, 0);
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        if (bque_is_notify(ctx)) {
+            notify_close(ctx);
+        }
+        pthread_cond_destroy(&ctx->sync.not_full);
+        pthread_cond_destroy(&ctx->sync.not_empty);
+        pthread_mutex_destroy(&ctx->sync.lock);
+    }
+#endif
+
+    /* free the index, the ring and the node pool. */
+    if (ctx->index.head != NULL) {
+        mem_free(ctx, ctx->index.head);
+    }
+    if (ctx->ring.slot != NULL) {
+        mem_free(ctx, ctx->ring.slot);
+    }
+    if (ctx->mem.pool.base != NULL) {
+        mem_free(ctx, ctx->mem.pool.base);
+    }
+
+    /* free context. */
+    mem_free(ctx, ctx);
+
+    return BQUE_OK;
+}
+
+#ifdef BQUE_STATS
+
+/**
+ * @brief copy the counters of BQUE_STATS.
+ * 
+ * @param ctx context pointer.
+ * @param stat status pointer.
+*/
+static void stats_copy(bque_ctx_t *ctx, bque_stat_t *stat) {
+    bque_u32_t k;
+
+    stat->enq_num = stats_get(ctx, enq_num);
+    stat->deq_num = stats_get(ctx, deq_num);
+    stat->full_num = stats_get(ctx, full_num);
+    stat->peak_num = stats_get(ctx, peak_num);
+    stat->find_num = stats_get(ctx, find_num);
+    stat->finger_hit_num = stats_get(ctx, finger_hit_num);
+    stat->walk_num = stats_get(ctx, walk_num);
+    for (k = 0; k < BQUE_STATS_DWELL_NUM; k++) {
+        stat->dwell_num[k] = stats_get(ctx, dwell_num[k]);
+    }
+}
+
+#endif
+
+/**
+ * @brief get the status of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param stat status pointer.
+*/
+BQUE_API bque_res_t bque_stat(bque_ctx_t *ctx, bque_stat_t *stat) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(stat != NULL);
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        stat->buff_num = bque_atomic_load(&ctx->cache.node_num);
+        stat->drop_num = 0;
+        stat->buff_bytes = bque_atomic_load(&ctx->cache.buff_bytes);
+        stat->mem_bytes = bque_atomic_load(&ctx->cache.mem_bytes);
+        stat->retire_num = bque_atomic_load(&ctx->mem.retire_num);
+#ifdef BQUE_STATS
+        stats_copy(ctx, stat);
+#endif
+
+        return BQUE_OK;
+    }
+#endif
+
+    stat->buff_num = ctx->cache.node_num;
+    stat->drop_num = ctx->cache.drop_num;
+    stat->buff_bytes = ctx->cache.buff_bytes;
+    stat->mem_bytes = ctx->cache.mem_bytes;
+    stat->retire_num = ctx->mem.retire_num;
+#ifdef BQUE_STATS
+    stats_copy(ctx, stat);
+#endif
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief drop all fingers of the fast indexing cache.
+ * 
+ * @param ctx context pointer.
+*/
+static void finger_reset(bque_ctx_t *ctx) {
+    bque_u32_t i;
+
+    for (i = 0; i < BQUE_FINGER_NUM; i++) {
+        ctx->cache.finger[i].node = NULL;
+        ctx->cache.finger[i].node_idx = 0;
+    }
+}
+
+/**
+ * @brief update the fingers after a node has been added.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the added node.
+*/
+static void finger_insert(bque_ctx_t *ctx, bque_u32_t idx) {
+    bque_u32_t i;
+
+    for (i = 0; i < BQUE_FINGER_NUM; i++) {
+        if (ctx->cache.finger[i].node != NULL &&
+            ctx->cache.finger[i].node_idx >= idx) {
+            ctx->cache.finger[i].node_idx++;
+        }
+    }
+}
+
+/**
+ * @brief update the fingers after consecutive nodes have been removed.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the first removed node.
+ * @param num number of the removed nodes.
+*/
+static void finger_remove(bque_ctx_t *ctx, bque_u32_t idx, bque_u32_t num) {
+    bque_u32_t i;
+
+    for (i = 0; i < BQUE_FINGER_NUM; i++) {
+        if (ctx->cache.finger[i].node == NULL ||
+            ctx->cache.finger[i].node_idx < idx) {
+            continue;
+        }
+        if (ctx->cache.finger[i].node_idx - idx < num) {
+            ctx->cache.finger[i].node = NULL;
+            ctx->cache.finger[i].node_idx = 0;
+        } else {
+            ctx->cache.finger[i].node_idx -= num;
+        }
+    }
+}
+
+/**
+ * @brief point a finger at a node and make it the most recently used one.
+ * 
+ * @param ctx context pointer.
+ * @param pos position of the finger to reuse, or BQUE_FINGER_NUM to take the
+ *            least recently used one.
+ * @param node node pointer.
+ * @param idx index of the node.
+*/
+static void finger_touch(bque_ctx_t *ctx, bque_u32_t pos,
+                         bque_node_t *node, bque_u32_t idx) {
+    if (pos >= BQUE_FINGER_NUM) {
+        pos = BQUE_FINGER_NUM - 1;
+    }
+    for (; pos > 0; pos--) {
+        ctx->cache.finger[pos] = ctx->cache.finger[pos - 1];
+    }
+    ctx->cache.finger[0].node = node;
+    ctx->cache.finger[0].node_idx = idx;
+}
+
+/**
+ * @brief unlink a node from the queue without counting it as taken.
+ * 
+ * @note the node itself is not destroyed.
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer.
+ * @param idx index of the node.
+*/
+static void unlink_node(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t idx) {
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(node != NULL);
+    BQUE_ASSERT(idx < ctx->cache.node_num);
+
+    /* move the fingers off the node, so they stay in the same region. */
+    for (i = 0; i < BQUE_FINGER_NUM; i++) {
+        if (ctx->cache.finger[i].node != node) {
+            continue;
+        }
+        if (node->next_node != NULL) {
+            ctx->cache.finger[i].node = node->next_node;
+            ctx->cache.finger[i].node_idx = idx + 1;
+        } else if (node->prev_node != NULL) {
+            ctx->cache.finger[i].node = node->prev_node;
+            ctx->cache.finger[i].node_idx = idx - 1;
+        }
+    }
+
+    /* remove the node. */
+    if (ctx->ring.slot != NULL) {
+        ring_remove(ctx, idx);
+    }
+    if (ctx->index.head != NULL) {
+        index_remove(ctx, idx);
+    }
+    if (node->prev_node != NULL) {
+        node->prev_node->next_node = node->next_node;
+    } else {
+        ctx->head_node = node->next_node;
+    }
+    if (node->next_node != NULL) {
+        node->next_node->prev_node = node->prev_node;
+    } else {
+        ctx->tail_node = node->prev_node;
+    }
+    node->prev_node = NULL;
+    node->next_node = NULL;
+    ctx->cache.node_num--;
+    ctx->cache.buff_bytes -= node->size;
+    ctx->cache.mem_bytes -= node_mem_size(node);
+
+    /* update the fast indexing cache. */
+    finger_remove(ctx, idx, 1);
+}
+
+/**
+ * @brief unlink a node taken from the queue.
+ * 
+ * @note the node itself is not destroyed.
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer.
+ * @param idx index of the node.
+*/
+static void detach_node(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t idx) {
+    unlink_node(ctx, node, idx);
+    stats_pop(ctx, node);
+}
+
+/**
+ * @brief move a buffer trimmed by bque_consume_bytes() back to the start of
+ *        its node, so the node can be found from the buffer again.
+ * 
+ * @param node node pointer.
+*/
+static void node_untrim(bque_node_t *node) {
+    if (node->buff != (bque_u8_t *)node->data) {
+        memmove(node->data, node->buff, node->size);
+        node->buff = (bque_u8_t *)node->data;
+    }
+}
+
+/**
+ * @brief find a node by index.
+ * 
+ * @note the walk starts from the closest one of the head, the tail and the
+ *       fingers of the fast indexing cache, the found node is remembered by
+ *       a finger.
+ * 
+ * @param ctx context pointer.
+ * @param idx valid index of the node.
+*/
+static bque_node_t *find_node(bque_ctx_t *ctx, bque_u32_t idx) {
+    bque_node_t *curt_node;
+    bque_u32_t curt_idx;
+    bque_u32_t node_idx_diff;
+    bque_u32_t temp_node_idx_diff;
+    bque_u32_t finger_pos = BQUE_FINGER_NUM;
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(idx < ctx->cache.node_num);
+
+    /* the ring backend indexes the nodes directly, one load for the slot
+       and one for the node. */
+    if (ctx->ring.slot != NULL) {
+        return ctx->ring.slot[ring_pos(ctx, idx)];
+    }
+    if (ctx->index.head != NULL) {
+        return index_find(ctx, idx);
+    }
+
+    /* check whether the head node or the tail node is closer. */
+    if (idx <= ctx->cache.node_num - 1 - idx) {
+        curt_node = ctx->head_node;
+        curt_idx = 0;
+    } else {
+        curt_node = ctx->tail_node;
+        curt_idx = ctx->cache.node_num - 1;
+    }
+    node_idx_diff = bque_abs_diff(idx, curt_idx);
+
+    /* check whether any finger is even closer. */
+    for (i = 0; i < BQUE_FINGER_NUM && node_idx_diff != 0; i++) {
+        if (ctx->cache.finger[i].node == NULL) {
+            continue;
+        }
+        temp_node_idx_diff = bque_abs_diff(idx, ctx->cache.finger[i].node_idx);
+        if (temp_node_idx_diff < node_idx_diff) {
+            node_idx_diff = temp_node_idx_diff;
+            curt_node = ctx->cache.finger[i].node;
+            curt_idx = ctx->cache.finger[i].node_idx;
+            finger_pos = i;
+        }
+    }
+
+    stats_add(ctx, find_num, 1);
+    stats_add(ctx, finger_hit_num, finger_pos < BQUE_FINGER_NUM);
+    stats_add(ctx, walk_num, node_idx_diff);
+
+    /* walk to the node. */
+    while (curt_idx < idx) {
+        curt_node = curt_node->next_node;
+        curt_idx++;
+    }
+    while (curt_idx > idx) {
+        curt_node = curt_node->prev_node;
+        curt_idx--;
+    }
+
+    /* the nodes next to the ends are cheap to find anyway. */
+    if (finger_pos < BQUE_FINGER_NUM ||
+        (idx > 1 && idx + 2 < ctx->cache.node_num)) {
+        finger_touch(ctx, finger_pos, curt_node, idx);
+    }
+
+    return curt_node;
+}
+
+/**
+ * @brief check whether a buffer size is valid for the queue.
+ * 
+ * @param ctx context pointer.
+ * @param size buffer size.
+*/
+static bque_res_t check_size(bque_ctx_t *ctx, bque_u32_t size) {
+
+    /* the limits may be fixed at compile time. */
+    (void)ctx;
+
+    /* a fixed size needs no other check. */
+    if (conf_elem_size(ctx) != 0) {
+        return size == conf_elem_size(ctx) ? BQUE_OK : BQUE_ERR_BAD_SIZE;
+    }
+
+    if (size == 0 || (conf_buff_size_max(ctx) != 0 &&
+                      size > conf_buff_size_max(ctx))) {
+        return BQUE_ERR_BAD_SIZE;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief check whether some more buffers would exceed the limits of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param num number of the buffers.
+ * @param bytes total size of the buffers.
+*/
+static int is_full(bque_ctx_t *ctx, bque_u32_t num, bque_u64_t bytes) {
+    return (conf_node_num_max(ctx) != 0 &&
+            (num > conf_node_num_max(ctx) ||
+             ctx->cache.node_num > conf_node_num_max(ctx) - num)) ||
+           (ctx->conf.total_bytes_max != 0 &&
+            (bytes > ctx->conf.total_bytes_max ||
+             ctx->cache.buff_bytes > ctx->conf.total_bytes_max - bytes));
+}
+
+/**
+ * @brief check whether a buffer can be added to the queue.
+ * 
+ * @param ctx context pointer.
+ * @param size buffer size.
+*/
+static bque_res_t check_push(bque_ctx_t *ctx, bque_u32_t size) {
+
+    /* check whether the queue is full. */
+    if (is_full(ctx, 1, size)) {
+        stats_add(ctx, full_num, 1);
+
+        return BQUE_ERR_FULL_QUE;
+    }
+
+    /* check whether the size is invalid. */
+    return check_size(ctx, size);
+}
+
+/**
+ * @brief check whether a buffer can be added to the tail of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param size buffer size.
+ * @param full set when the queue is full and drops its head buffers for the
+ *             new one, see BQUE_FLAG_OVERWRITE.
+*/
+static bque_res_t check_append(bque_ctx_t *ctx, bque_u32_t size, int *full) {
+    *full = 0;
+    if (!(ctx->conf.flags & BQUE_FLAG_OVERWRITE) || !is_full(ctx, 1, size)) {
+        return check_push(ctx, size);
+    }
+
+    /* the buffer must fit into the empty queue at least. */
+    if (ctx->conf.total_bytes_max != 0 && size > ctx->conf.total_bytes_max) {
+        stats_add(ctx, full_num, 1);
+
+        return BQUE_ERR_FULL_QUE;
+    }
+    *full = 1;
+
+    return check_size(ctx, size);
+}
+
+#ifdef BQUE_THREADS
+
+/**
+ * @brief take places in the node number of a shared queue.
+ * 
+ * @note the node number is counted before the node is visible, so it never
+ *       drops below the number of linked nodes.
+ * 
+ * @param ctx context pointer.
+ * @param num number of the places.
+*/
+static bque_res_t sync_take_slot(bque_ctx_t *ctx, bque_u32_t num) {
+    bque_u32_t node_num;
+
+    node_num = bque_atomic_load(&ctx->cache.node_num);
+    do {
+        if (conf_node_num_max(ctx) != 0 &&
+            (num > conf_node_num_max(ctx) ||
+             node_num > conf_node_num_max(ctx) - num)) {
+            stats_add(ctx, full_num, 1);
+
+            return BQUE_ERR_FULL_QUE;
+        }
+    } while (!bque_atomic_cas(&ctx->cache.node_num, &node_num, node_num + num));
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief give back places in the node number of a shared queue.
+ * 
+ * @note the notification is raised when the queue stops being full.
+ * 
+ * @param ctx context pointer.
+ * @param num number of the places.
+*/
+static void sync_give_slot(bque_ctx_t *ctx, bque_u32_t num) {
+    bque_u32_t node_num;
+
+    node_num = bque_atomic_sub(&ctx->cache.node_num, num);
+    if (bque_is_notify(ctx) && conf_node_num_max(ctx) != 0 &&
+        node_num == conf_node_num_max(ctx)) {
+        notify_raise(ctx);
+    }
+}
+
+/**
+ * @brief link a chain of nodes to the tail of a shared queue, called by
+ *        producers.
+ * 
+ * @note the tail is swapped first, then the chain is published through the
+ *       link of the previous tail, or the head when the queue was drained.
+ * 
+ * @param ctx context pointer.
+ * @param first_node first node of the chain.
+ * @param last_node last node of the chain, the places of all nodes must be
+ *                  taken by sync_take_slot().
+*/
+static void sync_push(bque_ctx_t *ctx, bque_node_t *first_node, bque_node_t *last_node) {
+    bque_node_t *prev_node;
+    bque_u64_t buff_bytes = 0;
+    bque_u64_t mem_bytes = 0;
+#ifdef BQUE_STATS
+    bque_u64_t now = stats_now();
+#endif
+
+    /* count the bytes first, so the consumers never take more than that. */
+    for (prev_node = first_node; ; prev_node = prev_node->next_node) {
+        buff_bytes += prev_node->size;
+        mem_bytes += node_mem_size(prev_node);
+        stats_push(ctx, prev_node, now);
+        if (prev_node == last_node) {
+            break;
+        }
+    }
+    bque_atomic_add(&ctx->cache.buff_bytes, buff_bytes);
+    bque_atomic_add(&ctx->cache.mem_bytes, mem_bytes);
+
+    last_node->next_node = NULL;
+    prev_node = bque_atomic_xchg(&ctx->tail_node, last_node);
+    first_node->prev_node = prev_node;
+    if (prev_node == NULL) {
+        bque_atomic_store(&ctx->head_node, first_node);
+
+        /* the queue stops being empty. */
+        if (bque_is_notify(ctx)) {
+            notify_raise(ctx);
+        }
+    } else {
+        bque_atomic_store(&prev_node->next_node, first_node);
+    }
+}
+
+/**
+ * @brief unlink the head node of a shared queue, called by the consumer.
+ * 
+ * @note NULL is returned when the queue is empty, or when the only visible
+ *       node is still being linked after by a producer.
+ * 
+ * @param ctx context pointer.
+*/
+static bque_node_t *sync_pop(bque_ctx_t *ctx) {
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+
+    curt_node = bque_atomic_load(&ctx->head_node);
+    if (curt_node == NULL) {
+        return NULL;
+    }
+
+    next_node = bque_atomic_load(&curt_node->next_node);
+    if (next_node == NULL) {
+        bque_node_t *tail_node = curt_node;
+
+        /* the head seems to be the tail too, detach it from the tail, a
+           producer will publish its node through the head then. */
+        bque_atomic_store(&ctx->head_node, NULL);
+        if (!bque_atomic_cas(&ctx->tail_node, &tail_node, NULL)) {
+
+            /* a producer has swapped the tail but not linked its node, it
+               won't notify the consumer seeing the queue empty, so do it
+               here to try again. */
+            bque_atomic_store(&ctx->head_node, curt_node);
+            if (bque_is_notify(ctx)) {
+                notify_raise(ctx);
+            }
+
+            return NULL;
+        }
+    } else {
+        next_node->prev_node = NULL;
+        bque_atomic_store(&ctx->head_node, next_node);
+    }
+    curt_node->next_node = NULL;
+    sync_give_slot(ctx, 1);
+    bque_atomic_sub(&ctx->cache.buff_bytes, curt_node->size);
+    bque_atomic_sub(&ctx->cache.mem_bytes, node_mem_size(curt_node));
+    stats_pop(ctx, curt_node);
+
+    /* update the fast indexing cache. */
+    finger_remove(ctx, 0, 1);
+
+    return curt_node;
+}
+
+/**
+ * @brief wake up threads waiting on a shared queue, if there are any.
+ * 
+ * @param ctx context pointer.
+ * @param wait_num number of the waiting threads.
+ * @param cond condition the threads are waiting on.
+ * @param num number of the nodes or places which became available.
+*/
+static void sync_wake(bque_ctx_t *ctx, bque_u32_t *wait_num, pthread_cond_t *cond,
+                      bque_u32_t num) {
+
+    /* read the waiter number with a read-modify-write, so either a waiter
+       announcing itself sees the preceding change, or it's seen here. */
+    if (__atomic_fetch_add(wait_num, 0, __ATOMIC_SEQ_CST) != 0) {
+        pthread_mutex_lock(&ctx->sync.lock);
+        if (num > 1) {
+            pthread_cond_broadcast(cond);
+        } else {
+            pthread_cond_signal(cond);
+        }
+        pthread_mutex_unlock(&ctx->sync.lock);
+    }
+}
+
+/**
+ * @brief get the absolute time after a timeout.
+ * 
+ * @param ts time pointer.
+ * @param timeout timeout in milliseconds.
+*/
+static void sync_deadline(struct timespec *ts, bque_s32_t timeout) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout / 1000;
+    ts->tv_nsec += (long)(timeout % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * @brief wait on a condition of a shared queue, the lock must be held.
+ * 
+ * @param ctx context pointer.
+ * @param cond condition pointer.
+ * @param deadline absolute time to give up, NULL means to wait forever.
+*/
+static bque_res_t sync_wait(bque_ctx_t *ctx, pthread_cond_t *cond,
+                            const struct timespec *deadline) {
+    if (deadline == NULL) {
+        pthread_cond_wait(cond, &ctx->sync.lock);
+    } else if (pthread_cond_timedwait(cond, &ctx->sync.lock, deadline) == ETIMEDOUT) {
+        return BQUE_ERR;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief take one place in the node number of a shared queue, waiting until
+ *        the queue is not full.
+ * 
+ * @param ctx context pointer.
+ * @param timeout timeout in milliseconds, 0 means not to wait and a negative
+ *                value means to wait forever.
+*/
+static bque_res_t sync_take_slot_wait(bque_ctx_t *ctx, bque_s32_t timeout) {
+    struct timespec deadline;
+    bque_res_t res;
+
+    res = sync_take_slot(ctx, 1);
+    if (res != BQUE_ERR_FULL_QUE || timeout == 0) {
+        return res;
+    }
+
+    if (timeout > 0) {
+        sync_deadline(&deadline, timeout);
+    }
+
+    pthread_mutex_lock(&ctx->sync.lock);
+    __atomic_add_fetch(&ctx->sync.enq_wait_num, 1, __ATOMIC_SEQ_CST);
+    while ((res = sync_take_slot(ctx, 1)) == BQUE_ERR_FULL_QUE) {
+        if (sync_wait(ctx, &ctx->sync.not_full,
+                      timeout > 0 ? &deadline : NULL) != BQUE_OK) {
+            res = sync_take_slot(ctx, 1);
+            break;
+        }
+    }
+    __atomic_sub_fetch(&ctx->sync.enq_wait_num, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ctx->sync.lock);
+
+    return res;
+}
+
+/**
+ * @brief link a chain of nodes to the tail of a shared queue and wake up
+ *        the consumers.
+ * 
+ * @param ctx context pointer.
+ * @param first_node first node of the chain.
+ * @param last_node last node of the chain.
+ * @param num number of the nodes, their places must be taken already.
+*/
+static void sync_publish(bque_ctx_t *ctx, bque_node_t *first_node,
+                         bque_node_t *last_node, bque_u32_t num) {
+    sync_push(ctx, first_node, last_node);
+    sync_wake(ctx, &ctx->sync.deq_wait_num, &ctx->sync.not_empty, num);
+}
+
+/**
+ * @brief unlink the head node of a shared queue, waiting until the queue is
+ *        not empty, and wake up a producer.
+ * 
+ * @param ctx context pointer.
+ * @param timeout timeout in milliseconds, 0 means not to wait and a negative
+ *                value means to wait forever.
+*/
+static bque_node_t *sync_take_node(bque_ctx_t *ctx, bque_s32_t timeout) {
+    struct timespec deadline;
+    bque_node_t *node;
+
+    if (!(ctx->conf.flags & BQUE_FLAG_MPMC) && timeout == 0) {
+
+        /* the only consumer doesn't need the lock. */
+        node = sync_pop(ctx);
+    } else {
+        if (timeout > 0) {
+            sync_deadline(&deadline, timeout);
+        }
+
+        pthread_mutex_lock(&ctx->sync.lock);
+        node = sync_pop(ctx);
+        if (node == NULL && timeout != 0) {
+            __atomic_add_fetch(&ctx->sync.deq_wait_num, 1, __ATOMIC_SEQ_CST);
+            while ((node = sync_pop(ctx)) == NULL) {
+                if (sync_wait(ctx, &ctx->sync.not_empty,
+                              timeout > 0 ? &deadline : NULL) != BQUE_OK) {
+                    node = sync_pop(ctx);
+                    break;
+                }
+            }
+            __atomic_sub_fetch(&ctx->sync.deq_wait_num, 1, __ATOMIC_SEQ_CST);
+        }
+        pthread_mutex_unlock(&ctx->sync.lock);
+    }
+
+    if (node != NULL) {
+        sync_wake(ctx, &ctx->sync.enq_wait_num, &ctx->sync.not_full, 1);
+    }
+
+    return node;
+}
+
+/**
+ * @brief append a buffer to the tail of a shared queue.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, can be NULL.
+ * @param size buffer size.
+ * @param timeout timeout in milliseconds to wait while the queue is full.
+*/
+static bque_res_t sync_enqueue(bque_ctx_t *ctx, const void *buff, bque_u32_t size,
+                               bque_s32_t timeout) {
+    bque_node_t *new_node;
+    bque_res_t res;
+
+    res = check_size(ctx, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    res = sync_take_slot_wait(ctx, timeout);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    res = create_node(ctx, &new_node, size);
+    if (res != BQUE_OK) {
+        sync_give_slot(ctx, 1);
+
+        return res;
+    }
+
+    if (buff != NULL) {
+        memcpy(new_node->buff, buff, size);
+    }
+    sync_publish(ctx, new_node, new_node, 1);
+
+    return BQUE_OK;
+}
+
+#endif
+
+/**
+ * @brief check whether two buffers are out of the sorting order.
+ * 
+ * @param cb sorting callback.
+ * @param order sorting order.
+ * @param buff_a the buffer which is currently before buff_b.
+ * @param size_a size of buff_a.
+ * @param buff_b buffer pointer.
+ * @param size_b size of buff_b.
+*/
+static inline int sort_swapped(bque_sort_cb_t cb, bque_sort_order_t order,
+                               const void *buff_a, bque_size_t size_a,
+                               const void *buff_b, bque_size_t size_b) {
+    bque_sort_res_t sort_res;
+
+    sort_res = cb(buff_a, size_a, buff_b, size_b);
+    if (order == BQUE_SORT_ASCENDING) {
+        return sort_res == BQUE_SORT_GREATER;
+    } else {
+        return sort_res == BQUE_SORT_LESS;
+    }
+}
+
+/**
+ * @brief check whether a buffer fits into a chunk.
+ * 
+ * @param chunk chunk pointer.
+ * @param size buffer size.
+*/
+static int chunk_fits(bque_chunk_t *chunk, bque_u32_t size) {
+    if (chunk->elem_size != 0) {
+        return (size_t)chunk->entry_num < chunk_slot_num(chunk);
+    }
+
+    return chunk_entry_end(chunk->entry_num + 1) + chunk->data_used +
+           bque_align_up(size) <= BQUE_CHUNK_SIZE;
+}
+
+/**
+ * @brief move the buffers of a chunk to its end in queue order, so the holes
+ *        are reclaimed.
+ * 
+ * @note the buffers of a fixed size are moved to the first slots instead.
+ * 
+ * @param chunk chunk pointer.
+*/
+static void chunk_compact(bque_chunk_t *chunk) {
+    bque_align_t temp[BQUE_CHUNK_SIZE / sizeof(bque_align_t)];
+    bque_u32_t offs = BQUE_CHUNK_SIZE;
+    bque_u32_t i;
+
+    if (chunk->elem_size != 0) {
+        memmove((bque_u8_t *)chunk + BQUE_CHUNK_SLOT_START, chunk_buff(chunk, 0),
+                chunk_slot_size(chunk) * chunk->entry_num);
+        chunk->data_offs = 0;
+
+        return;
+    }
+
+    for (i = 0; i < chunk->entry_num; i++) {
+        offs -= bque_align_up(chunk->entry[i].size);
+        memcpy((bque_u8_t *)temp + offs, chunk_buff(chunk, i),
+               chunk->entry[i].size);
+        chunk->entry[i].offs = (bque_u16_t)offs;
+    }
+    memcpy((bque_u8_t *)chunk + offs, (bque_u8_t *)temp + offs,
+           BQUE_CHUNK_SIZE - offs);
+    chunk->data_offs = (bque_u16_t)offs;
+}
+
+/**
+ * @brief add a buffer to a chunk.
+ * 
+ * @note the buffer must fit into the chunk.
+ * 
+ * @param chunk chunk pointer.
+ * @param pos position of the buffer in the chunk.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+*/
+static void chunk_put(bque_chunk_t *chunk, bque_u32_t pos,
+                      const void *buff, bque_u32_t size) {
+    bque_u32_t align_size = bque_align_up(size);
+
+    if (chunk->elem_size != 0) {
+        size_t slot_size = chunk_slot_size(chunk);
+
+        /* move the fewer buffers out of the way, the ones before the
+           position when there is a free slot before the first one. */
+        if (chunk->data_offs > 0 && pos < chunk->entry_num - pos) {
+            chunk->data_offs--;
+            memmove(chunk_buff(chunk, 0), chunk_buff(chunk, 1), slot_size * pos);
+        } else {
+            if ((size_t)chunk->data_offs + chunk->entry_num == chunk_slot_num(chunk)) {
+                chunk_compact(chunk);
+            }
+            memmove(chunk_buff(chunk, pos + 1), chunk_buff(chunk, pos),
+                    slot_size * (chunk->entry_num - pos));
+        }
+        if (buff != NULL) {
+            memcpy(chunk_buff(chunk, pos), buff, size);
+        }
+        chunk->entry_num++;
+
+        return;
+    }
+
+    if (chunk_entry_end(chunk->entry_num + 1) + align_size > chunk->data_offs) {
+        chunk_compact(chunk);
+    }
+    memmove(&chunk->entry[pos + 1], &chunk->entry[pos],
+            sizeof(chunk->entry[0]) * (chunk->entry_num - pos));
+    chunk->data_offs -= align_size;
+    chunk->data_used += align_size;
+    chunk->entry[pos].offs = chunk->data_offs;
+    chunk->entry[pos].size = (bque_u16_t)size;
+    if (buff != NULL) {
+        memcpy(chunk_buff(chunk, pos), buff, size);
+    }
+    chunk->entry_num++;
+}
+
+/**
+ * @brief remove a buffer from a chunk.
+ * 
+ * @note the data is not moved, only the last written buffer gives its space
+ *       back right away. the fewer buffers of a fixed size on either side
+ *       are moved over the slot instead.
+ * 
+ * @param chunk chunk pointer.
+ * @param pos position of the buffer in the chunk.
+*/
+static void chunk_take(bque_chunk_t *chunk, bque_u32_t pos) {
+    bque_u32_t align_size;
+
+    if (chunk->elem_size != 0) {
+        size_t slot_size = chunk_slot_size(chunk);
+
+        if (pos < chunk->entry_num - 1 - pos) {
+            memmove(chunk_buff(chunk, 1), chunk_buff(chunk, 0), slot_size * pos);
+            chunk->data_offs++;
+        } else {
+            memmove(chunk_buff(chunk, pos), chunk_buff(chunk, pos + 1),
+                    slot_size * (chunk->entry_num - pos - 1));
+        }
+        chunk->entry_num--;
+        if (chunk->entry_num == 0) {
+            chunk->data_offs = 0;
+        }
+
+        return;
+    }
+
+    align_size = bque_align_up(chunk->entry[pos].size);
+    if (chunk->entry[pos].offs == chunk->data_offs) {
+        chunk->data_offs += align_size;
+    }
+    chunk->data_used -= align_size;
+    memmove(&chunk->entry[pos], &chunk->entry[pos + 1],
+            sizeof(chunk->entry[0]) * (chunk->entry_num - pos - 1));
+    chunk->entry_num--;
+    if (chunk->entry_num == 0) {
+        chunk->data_offs = BQUE_CHUNK_SIZE;
+    }
+}
+
+/**
+ * @brief create an empty chunk and link it into the queue.
+ * 
+ * @param ctx context pointer.
+ * @param prev_node the chunk node to link after, NULL means the head.
+ * @param node the created chunk node.
+*/
+static bque_res_t packed_create(bque_ctx_t *ctx, bque_node_t *prev_node,
+                                bque_node_t **node) {
+    bque_node_t *new_node;
+    bque_chunk_t *chunk;
+    bque_res_t res;
+
+    res = create_node(ctx, &new_node, BQUE_CHUNK_SIZE);
+    if (res != BQUE_OK) {
+        return res;
+    }
+    chunk = node_to_chunk(new_node);
+    chunk->entry_num = 0;
+    chunk->data_used = 0;
+    chunk->elem_size = (bque_u16_t)conf_elem_size(ctx);
+    chunk->data_offs = chunk->elem_size != 0 ? 0 : BQUE_CHUNK_SIZE;
+    ctx->cache.mem_bytes += node_mem_size(new_node);
+
+    /* link the node. */
+    new_node->prev_node = prev_node;
+    if (prev_node != NULL) {
+        new_node->next_node = prev_node->next_node;
+        prev_node->next_node = new_node;
+    } else {
+        new_node->next_node = ctx->head_node;
+        ctx->head_node = new_node;
+    }
+    if (new_node->next_node != NULL) {
+        new_node->next_node->prev_node = new_node;
+    } else {
+        ctx->tail_node = new_node;
+    }
+    *node = new_node;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief unlink an empty chunk from the queue and destroy it.
+ * 
+ * @param ctx context pointer.
+ * @param node chunk node pointer.
+*/
+static void packed_destroy(bque_ctx_t *ctx, bque_node_t *node) {
+    if (node->prev_node != NULL) {
+        node->prev_node->next_node = node->next_node;
+    } else {
+        ctx->head_node = node->next_node;
+    }
+    if (node->next_node != NULL) {
+        node->next_node->prev_node = node->prev_node;
+    } else {
+        ctx->tail_node = node->prev_node;
+    }
+    ctx->cache.mem_bytes -= node_mem_size(node);
+    destroy_node(ctx, node);
+}
+
+/**
+ * @brief find the chunk holding a buffer by index.
+ * 
+ * @param ctx context pointer.
+ * @param idx valid index of the buffer.
+ * @param pos position of the buffer in the chunk.
+*/
+static bque_node_t *packed_find(bque_ctx_t *ctx, bque_u32_t idx, bque_u32_t *pos) {
+    bque_node_t *curt_node;
+    bque_u32_t first_idx;
+
+    BQUE_ASSERT(idx < ctx->cache.node_num);
+
+    /* walk the chunks from the closer end. */
+    if (idx < ctx->cache.node_num / 2) {
+        curt_node = ctx->head_node;
+        first_idx = 0;
+        while (idx >= first_idx + node_to_chunk(curt_node)->entry_num) {
+            first_idx += node_to_chunk(curt_node)->entry_num;
+            curt_node = curt_node->next_node;
+        }
+    } else {
+        curt_node = ctx->tail_node;
+        first_idx = ctx->cache.node_num - node_to_chunk(curt_node)->entry_num;
+        while (idx < first_idx) {
+            curt_node = curt_node->prev_node;
+            first_idx -= node_to_chunk(curt_node)->entry_num;
+        }
+    }
+    *pos = idx - first_idx;
+
+    return curt_node;
+}
+
+/**
+ * @brief add a buffer to a queue of the packed mode.
+ * 
+ * @note a full chunk gets a new neighbour when the buffer goes to one of its
+ *       ends, otherwise it's split at the position of the buffer.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the added buffer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size, must have passed check_push().
+*/
+static bque_res_t packed_push(bque_ctx_t *ctx, bque_u32_t idx,
+                              const void *buff, bque_u32_t size) {
+    bque_node_t *curt_node;
+    bque_node_t *new_node;
+    bque_chunk_t *chunk;
+    bque_u32_t pos;
+    bque_res_t res;
+
+    /* find the chunk and the position of the buffer. */
+    if (ctx->cache.node_num == 0) {
+        res = packed_create(ctx, NULL, &curt_node);
+        if (res != BQUE_OK) {
+            return res;
+        }
+        pos = 0;
+    } else if (idx == ctx->cache.node_num) {
+        curt_node = ctx->tail_node;
+        pos = node_to_chunk(curt_node)->entry_num;
+    } else {
+        curt_node = packed_find(ctx, idx, &pos);
+
+        /* on a chunk boundary, the end of the previous chunk works too. */
+        if (pos == 0 && curt_node->prev_node != NULL &&
+            !chunk_fits(node_to_chunk(curt_node), size) &&
+            chunk_fits(node_to_chunk(curt_node->prev_node), size)) {
+            curt_node = curt_node->prev_node;
+            pos = node_to_chunk(curt_node)->entry_num;
+        }
+    }
+
+    /* make room for the buffer. */
+    chunk = node_to_chunk(curt_node);
+    if (!chunk_fits(chunk, size)) {
+        if (pos == 0) {
+            res = packed_create(ctx, curt_node->prev_node, &new_node);
+        } else if (pos == chunk->entry_num) {
+            res = packed_create(ctx, curt_node, &new_node);
+        } else {
+            bque_u32_t i;
+
+            /* move the buffers from the position on to a new chunk. */
+            res = packed_create(ctx, curt_node, &new_node);
+            if (res != BQUE_OK) {
+                return res;
+            }
+            for (i = pos; i < chunk->entry_num; i++) {
+                chunk_put(node_to_chunk(new_node), i - pos,
+                          chunk_buff(chunk, i), chunk_size(chunk, i));
+            }
+            while (chunk->entry_num > pos) {
+                chunk_take(chunk, chunk->entry_num - 1);
+            }
+            if (chunk_fits(chunk, size)) {
+                new_node = curt_node;
+            } else if (!chunk_fits(node_to_chunk(new_node), size)) {
+                res = packed_create(ctx, curt_node, &new_node);
+            }
+        }
+        if (res != BQUE_OK) {
+            return res;
+        }
+        if (new_node != curt_node) {
+            curt_node = new_node;
+            pos = 0;
+        }
+        chunk = node_to_chunk(curt_node);
+    }
+
+    /* add the buffer. */
+    chunk_put(chunk, pos, buff, size);
+    ctx->cache.node_num++;
+    ctx->cache.buff_bytes += size;
+    stats_push(ctx, NULL, 0);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief remove a buffer from a known position of a queue of the packed mode.
+ * 
+ * @param ctx context pointer.
+ * @param node chunk node pointer.
+ * @param pos valid position of the buffer in the chunk.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+ * @param release whether to release the buffer with the freeing callback.
+*/
+static void packed_take(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t pos,
+                        void *buff, bque_u32_t *size, int release) {
+    bque_chunk_t *chunk = node_to_chunk(node);
+
+    /* if necessary, output the buffer and buffer size. */
+    if (buff != NULL) {
+        memcpy(buff, chunk_buff(chunk, pos), chunk_size(chunk, pos));
+    }
+    if (size != NULL) {
+        *size = chunk_size(chunk, pos);
+    }
+    if (release && conf_free_buff_cb(ctx) != NULL) {
+        conf_free_buff_cb(ctx)(chunk_buff(chunk, pos), chunk_size(chunk, pos));
+    }
+
+    /* remove the buffer, and the chunk once it's empty. */
+    ctx->cache.buff_bytes -= chunk_size(chunk, pos);
+    chunk_take(chunk, pos);
+    if (chunk->entry_num == 0) {
+        packed_destroy(ctx, node);
+    }
+    ctx->cache.node_num--;
+}
+
+/**
+ * @brief remove a buffer from a queue of the packed mode.
+ * 
+ * @param ctx context pointer.
+ * @param idx valid index of the buffer.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+ * @param release whether to release the buffer with the freeing callback.
+*/
+static void packed_pop(bque_ctx_t *ctx, bque_u32_t idx, void *buff, bque_u32_t *size,
+                       int release) {
+    bque_node_t *curt_node;
+    bque_u32_t pos;
+
+    /* find the chunk and the position of the buffer. */
+    if (idx == 0) {
+        curt_node = ctx->head_node;
+        pos = 0;
+    } else if (idx == ctx->cache.node_num - 1) {
+        curt_node = ctx->tail_node;
+        pos = node_to_chunk(curt_node)->entry_num - 1;
+    } else {
+        curt_node = packed_find(ctx, idx, &pos);
+    }
+
+    packed_take(ctx, curt_node, pos, buff, size, release);
+    stats_pop(ctx, NULL);
+}
+
+/**
+ * @brief remove all buffers from a queue of the packed mode.
+ * 
+ * @param ctx context pointer.
+*/
+static void packed_clear(bque_ctx_t *ctx) {
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+    bque_chunk_t *chunk;
+    bque_u32_t i;
+
+    curt_node = ctx->head_node;
+    while (curt_node != NULL) {
+        next_node = curt_node->next_node;
+        if (conf_free_buff_cb(ctx) != NULL) {
+            chunk = node_to_chunk(curt_node);
+            for (i = 0; i < chunk->entry_num; i++) {
+                conf_free_buff_cb(ctx)(chunk_buff(chunk, i), chunk_size(chunk, i));
+            }
+        }
+        destroy_node(ctx, curt_node);
+        curt_node = next_node;
+    }
+}
+
+/**
+ * @brief find the index where a buffer goes in a queue kept in priority order.
+ * 
+ * @note the buffer goes after all buffers which don't come after it, so equal
+ *       buffers keep their arrival order. the index and the ring are searched
+ *       in logarithmic time, the chunks of the packed mode are walked from the
+ *       tail and searched inside, and the plain list is walked from the tail.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer.
+ * @param size buffer size.
+*/
+static bque_u32_t prio_pos(bque_ctx_t *ctx, const void *buff, bque_u32_t size) {
+    bque_sort_cb_t cb = ctx->conf.prio_cb;
+    bque_sort_order_t order = ctx->conf.prio_order;
+    bque_node_t *curt_node;
+    bque_u32_t idx;
+
+    if (ctx->index.head != NULL) {
+        bque_tower_t *curt_tower = ctx->index.head;
+        bque_u32_t l;
+
+        /* skip the towers which don't come after the buffer. */
+        idx = 0;
+        for (l = ctx->index.level; l-- > 0;) {
+            while (curt_tower->link[l].next != NULL &&
+                   !sort_swapped(cb, order, curt_tower->link[l].next->node->buff,
+                                 curt_tower->link[l].next->node->size, buff, size)) {
+                idx += curt_tower->link[l].span;
+                curt_tower = curt_tower->link[l].next;
+            }
+        }
+
+        /* walk the rest of the way on the nodes. */
+        curt_node = idx == 0 ? ctx->head_node : curt_tower->node->next_node;
+        while (curt_node != NULL &&
+               !sort_swapped(cb, order, curt_node->buff, curt_node->size, buff, size)) {
+            curt_node = curt_node->next_node;
+            idx++;
+        }
+
+        return idx;
+    }
+
+    if (ctx->ring.slot != NULL) {
+        bque_u32_t lo = 0;
+        bque_u32_t hi = ctx->cache.node_num;
+        bque_u32_t mid;
+
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            curt_node = ctx->ring.slot[ring_pos(ctx, mid)];
+            if (sort_swapped(cb, order, curt_node->buff, curt_node->size, buff, size)) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+
+        return lo;
+    }
+
+    if (bque_is_packed(ctx)) {
+        bque_chunk_t *chunk;
+        bque_u32_t lo;
+        bque_u32_t hi;
+        bque_u32_t mid;
+
+        /* find the last chunk starting with a buffer which doesn't come
+           after the buffer. */
+        idx = ctx->cache.node_num;
+        for (curt_node = ctx->tail_node; curt_node != NULL;
+             curt_node = curt_node->prev_node) {
+            chunk = node_to_chunk(curt_node);
+            idx -= chunk->entry_num;
+            if (!sort_swapped(cb, order, chunk_buff(chunk, 0), chunk_size(chunk, 0),
+                              buff, size)) {
+                break;
+            }
+        }
+        if (curt_node == NULL) {
+            return 0;
+        }
+
+        /* search inside the chunk. */
+        lo = 1;
+        hi = chunk->entry_num;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (sort_swapped(cb, order, chunk_buff(chunk, mid), chunk_size(chunk, mid),
+                             buff, size)) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+
+        return idx + lo;
+    }
+
+    /* walk back from the tail. */
+    idx = ctx->cache.node_num;
+    for (curt_node = ctx->tail_node; curt_node != NULL &&
+         sort_swapped(cb, order, curt_node->buff, curt_node->size, buff, size);
+         curt_node = curt_node->prev_node) {
+        idx--;
+    }
+
+    return idx;
+}
+
+/**
+ * @brief find the index where a buffer is appended.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer.
+ * @param size buffer size.
+*/
+static bque_u32_t push_pos(bque_ctx_t *ctx, const void *buff, bque_u32_t size) {
+    if (ctx->conf.prio_cb != NULL) {
+        return prio_pos(ctx, buff, size);
+    }
+
+    return ctx->cache.node_num;
+}
+
+/**
+ * @brief link a node into the queue before a known node.
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer.
+ * @param idx index of the node after linking, must not exceed the node number.
+ * @param next_node the node at the index before linking, NULL means the node
+ *                  is found by the index.
+*/
+static void attach_node_before(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t idx,
+                               bque_node_t *next_node) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(node != NULL);
+    BQUE_ASSERT(idx <= ctx->cache.node_num);
+
+    /* insert the node. */
+    if (ctx->head_node == NULL) {
+
+        /* insert to the empty queue. */
+        node->prev_node = NULL;
+        node->next_node = NULL;
+        ctx->head_node = node;
+        ctx->tail_node = node;
+    } else if (idx == 0) {
+
+        /* insert to the head. */
+        node->prev_node = NULL;
+        node->next_node = ctx->head_node;
+        ctx->head_node->prev_node = node;
+        ctx->head_node = node;
+    } else if (idx == ctx->cache.node_num) {
+
+        /* insert to the tail. */
+        node->prev_node = ctx->tail_node;
+        node->next_node = NULL;
+        ctx->tail_node->next_node = node;
+        ctx->tail_node = node;
+    } else {
+
+        /* insert to the middle. */
+        bque_node_t *curt_node = next_node != NULL ? next_node : find_node(ctx, idx);
+
+        node->prev_node = curt_node->prev_node;
+        node->next_node = curt_node;
+        curt_node->prev_node->next_node = node;
+        curt_node->prev_node = node;
+    }
+    if (ctx->ring.slot != NULL) {
+        ring_insert(ctx, node, idx);
+    }
+    if (ctx->index.head != NULL) {
+        index_insert(ctx, node, idx);
+    }
+
+    /* update the node number and the byte counts. */
+    ctx->cache.node_num++;
+    ctx->cache.buff_bytes += node->size;
+    ctx->cache.mem_bytes += node_mem_size(node);
+    stats_push(ctx, node, stats_now());
+
+    /* update the fast indexing cache. */
+    finger_insert(ctx, idx);
+}
+
+/**
+ * @brief link a node into the queue.
+ * 
+ * @param ctx context pointer.
+ * @param node node pointer.
+ * @param idx index of the node after linking, must not exceed the node number.
+*/
+static void attach_node(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t idx) {
+    attach_node_before(ctx, node, idx, NULL);
+}
+
+/**
+ * @brief add a buffer to the queue.
+ * 
+ * @note the buffer must have passed check_push().
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the added buffer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+*/
+static bque_res_t push_buff(bque_ctx_t *ctx, bque_u32_t idx,
+                            const void *buff, bque_u32_t size) {
+    bque_node_t *new_node;
+    bque_res_t res;
+
+    if (bque_is_packed(ctx)) {
+        return packed_push(ctx, idx, buff, size);
+    }
+
+    /* create a new node. */
+    res = create_node(ctx, &new_node, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    /* if necessary, copy the buffer. */
+    if (buff != NULL) {
+        memcpy(new_node->buff, buff, size);
+    }
+
+    /* link the node. */
+    attach_node(ctx, new_node, idx);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief drop the head buffer of a full queue to make room for a new one.
+ * 
+ * @note the buffer is released with the freeing callback and counted as
+ *       dropped rather than taken, so it stays out of the dwell time. its
+ *       node is detached and returned when it's to be reused, otherwise it
+ *       goes through retire_node() and NULL is returned, which is always the
+ *       case in the packed mode and with BQUE_FLAG_DEFER_FREE, whose nodes
+ *       wait for bque_reclaim() to release their buffers.
+ * 
+ * @param ctx context pointer.
+ * @param reuse whether the node is wanted for a new buffer.
+*/
+static bque_node_t *drop_head(bque_ctx_t *ctx, int reuse) {
+    bque_node_t *curt_node = ctx->head_node;
+
+    /* the dropped buffers are counted apart from the ones taken. */
+    ctx->cache.drop_num++;
+
+    if (bque_is_packed(ctx)) {
+        packed_take(ctx, curt_node, 0, NULL, NULL, 1);
+
+        return NULL;
+    }
+
+    unlink_node(ctx, curt_node, 0);
+    if (!reuse || (ctx->conf.flags & BQUE_FLAG_DEFER_FREE)) {
+        retire_node(ctx, curt_node, 1);
+
+        return NULL;
+    }
+    if (conf_free_buff_cb(ctx) != NULL) {
+        conf_free_buff_cb(ctx)(curt_node->buff, curt_node->size);
+    }
+
+    return curt_node;
+}
+
+/**
+ * @brief count the head buffers to drop before some buffers fit, without
+ *        dropping them.
+ * 
+ * @param ctx context pointer.
+ * @param num number of the buffers, within the limit of the queue.
+ * @param bytes total size of the buffers, within the limit of the queue.
+*/
+static bque_u32_t drop_count(bque_ctx_t *ctx, bque_u32_t num, bque_u64_t bytes) {
+    bque_node_t *curt_node = ctx->head_node;
+    bque_u32_t node_num = ctx->cache.node_num;
+    bque_u64_t buff_bytes = ctx->cache.buff_bytes;
+    bque_u32_t drop_num = 0;
+
+    while ((conf_node_num_max(ctx) != 0 && node_num > conf_node_num_max(ctx) - num) ||
+           (ctx->conf.total_bytes_max != 0 &&
+            buff_bytes > ctx->conf.total_bytes_max - bytes)) {
+        node_num--;
+        buff_bytes -= curt_node->size;
+        curt_node = curt_node->next_node;
+        drop_num++;
+    }
+
+    return drop_num;
+}
+
+/**
+ * @brief add a buffer to a full queue in place of its head buffers.
+ * 
+ * @note the head buffers are dropped until the new one is within the limits,
+ *       the node of the first one is reused when the new buffer fits, so a
+ *       queue overflowing steadily doesn't allocate.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+*/
+static bque_res_t overwrite_buff(bque_ctx_t *ctx, const void *buff, bque_u32_t size) {
+    bque_node_t *curt_node;
+
+    curt_node = drop_head(ctx, 1);
+    while (is_full(ctx, 1, size)) {
+        drop_head(ctx, 0);
+    }
+    if (curt_node == NULL || size > curt_node->cap) {
+
+        /* the buffer of a node returned by drop_head() is released already. */
+        if (curt_node != NULL) {
+            destroy_node(ctx, curt_node);
+        }
+
+        return push_buff(ctx, push_pos(ctx, buff, size), buff, size);
+    }
+
+    /* if necessary, copy the buffer. */
+    curt_node->buff = (bque_u8_t *)curt_node->data;
+    curt_node->size = size;
+    if (buff != NULL) {
+        memcpy(curt_node->buff, buff, size);
+    }
+
+    /* link the node. */
+    attach_node(ctx, curt_node, push_pos(ctx, curt_node->buff, size));
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief append a buffer to the tail of the queue.
+ * 
+ * @note with BQUE_FLAG_SPSC or BQUE_FLAG_MPMC, this can be called by the
+ *       producer threads while the consumer threads are dequeuing.
+ * 
+ * @note with a priority callback, the buffer goes to its place in the order
+ *       instead, which is found in logarithmic time with BQUE_FLAG_RING or
+ *       BQUE_FLAG_INDEXED.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer, but not with a priority callback.
+ * @param size buffer size.
+*/
+BQUE_API bque_res_t bque_enqueue(bque_ctx_t *ctx, const void *buff, bque_u32_t size) {
+    bque_res_t res;
+    int full;
+
+    BQUE_ASSERT(ctx != NULL);
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        return sync_enqueue(ctx, buff, size, 0);
+    }
+#endif
+
+#ifdef BQUE_FILE
+    if (bque_is_file(ctx)) {
+        bque_vec_t vec;
+
+        res = check_push(ctx, size);
+        if (res != BQUE_OK) {
+            return res;
+        }
+        vec.base = (void *)buff;
+        vec.size = size;
+
+        return file_push(ctx, &vec, 1);
+    }
+#endif
+
+    /* check whether the buffer can be added. */
+    res = check_append(ctx, size, &full);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    /* the priority order needs the content of the buffer. */
+    if (ctx->conf.prio_cb != NULL && buff == NULL) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    if (full) {
+        return overwrite_buff(ctx, buff, size);
+    }
+
+    return push_buff(ctx, push_pos(ctx, buff, size), buff, size);
+}
+
+/**
+ * @brief append a buffer to the head of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+*/
+BQUE_API bque_res_t bque_preempt(bque_ctx_t *ctx, const void *buff, bque_u32_t size) {
+    bque_res_t res;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    /* the position is given by the priority order, and the file backend
+       only adds buffers to the tail. */
+    if (ctx->conf.prio_cb != NULL || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the buffer can be added. */
+    res = check_push(ctx, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    return push_buff(ctx, 0, buff, size);
+}
+
+/**
+ * @brief insert a buffer to the queue.
+ * 
+ * @note the buffer will be inserted to the specified index.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the inserted buffer.
+ * @param buff buffer pointer.
+ * @param size buffer size.
+*/
+BQUE_API bque_res_t bque_insert(bque_ctx_t *ctx, bque_u32_t idx, const void *buff, bque_u32_t size) {
+    bque_res_t res;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    /* the position is given by the priority order, and the file backend
+       only adds buffers to the tail. */
+    if (ctx->conf.prio_cb != NULL || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the buffer can be added. */
+    res = check_push(ctx, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    /* check whether the idx is invalid. */
+    if (idx > ctx->cache.node_num) {
+        return BQUE_ERR_BAD_OFFS;
+    }
+
+    return push_buff(ctx, idx, buff, size);
+}
+
+/**
+ * @brief allocate a buffer which can be handed to bque_enqueue_adopt() later.
+ * 
+ * @note the buffer is not part of the queue until it's adopted, if it's not
+ *       going to be adopted, give it back with bque_release().
+ * 
+ * @param ctx context pointer.
+ * @param size buffer size.
+ * @param buff the address of the buffer pointer.
+*/
+BQUE_API bque_res_t bque_alloc(bque_ctx_t *ctx, bque_u32_t size, void **buff) {
+    bque_node_t *new_node;
+    bque_res_t res;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    /* the buffers of the packed mode and the file backend don't have nodes
+       of their own. */
+    if (bque_is_packed(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the size is invalid. */
+    res = check_size(ctx, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    /* create a new node. */
+    res = create_node(ctx, &new_node, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    *buff = new_node->buff;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief append a caller-owned buffer to the tail of the queue without
+ *        copying it.
+ * 
+ * @note the buffer must come from bque_alloc() or one of the *_ref functions
+ *       of the same queue. on success the queue owns the buffer and releases
+ *       it like any other buffer, on failure it's still owned by the caller.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer.
+ * @param size buffer size, must not exceed the size the buffer was allocated
+ *             or detached with.
+*/
+BQUE_API bque_res_t bque_enqueue_adopt(bque_ctx_t *ctx, void *buff, bque_u32_t size) {
+    bque_node_t *new_node;
+    bque_res_t res;
+    int full;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    /* the buffers of the packed mode and the file backend don't have nodes
+       of their own. */
+    if (bque_is_packed(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        new_node = buff_to_node(buff);
+        res = check_size(ctx, size);
+        if (res != BQUE_OK || size > new_node->size) {
+            return BQUE_ERR_BAD_SIZE;
+        }
+        res = sync_take_slot(ctx, 1);
+        if (res != BQUE_OK) {
+            return res;
+        }
+        new_node->size = size;
+        sync_publish(ctx, new_node, new_node, 1);
+
+        return BQUE_OK;
+    }
+#endif
+
+    /* check whether the buffer can be added. */
+    res = check_append(ctx, size, &full);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    new_node = buff_to_node(buff);
+    if (size > new_node->size) {
+        return BQUE_ERR_BAD_SIZE;
+    }
+
+    /* if necessary, make room for the node. */
+    while (full && is_full(ctx, 1, size)) {
+        drop_head(ctx, 0);
+    }
+
+    /* link the node. */
+    new_node->size = size;
+    attach_node(ctx, new_node, push_pos(ctx, new_node->buff, size));
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief reserve a buffer for a new tail node, so it can be filled in place.
+ * 
+ * @note only one buffer can be reserved at a time, the reserved buffer becomes
+ *       part of the queue once bque_commit() is called. the reservation
+ *       belongs to the context rather than to a producer, so BQUE_FLAG_MPMC
+ *       doesn't support it, its producers use bque_alloc() and
+ *       bque_enqueue_adopt() instead.
+ * 
+ * @param ctx context pointer.
+ * @param size maximum buffer size.
+ * @param buff the address of the writable buffer pointer.
+*/
+BQUE_API bque_res_t bque_reserve(bque_ctx_t *ctx, bque_u32_t size, void **buff) {
+    bque_node_t *new_node;
+    bque_res_t res;
+    int full;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    /* the buffers of the packed mode and the file backend don't have nodes
+       of their own, and the producers of BQUE_FLAG_MPMC would share the
+       reservation. */
+    if (bque_is_packed(ctx) || bque_is_file(ctx) ||
+        (ctx->conf.flags & BQUE_FLAG_MPMC)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether there is a pending reservation. */
+    if (ctx->resv_node != NULL) {
+        return BQUE_ERR;
+    }
+
+    /* check whether the buffer can be added, a shared queue takes its place
+       on committing. */
+    if (bque_is_sync(ctx)) {
+        res = check_size(ctx, size);
+    } else {
+        res = check_append(ctx, size, &full);
+    }
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    /* create a new node. */
+    res = create_node(ctx, &new_node, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    ctx->resv_node = new_node;
+    *buff = new_node->buff;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief append the reserved buffer to the tail of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param size number of bytes filled in, must not exceed the reserved size,
+ *             0 means to discard the reservation.
+*/
+BQUE_API bque_res_t bque_commit(bque_ctx_t *ctx, bque_u32_t size) {
+    bque_node_t *new_node;
+    bque_res_t res;
+    int full;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    /* BQUE_FLAG_MPMC doesn't reserve, see bque_reserve(). */
+    if (ctx->conf.flags & BQUE_FLAG_MPMC) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether there is a pending reservation. */
+    new_node = ctx->resv_node;
+    if (new_node == NULL) {
+        return BQUE_ERR;
+    }
+
+    /* discard the reservation. */
+    if (size == 0) {
+        ctx->resv_node = NULL;
+        destroy_node(ctx, new_node);
+
+        return BQUE_OK;
+    }
+
+    if (size > new_node->size) {
+        return BQUE_ERR_BAD_SIZE;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        res = sync_take_slot(ctx, 1);
+        if (res != BQUE_OK) {
+            return res;
+        }
+        new_node->size = size;
+        ctx->resv_node = NULL;
+        sync_publish(ctx, new_node, new_node, 1);
+
+        return BQUE_OK;
+    }
+#endif
+
+    /* the limits may have been adjusted since the reservation. */
+    res = check_append(ctx, size, &full);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    /* if necessary, make room for the node. */
+    while (full && is_full(ctx, 1, size)) {
+        drop_head(ctx, 0);
+    }
+
+    /* link the node. */
+    ctx->resv_node = NULL;
+    new_node->size = size;
+    attach_node(ctx, new_node, push_pos(ctx, new_node->buff, size));
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief detach a buffer from the head of the queue.
+ * 
+ * @note with BQUE_FLAG_SPSC or BQUE_FLAG_MPMC, this can be called by the
+ *       consumer threads while the producer threads are enqueuing.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_dequeue(bque_ctx_t *ctx, void *buff, bque_u32_t *size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        curt_node = sync_take_node(ctx, 0);
+        if (curt_node == NULL) {
+            return BQUE_ERR_EMPTY_QUE;
+        }
+        if (buff != NULL) {
+            memcpy(buff, curt_node->buff, curt_node->size);
+        }
+        if (size != NULL) {
+            *size = curt_node->size;
+        }
+        retire_node(ctx, curt_node, buff == NULL);
+
+        return BQUE_OK;
+    }
+#endif
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+#ifdef BQUE_FILE
+    if (bque_is_file(ctx)) {
+        return file_pop(ctx, buff, size);
+    }
+#endif
+
+    if (bque_is_packed(ctx)) {
+        packed_pop(ctx, 0, buff, size, buff == NULL);
+
+        return BQUE_OK;
+    }
+
+    /* if necessary, output the buffer and buffer size of the head node. */
+    curt_node = ctx->head_node;
+    if (buff != NULL) {
+        memcpy(buff, curt_node->buff, curt_node->size);
+    }
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+
+    /* remove the node. */
+    detach_node(ctx, curt_node, 0);
+    retire_node(ctx, curt_node, buff == NULL);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief detach a buffer from the head of the queue without copying it.
+ * 
+ * @note the buffer is owned by the caller afterwards and must be given back
+ *       with bque_release().
+ * 
+ * @param ctx context pointer.
+ * @param buff the address of the buffer pointer.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_dequeue_ref(bque_ctx_t *ctx, void **buff, bque_u32_t *size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    /* the buffers of the packed mode and the file backend don't have nodes
+       of their own. */
+    if (bque_is_packed(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        curt_node = sync_take_node(ctx, 0);
+        if (curt_node == NULL) {
+            return BQUE_ERR_EMPTY_QUE;
+        }
+        *buff = curt_node->buff;
+        if (size != NULL) {
+            *size = curt_node->size;
+        }
+
+        return BQUE_OK;
+    }
+#endif
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    /* output the buffer and buffer size of the head node. */
+    curt_node = ctx->head_node;
+    node_untrim(curt_node);
+    *buff = curt_node->buff;
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+
+    /* remove the node. */
+    detach_node(ctx, curt_node, 0);
+
+    return BQUE_OK;
+}
+
+#ifdef BQUE_THREADS
+
+/**
+ * @brief append a buffer to the tail of the queue, waiting while it's full.
+ * 
+ * @note on a queue which is not shared between threads, this is the same
+ *       as bque_enqueue().
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+ * @param timeout timeout in milliseconds, 0 means not to wait and a negative
+ *                value means to wait forever. BQUE_ERR_FULL_QUE is returned
+ *                when it expires.
+*/
+BQUE_API bque_res_t bque_enqueue_wait(bque_ctx_t *ctx, const void *buff, bque_u32_t size,
+                                      bque_s32_t timeout) {
+    BQUE_ASSERT(ctx != NULL);
+
+    if (!bque_is_sync(ctx)) {
+        return bque_enqueue(ctx, buff, size);
+    }
+
+    return sync_enqueue(ctx, buff, size, timeout);
+}
+
+/**
+ * @brief detach a buffer from the head of the queue, waiting while it's empty.
+ * 
+ * @note on a queue which is not shared between threads, this is the same
+ *       as bque_dequeue().
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+ * @param timeout timeout in milliseconds, 0 means not to wait and a negative
+ *                value means to wait forever. BQUE_ERR_EMPTY_QUE is returned
+ *                when it expires.
+*/
+BQUE_API bque_res_t bque_dequeue_wait(bque_ctx_t *ctx, void *buff, bque_u32_t *size,
+                                      bque_s32_t timeout) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    if (!bque_is_sync(ctx)) {
+        return bque_dequeue(ctx, buff, size);
+    }
+
+    curt_node = sync_take_node(ctx, timeout);
+    if (curt_node == NULL) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+    if (buff != NULL) {
+        memcpy(buff, curt_node->buff, curt_node->size);
+    }
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+    retire_node(ctx, curt_node, buff == NULL);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief acknowledge the notification fd of BQUE_FLAG_NOTIFY.
+ * 
+ * @note the fd is drained and raised again on the next time the queue stops
+ *       being empty or full. so check the queue after this, and wait on the
+ *       fd only when there's nothing to do.
+ * 
+ * @param ctx context pointer.
+*/
+BQUE_API bque_res_t bque_notify_ack(bque_ctx_t *ctx) {
+    bque_u64_t val[8];
+    ssize_t len;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    if (!bque_is_notify(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* drain first, so the fd can only be raised again once it's empty. */
+    do {
+        len = read(ctx->sync.notify_fd[0], val, sizeof(val));
+    } while (len > 0 || (len < 0 && errno == EINTR));
+    __atomic_exchange_n(&ctx->sync.notify_pend, 0, __ATOMIC_SEQ_CST);
+
+    return BQUE_OK;
+}
+
+#endif
+
+/**
+ * @brief detach a buffer from the tail of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_forfeit(bque_ctx_t *ctx, void *buff, bque_u32_t *size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    /* the file backend only takes buffers from the head. */
+    if (bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    if (bque_is_packed(ctx)) {
+        packed_pop(ctx, ctx->cache.node_num - 1, buff, size, buff == NULL);
+
+        return BQUE_OK;
+    }
+
+    /* if necessary, output the buffer and buffer size of the tail node. */
+    curt_node = ctx->tail_node;
+    if (buff != NULL) {
+        memcpy(buff, curt_node->buff, curt_node->size);
+    }
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+
+    /* remove the node. */
+    detach_node(ctx, curt_node, ctx->cache.node_num - 1);
+    retire_node(ctx, curt_node, buff == NULL);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief detach a buffer from the tail of the queue without copying it.
+ * 
+ * @note the buffer is owned by the caller afterwards and must be given back
+ *       with bque_release().
+ * 
+ * @param ctx context pointer.
+ * @param buff the address of the buffer pointer.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_forfeit_ref(bque_ctx_t *ctx, void **buff, bque_u32_t *size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    /* the buffers of the packed mode and the file backend don't have nodes
+       of their own. */
+    if (bque_is_packed(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    /* output the buffer and buffer size of the tail node. */
+    curt_node = ctx->tail_node;
+    node_untrim(curt_node);
+    *buff = curt_node->buff;
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+
+    /* remove the node. */
+    detach_node(ctx, curt_node, ctx->cache.node_num - 1);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief detach a buffer from the queue by index.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the buffer to be detached.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_drop(bque_ctx_t *ctx, bque_u32_t idx, void *buff, bque_u32_t *size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    /* the file backend only takes buffers from the head. */
+    if (bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    /* check whether the index is valid. */
+    if (idx >= ctx->cache.node_num) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    if (bque_is_packed(ctx)) {
+        packed_pop(ctx, idx, buff, size, buff == NULL);
+
+        return BQUE_OK;
+    }
+
+    /* find the node. */
+    curt_node = find_node(ctx, idx);
+
+    /* if necessary, output the buffer and buffer size of the node. */
+    if (buff != NULL) {
+        memcpy(buff, curt_node->buff, curt_node->size);
+    }
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+
+    /* remove the node. */
+    detach_node(ctx, curt_node, idx);
+    retire_node(ctx, curt_node, buff == NULL);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief detach a buffer from the queue by index without copying it.
+ * 
+ * @note the buffer is owned by the caller afterwards and must be given back
+ *       with bque_release().
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the buffer to be detached.
+ * @param buff the address of the buffer pointer.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_drop_ref(bque_ctx_t *ctx, bque_u32_t idx, void **buff, bque_u32_t *size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    /* the buffers of the packed mode and the file backend don't have nodes
+       of their own. */
+    if (bque_is_packed(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    /* check whether the index is valid. */
+    if (idx >= ctx->cache.node_num) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    /* find the node and output its buffer and buffer size. */
+    curt_node = find_node(ctx, idx);
+    node_untrim(curt_node);
+    *buff = curt_node->buff;
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+
+    /* remove the node. */
+    detach_node(ctx, curt_node, idx);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief give back a buffer detached by bque_dequeue_ref(), bque_forfeit_ref()
+ *        or bque_drop_ref().
+ * 
+ * @param ctx context pointer, must be the queue the buffer was detached from.
+ * @param buff buffer pointer.
+*/
+BQUE_API bque_res_t bque_release(bque_ctx_t *ctx, void *buff) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    retire_node(ctx, buff_to_node(buff), 0);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief append buffers to the tail of the queue in one go, see
+ *        bque_enqueue_batch().
+ * 
+ * @param ctx context pointer.
+ * @param vec buffer descriptors, a NULL base means the buffer won't be copied.
+ * @param num number of the descriptors.
+ * @param slab block to carve the new nodes from, or NULL to create them.
+*/
+static bque_res_t push_batch(bque_ctx_t *ctx, const bque_vec_t *vec, bque_u32_t num,
+                             bque_slab_t *slab) {
+    bque_node_t *first_node = NULL;
+    bque_node_t *last_node = NULL;
+    bque_node_t *spare_node = NULL;
+    bque_node_t *alloc_node;
+    bque_node_t *new_node;
+    bque_u32_t drop_num = 0;
+    bque_u32_t reuse_num = 0;
+    bque_u64_t bytes = 0;
+#ifdef BQUE_STATS
+    bque_u64_t now = stats_now();
+#endif
+    int full = 0;
+    bque_res_t res;
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(vec != NULL || num == 0);
+
+    if (num == 0) {
+        return BQUE_OK;
+    }
+
+    /* check whether the buffers can be added. */
+    for (i = 0; i < num; i++) {
+        if ((size_t)(bque_u32_t)vec[i].size != vec[i].size) {
+            return BQUE_ERR_BAD_SIZE;
+        }
+        res = check_size(ctx, (bque_u32_t)vec[i].size);
+        if (res != BQUE_OK) {
+            return res;
+        }
+        if (ctx->conf.prio_cb != NULL && vec[i].base == NULL) {
+            return BQUE_ERR_NOT_SUPP;
+        }
+        bytes += vec[i].size;
+    }
+
+    /* a full queue of BQUE_FLAG_OVERWRITE drops as many head buffers as
+       needed, if the buffers fit into the empty queue at least. */
+    if (!bque_is_sync(ctx) && is_full(ctx, num, bytes)) {
+        if (!(ctx->conf.flags & BQUE_FLAG_OVERWRITE) ||
+            (conf_node_num_max(ctx) != 0 && num > conf_node_num_max(ctx)) ||
+            (ctx->conf.total_bytes_max != 0 && bytes > ctx->conf.total_bytes_max)) {
+            stats_add(ctx, full_num, 1);
+
+            return BQUE_ERR_FULL_QUE;
+        }
+        full = 1;
+    }
+
+#ifdef BQUE_FILE
+    if (bque_is_file(ctx)) {
+        return file_push(ctx, vec, num);
+    }
+#endif
+
+    /* the packed mode adds the buffers one by one, and takes them out again
+       in reverse order on failure. */
+    if (bque_is_packed(ctx)) {
+        bque_u32_t *pos = NULL;
+
+        if (ctx->conf.prio_cb != NULL) {
+            pos = (bque_u32_t *)mem_alloc(ctx, sizeof(bque_u32_t) * (size_t)num);
+            if (pos == NULL) {
+                return BQUE_ERR_NO_MEM;
+            }
+        }
+        for (i = 0; i < num; i++) {
+            bque_u32_t idx = push_pos(ctx, vec[i].base, (bque_u32_t)vec[i].size);
+
+            res = packed_push(ctx, idx, vec[i].base, (bque_u32_t)vec[i].size);
+            if (res != BQUE_OK) {
+                while (i-- > 0) {
+                    packed_pop(ctx, pos != NULL ? pos[i] : ctx->cache.node_num - 1,
+                               NULL, NULL, 0);
+                }
+                break;
+            }
+            if (pos != NULL) {
+                pos[i] = idx;
+            }
+        }
+        if (pos != NULL) {
+            mem_free(ctx, pos);
+        }
+        while (res == BQUE_OK && full && is_full(ctx, 0, 0)) {
+            drop_head(ctx, 0);
+        }
+
+        return res;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        res = sync_take_slot(ctx, num);
+        if (res != BQUE_OK) {
+            return res;
+        }
+    }
+#endif
+
+    /* the head buffers making room stay in the queue until the new nodes
+       exist, so failing to create them loses nothing. the nodes of the
+       dropped buffers are reused in order by the new buffers they fit,
+       unless they wait for bque_reclaim(). */
+    if (full) {
+        drop_num = drop_count(ctx, num, bytes);
+    }
+    if (!(ctx->conf.flags & BQUE_FLAG_DEFER_FREE)) {
+        reuse_num = drop_num;
+    }
+    spare_node = ctx->head_node;
+
+    /* create the nodes which can't be reused. */
+    for (i = 0; i < num; i++) {
+        if (reuse_num > 0 && vec[i].size <= spare_node->cap) {
+            spare_node = spare_node->next_node;
+            reuse_num--;
+            continue;
+        }
+        if (slab != NULL) {
+            new_node = slab_take(slab, (bque_u32_t)vec[i].size);
+            res = BQUE_OK;
+        } else {
+            res = create_node(ctx, &new_node, (bque_u32_t)vec[i].size);
+        }
+        if (res != BQUE_OK) {
+            while (first_node != NULL) {
+                new_node = first_node->next_node;
+                destroy_node(ctx, first_node);
+                first_node = new_node;
+            }
+#ifdef BQUE_THREADS
+            if (bque_is_sync(ctx)) {
+                sync_give_slot(ctx, num);
+            }
+#endif
+
+            return res;
+        }
+        new_node->next_node = NULL;
+        if (last_node != NULL) {
+            last_node->next_node = new_node;
+        } else {
+            first_node = new_node;
+        }
+        last_node = new_node;
+    }
+
+    /* drop the head buffers, keeping their nodes in order. */
+    spare_node = NULL;
+    last_node = NULL;
+    for (i = 0; i < drop_num; i++) {
+        new_node = drop_head(ctx, 1);
+        if (new_node == NULL) {
+            continue;
+        }
+        if (last_node != NULL) {
+            last_node->next_node = new_node;
+        } else {
+            spare_node = new_node;
+        }
+        last_node = new_node;
+    }
+
+    /* chain the nodes, taking the dropped ones the same way as above. */
+    alloc_node = first_node;
+    first_node = NULL;
+    last_node = NULL;
+    for (i = 0; i < num; i++) {
+        if (spare_node != NULL && vec[i].size <= spare_node->cap) {
+            new_node = spare_node;
+            spare_node = spare_node->next_node;
+            new_node->buff = (bque_u8_t *)new_node->data;
+            new_node->size = (bque_u32_t)vec[i].size;
+        } else {
+            new_node = alloc_node;
+            alloc_node = alloc_node->next_node;
+        }
+
+        if (vec[i].base != NULL) {
+            memcpy(new_node->buff, vec[i].base, vec[i].size);
+        }
+        new_node->next_node = NULL;
+        new_node->prev_node = last_node;
+        if (last_node != NULL) {
+            last_node->next_node = new_node;
+        } else {
+            first_node = new_node;
+        }
+        last_node = new_node;
+    }
+
+    /* destroy the nodes which weren't reused. */
+    while (spare_node != NULL) {
+        new_node = spare_node->next_node;
+        destroy_node(ctx, spare_node);
+        spare_node = new_node;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        sync_publish(ctx, first_node, last_node, num);
+
+        return BQUE_OK;
+    }
+#endif
+
+    /* the priority order places the nodes one by one. */
+    if (ctx->conf.prio_cb != NULL) {
+        bque_node_t *next_node;
+
+        for (new_node = first_node; new_node != NULL; new_node = next_node) {
+            next_node = new_node->next_node;
+            attach_node(ctx, new_node, prio_pos(ctx, new_node->buff, new_node->size));
+        }
+
+        return BQUE_OK;
+    }
+
+    /* put the nodes into the ring. */
+    if (ctx->ring.slot != NULL) {
+        for (new_node = first_node, i = ctx->cache.node_num; new_node != NULL;
+             new_node = new_node->next_node, i++) {
+            ctx->ring.slot[ring_pos(ctx, i)] = new_node;
+        }
+    }
+
+    /* join the chain to the tail. */
+    if (ctx->tail_node == NULL) {
+        ctx->head_node = first_node;
+    } else {
+        ctx->tail_node->next_node = first_node;
+        first_node->prev_node = ctx->tail_node;
+    }
+    ctx->tail_node = last_node;
+
+    /* put the nodes into the index, and count them. */
+    for (new_node = first_node; new_node != NULL; new_node = new_node->next_node) {
+        if (ctx->index.head != NULL) {
+            index_insert(ctx, new_node, ctx->cache.node_num);
+        }
+        ctx->cache.node_num++;
+        ctx->cache.mem_bytes += node_mem_size(new_node);
+        stats_push(ctx, new_node, now);
+    }
+    ctx->cache.buff_bytes += bytes;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief append buffers to the tail of the queue in one go.
+ * 
+ * @note either all buffers are added or none of them. the nodes are created
+ *       and linked to each other first, then the chain is joined to the tail.
+ * 
+ * @note with BQUE_FLAG_OVERWRITE, the head buffers making room are only
+ *       dropped once the new buffers are sure to be added, and their nodes are
+ *       reused by the new buffers they fit.
+ * 
+ * @param ctx context pointer.
+ * @param vec buffer descriptors, a NULL base means the buffer won't be copied.
+ * @param num number of the descriptors.
+*/
+BQUE_API bque_res_t bque_enqueue_batch(bque_ctx_t *ctx, const bque_vec_t *vec, bque_u32_t num) {
+    return push_batch(ctx, vec, num, NULL);
+}
+
+/**
+ * @brief detach buffers from the head of the queue in one go without copying
+ *        them.
+ * 
+ * @note the buffers are owned by the caller afterwards and must be given back
+ *       with bque_release() or bque_release_batch(). the descriptors can be
+ *       passed to writev() directly.
+ * 
+ * @param ctx context pointer.
+ * @param vec descriptors receiving the buffers.
+ * @param num maximum number of the buffers.
+ * @param out_num number of the detached buffers.
+*/
+BQUE_API bque_res_t bque_dequeue_batch(bque_ctx_t *ctx, bque_vec_t *vec, bque_u32_t num,
+                                       bque_u32_t *out_num) {
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(vec != NULL || num == 0);
+    BQUE_ASSERT(out_num != NULL);
+
+    *out_num = 0;
+
+    /* the buffers of the packed mode and the file backend don't have nodes
+       of their own. */
+    if (bque_is_packed(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        int locked = (ctx->conf.flags & BQUE_FLAG_MPMC) != 0;
+
+        /* take the lock once for the whole batch. */
+        if (locked) {
+            pthread_mutex_lock(&ctx->sync.lock);
+        }
+        for (i = 0; i < num; i++) {
+            curt_node = sync_pop(ctx);
+            if (curt_node == NULL) {
+                break;
+            }
+            vec[i].base = curt_node->buff;
+            vec[i].size = curt_node->size;
+        }
+        if (locked) {
+            pthread_mutex_unlock(&ctx->sync.lock);
+        }
+
+        *out_num = i;
+        if (i == 0) {
+            return num == 0 ? BQUE_OK : BQUE_ERR_EMPTY_QUE;
+        }
+        sync_wake(ctx, &ctx->sync.enq_wait_num, &ctx->sync.not_full, i);
+
+        return BQUE_OK;
+    }
+#endif
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return num == 0 ? BQUE_OK : BQUE_ERR_EMPTY_QUE;
+    }
+    if (num > ctx->cache.node_num) {
+        num = ctx->cache.node_num;
+    }
+
+    /* take the head nodes out of the index. */
+    if (ctx->index.head != NULL) {
+        for (i = 0; i < num; i++) {
+            index_remove(ctx, 0);
+        }
+    }
+
+    /* output the buffers of the head nodes. */
+    curt_node = ctx->head_node;
+    for (i = 0; i < num; i++) {
+        next_node = curt_node->next_node;
+        node_untrim(curt_node);
+        vec[i].base = curt_node->buff;
+        vec[i].size = curt_node->size;
+        ctx->cache.buff_bytes -= curt_node->size;
+        ctx->cache.mem_bytes -= node_mem_size(curt_node);
+        stats_pop(ctx, curt_node);
+        curt_node->prev_node = NULL;
+        curt_node->next_node = NULL;
+        curt_node = next_node;
+    }
+
+    /* cut the nodes from the queue. */
+    ctx->head_node = curt_node;
+    if (curt_node != NULL) {
+        curt_node->prev_node = NULL;
+    } else {
+        ctx->tail_node = NULL;
+    }
+    if (ctx->ring.slot != NULL) {
+        ctx->ring.head = ring_pos(ctx, num);
+    }
+    ctx->cache.node_num -= num;
+    *out_num = num;
+
+    /* update the fast indexing cache. */
+    finger_remove(ctx, 0, num);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief give back buffers detached by bque_dequeue_batch().
+ * 
+ * @param ctx context pointer, must be the queue the buffers were detached from.
+ * @param vec buffer descriptors.
+ * @param num number of the descriptors.
+*/
+BQUE_API bque_res_t bque_release_batch(bque_ctx_t *ctx, const bque_vec_t *vec, bque_u32_t num) {
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(vec != NULL || num == 0);
+
+    for (i = 0; i < num; i++) {
+        retire_node(ctx, buff_to_node(vec[i].base), 0);
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief free the nodes retired with BQUE_FLAG_DEFER_FREE.
+ * 
+ * @note the discarded buffers are released with the freeing callback here.
+ *       on a shared queue, any thread can call this while the producers and
+ *       the consumers keep going, e.g. a housekeeping thread, as long as the
+ *       allocator and the freeing callback may be called from it.
+ * 
+ * @param ctx context pointer.
+ * @param out_num number of the freed nodes, can be NULL.
+*/
+BQUE_API bque_res_t bque_reclaim(bque_ctx_t *ctx, bque_u32_t *out_num) {
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+    bque_u32_t node_num = 0;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    if (out_num != NULL) {
+        *out_num = 0;
+    }
+
+    if (!(ctx->conf.flags & BQUE_FLAG_DEFER_FREE)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* take the whole list, the nodes retired meanwhile wait for the next
+       call. */
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        curt_node = bque_atomic_xchg(&ctx->mem.retire_node, NULL);
+    } else
+#endif
+    {
+        curt_node = ctx->mem.retire_node;
+        ctx->mem.retire_node = NULL;
+    }
+
+    for (; curt_node != NULL; curt_node = next_node) {
+        next_node = curt_node->next_node;
+        if (curt_node->buff != NULL && conf_free_buff_cb(ctx) != NULL) {
+            conf_free_buff_cb(ctx)(curt_node->buff, curt_node->size);
+        }
+        destroy_node(ctx, curt_node);
+        node_num++;
+    }
+
+#ifdef BQUE_THREADS
+    if (bque_is_sync(ctx)) {
+        bque_atomic_sub(&ctx->mem.retire_num, node_num);
+    } else
+#endif
+    {
+        ctx->mem.retire_num -= node_num;
+    }
+    if (out_num != NULL) {
+        *out_num = node_num;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief step to the next buffer in queue order, for the byte stream
+ *        functions.
+ * 
+ * @param ctx context pointer.
+ * @param node current node, NULL to start from the head.
+ * @param pos position of the current buffer in its chunk, only used by the
+ *            packed mode.
+ * @param buff the address of the buffer pointer.
+ * @param size the address of the buffer size.
+*/
+static int next_buff(bque_ctx_t *ctx, bque_node_t **node, bque_u32_t *pos,
+                     bque_u8_t **buff, bque_u32_t *size) {
+    if (bque_is_packed(ctx)) {
+        bque_chunk_t *chunk;
+
+        if (*node == NULL) {
+            *node = ctx->head_node;
+            *pos = 0;
+        } else if (++*pos == node_to_chunk(*node)->entry_num) {
+            *node = (*node)->next_node;
+            *pos = 0;
+        }
+        if (*node == NULL) {
+            return 0;
+        }
+        chunk = node_to_chunk(*node);
+        *buff = chunk_buff(chunk, *pos);
+        *size = chunk_size(chunk, *pos);
+
+        return 1;
+    }
+
+    *node = *node == NULL ? ctx->head_node : (*node)->next_node;
+    if (*node == NULL) {
+        return 0;
+    }
+    *buff = (*node)->buff;
+    *size = (*node)->size;
+
+    return 1;
+}
+
+/**
+ * @brief copy bytes out of the queue as if the buffers were one stream.
+ * 
+ * @note the bytes may span any number of buffers, the queue is not modified.
+ * 
+ * @param ctx context pointer.
+ * @param offs offset of the first byte from the head of the stream.
+ * @param buff buffer pointer.
+ * @param size number of the bytes to copy.
+*/
+BQUE_API bque_res_t bque_peek_bytes(bque_ctx_t *ctx, size_t offs, void *buff, size_t size) {
+    bque_node_t *curt_node = NULL;
+    bque_u8_t *curt_buff;
+    bque_u32_t curt_size;
+    bque_u32_t pos = 0;
+    size_t part;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL || size == 0);
+
+    /* the records of the file backend aren't walked as a stream. */
+    if (bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the bytes are in the queue. */
+    if (offs > ctx->cache.buff_bytes || size > ctx->cache.buff_bytes - offs) {
+        return BQUE_ERR_BAD_OFFS;
+    }
+
+    /* skip the buffers before the offset, then copy. */
+    while (size > 0 && next_buff(ctx, &curt_node, &pos, &curt_buff, &curt_size)) {
+        if (offs >= curt_size) {
+            offs -= curt_size;
+            continue;
+        }
+        part = curt_size - offs < size ? curt_size - offs : size;
+        memcpy(buff, curt_buff + offs, part);
+        buff = (bque_u8_t *)buff + part;
+        size -= part;
+        offs = 0;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief describe the first bytes of the stream without copying them.
+ * 
+ * @note the descriptors point into the queue and stay valid until it's
+ *       modified, the last one may cover a part of a buffer. the descriptors
+ *       can be passed to writev() directly.
+ * 
+ * @param ctx context pointer.
+ * @param size number of the bytes to describe.
+ * @param vec descriptors receiving the bytes.
+ * @param num maximum number of the descriptors.
+ * @param out_num number of the filled descriptors, fewer bytes are described
+ *                when the descriptors run out.
+*/
+BQUE_API bque_res_t bque_peek_vec(bque_ctx_t *ctx, size_t size, bque_vec_t *vec, bque_u32_t num,
+                                  bque_u32_t *out_num) {
+    bque_node_t *curt_node = NULL;
+    bque_u8_t *curt_buff;
+    bque_u32_t curt_size;
+    bque_u32_t pos = 0;
+    bque_u32_t i = 0;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(vec != NULL || num == 0);
+    BQUE_ASSERT(out_num != NULL);
+
+    /* the records of the file backend aren't walked as a stream. */
+    if (bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the bytes are in the queue. */
+    if (size > ctx->cache.buff_bytes) {
+        return BQUE_ERR_BAD_OFFS;
+    }
+
+    while (size > 0 && i < num &&
+           next_buff(ctx, &curt_node, &pos, &curt_buff, &curt_size)) {
+        vec[i].base = curt_buff;
+        vec[i].size = curt_size < size ? curt_size : size;
+        size -= vec[i].size;
+        i++;
+    }
+    *out_num = i;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief remove bytes from the head of the stream.
+ * 
+ * @note the buffers consumed completely are removed without copying, and the
+ *       rest of a partly consumed head buffer stays in place, so it's no
+ *       longer aligned.
+ * 
+ * @param ctx context pointer.
+ * @param size number of the bytes to remove.
+*/
+BQUE_API bque_res_t bque_consume_bytes(bque_ctx_t *ctx, size_t size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    /* the consumers of a shared queue and the file backend only take whole
+       buffers, and the buffers of a fixed size must keep it. */
+    if (bque_is_sync(ctx) || bque_is_file(ctx) || conf_elem_size(ctx) != 0) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the bytes are in the queue. */
+    if (size > ctx->cache.buff_bytes) {
+        return BQUE_ERR_BAD_OFFS;
+    }
+
+    while (size > 0) {
+        curt_node = ctx->head_node;
+
+        if (bque_is_packed(ctx)) {
+            bque_chunk_t *chunk = node_to_chunk(curt_node);
+            struct _bque_chunk_entry *entry = &chunk->entry[0];
+
+            if (size >= entry->size) {
+                size -= entry->size;
+                packed_pop(ctx, 0, NULL, NULL, 0);
+                continue;
+            }
+
+            /* trim the head buffer, giving back the aligned bytes. */
+            chunk->data_used -= (bque_u16_t)(bque_align_up(entry->size) -
+                                             bque_align_up(entry->size - size));
+            entry->offs += (bque_u16_t)size;
+            entry->size -= (bque_u16_t)size;
+        } else {
+            if (size >= curt_node->size) {
+                size -= curt_node->size;
+                detach_node(ctx, curt_node, 0);
+                retire_node(ctx, curt_node, 0);
+                continue;
+            }
+
+            /* trim the head buffer. */
+            curt_node->buff += size;
+            curt_node->size -= (bque_u32_t)size;
+        }
+        ctx->cache.buff_bytes -= size;
+        break;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief check whether the nodes of a context can be moved to another one.
+ * 
+ * @note nodes of the pool or shared queues are never moved, and both
+ *       contexts must free the nodes in the same way, the node blocks
+ *       included.
+ * 
+ * @param a context pointer.
+ * @param b context pointer.
+*/
+static int can_move_nodes(bque_ctx_t *a, bque_ctx_t *b) {
+    if ((a->conf.flags | b->conf.flags) & (BQUE_FLAG_NODE_POOL | BQUE_FLAG_INDEXED |
+                                          BQUE_FLAG_PACKED | BQUE_FLAG_FILE |
+                                          BQUE_SYNC_FLAGS)) {
+        return 0;
+    }
+
+    return a->mem.alloc_cb == b->mem.alloc_cb &&
+           a->mem.dealloc_cb == b->mem.dealloc_cb &&
+           a->mem.user == b->mem.user;
+}
+
+/**
+ * @brief move all buffers of a queue to the tail of another one.
+ * 
+ * @note the nodes are relinked without copying the buffers, the buffers are
+ *       only visited when the buffer size limit of `dst` is smaller than the
+ *       one of `src`. `src` is left empty.
+ * 
+ * @param dst context receiving the buffers.
+ * @param src context giving the buffers.
+*/
+BQUE_API bque_res_t bque_splice(bque_ctx_t *dst, bque_ctx_t *src) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(dst != NULL);
+    BQUE_ASSERT(src != NULL);
+    BQUE_ASSERT(dst != src);
+
+    if (!can_move_nodes(dst, src) || dst->conf.prio_cb != NULL) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the buffers can be added. */
+    if (src->cache.node_num == 0) {
+        return BQUE_OK;
+    }
+    if (conf_node_num_max(dst) != 0 &&
+        (src->cache.node_num > conf_node_num_max(dst) ||
+         dst->cache.node_num > conf_node_num_max(dst) - src->cache.node_num)) {
+        return BQUE_ERR_FULL_QUE;
+    }
+    if (dst->conf.total_bytes_max != 0 &&
+        (src->cache.buff_bytes > dst->conf.total_bytes_max ||
+         dst->cache.buff_bytes > dst->conf.total_bytes_max - src->cache.buff_bytes)) {
+        return BQUE_ERR_FULL_QUE;
+    }
+    if (conf_buff_size_max(dst) != 0 &&
+        (conf_buff_size_max(src) == 0 ||
+         conf_buff_size_max(src) > conf_buff_size_max(dst))) {
+        for (curt_node = src->head_node; curt_node != NULL;
+             curt_node = curt_node->next_node) {
+            if (curt_node->size > conf_buff_size_max(dst)) {
+                return BQUE_ERR_BAD_SIZE;
+            }
+        }
+    }
+    if (conf_elem_size(dst) != 0 && conf_elem_size(src) != conf_elem_size(dst)) {
+        for (curt_node = src->head_node; curt_node != NULL;
+             curt_node = curt_node->next_node) {
+            if (curt_node->size != conf_elem_size(dst)) {
+                return BQUE_ERR_BAD_SIZE;
+            }
+        }
+    }
+
+    /* join the nodes to the tail of `dst`. */
+    if (dst->tail_node == NULL) {
+        dst->head_node = src->head_node;
+    } else {
+        dst->tail_node->next_node = src->head_node;
+        src->head_node->prev_node = dst->tail_node;
+    }
+    dst->tail_node = src->tail_node;
+    dst->cache.node_num += src->cache.node_num;
+    dst->cache.buff_bytes += src->cache.buff_bytes;
+    dst->cache.mem_bytes += src->cache.mem_bytes;
+
+    /* leave `src` empty. */
+    src->head_node = NULL;
+    src->tail_node = NULL;
+    src->cache.node_num = 0;
+    src->cache.buff_bytes = 0;
+    src->cache.mem_bytes = 0;
+    finger_reset(src);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief cut a queue in two at a specific position.
+ * 
+ * @note the buffers from `idx` to the tail are moved to a new context created
+ *       with the same configuration, the buffers are not copied.
+ * 
+ * @param ctx context pointer.
+ * @param idx index of the first buffer to move, can be the number of the
+ *            buffers to get an empty queue.
+ * @param new_ctx the new context, must be freed with bque_free().
+*/
+BQUE_API bque_res_t bque_split(bque_ctx_t *ctx, bque_u32_t idx, bque_ctx_t **new_ctx) {
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+    bque_ctx_t *alloc_ctx;
+    bque_conf_t conf;
+    bque_res_t res;
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(new_ctx != NULL);
+
+    if (!can_move_nodes(ctx, ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the index is valid. */
+    if (idx > ctx->cache.node_num) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    /* create the new context. */
+    memset(&conf, 0, sizeof(bque_conf_t));
+    conf.buff_num_max = conf_node_num_max(ctx);
+    conf.buff_size_max = conf_buff_size_max(ctx);
+    conf.free_buff_cb = conf_free_buff_cb(ctx);
+    conf.elem_size = conf_elem_size(ctx);
+    conf.alloc_cb = ctx->mem.alloc_cb;
+    conf.dealloc_cb = ctx->mem.dealloc_cb;
+    conf.alloc_user = ctx->mem.user;
+    conf.flags = ctx->conf.flags;
+    conf.prio_cb = ctx->conf.prio_cb;
+    conf.prio_order = ctx->conf.prio_order;
+    conf.total_bytes_max = ctx->conf.total_bytes_max;
+    res = bque_new(&alloc_ctx, &conf);
+    if (res != BQUE_OK) {
+        return res;
+    }
+    *new_ctx = alloc_ctx;
+
+    if (idx == ctx->cache.node_num) {
+        return BQUE_OK;
+    }
+
+    /* count the bytes of the moved nodes from the shorter side. */
+    curt_node = find_node(ctx, idx);
+    if (idx < ctx->cache.node_num - idx) {
+        alloc_ctx->cache.buff_bytes = ctx->cache.buff_bytes;
+        alloc_ctx->cache.mem_bytes = ctx->cache.mem_bytes;
+        for (next_node = ctx->head_node; next_node != curt_node;
+             next_node = next_node->next_node) {
+            alloc_ctx->cache.buff_bytes -= next_node->size;
+            alloc_ctx->cache.mem_bytes -= node_mem_size(next_node);
+        }
+    } else {
+        for (next_node = curt_node; next_node != NULL;
+             next_node = next_node->next_node) {
+            alloc_ctx->cache.buff_bytes += next_node->size;
+            alloc_ctx->cache.mem_bytes += node_mem_size(next_node);
+        }
+    }
+    ctx->cache.buff_bytes -= alloc_ctx->cache.buff_bytes;
+    ctx->cache.mem_bytes -= alloc_ctx->cache.mem_bytes;
+
+    /* move the nodes from `idx` on to the new context. */
+    alloc_ctx->head_node = curt_node;
+    alloc_ctx->tail_node = ctx->tail_node;
+    alloc_ctx->cache.node_num = ctx->cache.node_num - idx;
+    ctx->tail_node = curt_node->prev_node;
+    if (ctx->tail_node == NULL) {
+        ctx->head_node = NULL;
+    } else {
+        ctx->tail_node->next_node = NULL;
+    }
+    curt_node->prev_node = NULL;
+    ctx->cache.node_num = idx;
+
+    /* the fingers go with their nodes. */
+    for (i = 0; i < BQUE_FINGER_NUM; i++) {
+        if (ctx->cache.finger[i].node != NULL &&
+            ctx->cache.finger[i].node_idx >= idx) {
+            alloc_ctx->cache.finger[i].node = ctx->cache.finger[i].node;
+            alloc_ctx->cache.finger[i].node_idx = ctx->cache.finger[i].node_idx - idx;
+            ctx->cache.finger[i].node = NULL;
+            ctx->cache.finger[i].node_idx = 0;
+        }
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief empty the queue.
+ * 
+ * @param ctx context pointer.
+*/
+BQUE_API bque_res_t bque_empty(bque_ctx_t *ctx) {
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+
+    BQUE_ASSERT(ctx != NULL);
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_OK;
+    }
+
+#ifdef BQUE_FILE
+    if (bque_is_file(ctx)) {
+        return file_clear(ctx);
+    }
+#endif
+
+    /* remove all nodes. */
+    curt_node = ctx->head_node;
+    if (bque_is_packed(ctx)) {
+        packed_clear(ctx);
+    } else {
+        while (curt_node != NULL) {
+            next_node = curt_node->next_node;
+            retire_node(ctx, curt_node, 1);
+            curt_node = next_node;
+        }
+    }
+
+    /* reset context. */
+    ctx->head_node = NULL;
+    ctx->tail_node = NULL;
+    ctx->cache.node_num = 0;
+    ctx->cache.buff_bytes = 0;
+    ctx->cache.mem_bytes = 0;
+    ctx->ring.head = 0;
+    if (ctx->index.head != NULL) {
+        index_clear(ctx);
+    }
+
+    /* update the fast indexing cache. */
+    finger_reset(ctx);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief Get buffer in the queue by index.
+ * 
+ * @note Parameters `buff` and `size` must not be NULL at the same time.
+ * 
+ * @param ctx The context pointer.
+ * @param idx The buffer index, 0 and the positive value indicates forward
+ *            indexing and the negative value indicates backward indexing.
+ * @param buff The buffer pointer.
+ * @param size The buffer size pointer.
+ */
+BQUE_API bque_res_t bque_item(bque_ctx_t *ctx, bque_s32_t idx,
+                              void **buff, bque_size_t *size) {
+    bque_u32_t node_num;
+    bque_u32_t node_idx_max;
+    bque_u32_t forward_node_idx;
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(buff != NULL ||
+                size != NULL);
+
+    /* check whether the queue is empty. */
+    node_num = ctx->cache.node_num;
+    if (node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    /* check whether the index is valid. */
+    node_idx_max = node_num - 1;
+    if (idx >= 0) {
+        forward_node_idx = (bque_u32_t)idx;
+        if (forward_node_idx > node_idx_max) {
+            return BQUE_ERR_BAD_IDX;
+        }
+    } else {
+        bque_u32_t temp;
+
+        temp = (bque_u32_t)(-idx);
+        if (temp > node_num) {
+            return BQUE_ERR_BAD_IDX;
+        }
+
+        forward_node_idx = node_num - temp;
+    }
+
+#ifdef BQUE_FILE
+    if (bque_is_file(ctx)) {
+        bque_file_rec_t *rec;
+
+        rec = file_find(ctx, forward_node_idx);
+        if (buff != NULL) {
+            *buff = rec + 1;
+        }
+        if (size != NULL) {
+            *size = rec->size;
+        }
+
+        return BQUE_OK;
+    }
+#endif
+
+    if (bque_is_packed(ctx)) {
+        bque_chunk_t *chunk;
+        bque_u32_t pos;
+
+        curt_node = packed_find(ctx, forward_node_idx, &pos);
+        chunk = node_to_chunk(curt_node);
+        if (buff != NULL) {
+            *buff = chunk_buff(chunk, pos);
+        }
+        if (size != NULL) {
+            *size = chunk_size(chunk, pos);
+        }
+
+        return BQUE_OK;
+    }
+
+    /* find the node indexed by forward_node_idx. */
+    curt_node = find_node(ctx, forward_node_idx);
+
+    /* copy the buffer information. */
+    if (buff != NULL) {
+        *buff = curt_node->buff;
+    }
+    if (size != NULL) {
+        *size = curt_node->size;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief sort the linked nodes with bottom-up merge sort.
+ * 
+ * @note the sort is stable and works on the links only, merging runs of
+ *       length 1, 2, 4 ... until a single run is left.
+ * 
+ * @param ctx context pointer.
+ * @param cb sorting callback.
+ * @param order sorting order.
+*/
+static void sort_list(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order) {
+    bque_node_t *list_node = ctx->head_node;
+    bque_node_t *tail_node;
+    bque_node_t *node_a;
+    bque_node_t *node_b;
+    bque_node_t *curt_node;
+    bque_u32_t run_size = 1;
+    bque_u32_t merge_num;
+    bque_u32_t size_a;
+    bque_u32_t size_b;
+
+    do {
+        node_a = list_node;
+        list_node = NULL;
+        tail_node = NULL;
+        merge_num = 0;
+
+        while (node_a != NULL) {
+
+            /* cut two runs of run_size nodes from the list. */
+            merge_num++;
+            node_b = node_a;
+            for (size_a = 0; size_a < run_size && node_b != NULL; size_a++) {
+                node_b = node_b->next_node;
+            }
+            size_b = run_size;
+
+            /* merge the runs, the first run wins on equal buffers. */
+            while (size_a > 0 || (size_b > 0 && node_b != NULL)) {
+                if (size_a == 0) {
+                    curt_node = node_b;
+                    node_b = node_b->next_node;
+                    size_b--;
+                } else if (size_b == 0 || node_b == NULL ||
+                           !sort_swapped(cb, order, node_a->buff, node_a->size,
+                                         node_b->buff, node_b->size)) {
+                    curt_node = node_a;
+                    node_a = node_a->next_node;
+                    size_a--;
+                } else {
+                    curt_node = node_b;
+                    node_b = node_b->next_node;
+                    size_b--;
+                }
+
+                if (tail_node != NULL) {
+                    tail_node->next_node = curt_node;
+                } else {
+                    list_node = curt_node;
+                }
+                curt_node->prev_node = tail_node;
+                tail_node = curt_node;
+            }
+
+            node_a = node_b;
+        }
+
+        tail_node->next_node = NULL;
+        run_size *= 2;
+    } while (merge_num > 1);
+
+    ctx->head_node = list_node;
+    ctx->tail_node = tail_node;
+}
+
+/* buffer listed by the sorting, the node is NULL for the packed mode. */
+typedef struct _bque_sort_ent {
+    void *buff;
+    bque_size_t size;
+    bque_node_t *node;
+} bque_sort_ent_t;
+
+/**
+ * @brief list the buffers of a queue in queue order.
+ * 
+ * @param ctx context pointer.
+ * @param ent array of as many entries as the buffers.
+*/
+static void sort_list_ent(bque_ctx_t *ctx, bque_sort_ent_t *ent) {
+    bque_node_t *curt_node;
+    bque_chunk_t *chunk;
+    bque_u32_t pos;
+    bque_u32_t i = 0;
+
+    for (curt_node = ctx->head_node; curt_node != NULL; curt_node = curt_node->next_node) {
+        if (bque_is_packed(ctx)) {
+            chunk = node_to_chunk(curt_node);
+            for (pos = 0; pos < chunk->entry_num; pos++, i++) {
+                ent[i].buff = chunk_buff(chunk, pos);
+                ent[i].size = chunk_size(chunk, pos);
+                ent[i].node = NULL;
+            }
+        } else {
+            ent[i].buff = curt_node->buff;
+            ent[i].size = curt_node->size;
+            ent[i].node = curt_node;
+            i++;
+        }
+    }
+}
+
+/**
+ * @brief merge two sorted runs of entries.
+ * 
+ * @note the run [lo, mid) of `src` and the run [mid, hi) are merged into the
+ *       same range of `dst`, the first run wins on equal buffers.
+ * 
+ * @param src source entries.
+ * @param dst destination entries.
+ * @param lo start of the first run.
+ * @param mid start of the second run.
+ * @param hi end of the second run.
+ * @param cb sorting callback.
+ * @param order sorting order.
+*/
+static void sort_merge(const bque_sort_ent_t *src, bque_sort_ent_t *dst,
+                       bque_u32_t lo, bque_u32_t mid, bque_u32_t hi,
+                       bque_sort_cb_t cb, bque_sort_order_t order) {
+    bque_u32_t a, b, i;
+
+    for (a = lo, b = mid, i = lo; i < hi; i++) {
+        if (a < mid && (b >= hi ||
+            !sort_swapped(cb, order, src[a].buff, src[a].size,
+                          src[b].buff, src[b].size))) {
+            dst[i] = src[a++];
+        } else {
+            dst[i] = src[b++];
+        }
+    }
+}
+
+/**
+ * @brief sort a range of entries with a stable bottom-up merge sort.
+ * 
+ * @note runs of length 1, 2, 4 ... are merged back and forth between `ent`
+ *       and `temp`, the sorted range is left in `ent`.
+ * 
+ * @param ent entries.
+ * @param temp temporary entries, as many as `ent`.
+ * @param lo start of the range.
+ * @param hi end of the range.
+ * @param cb sorting callback.
+ * @param order sorting order.
+*/
+static void sort_range(bque_sort_ent_t *ent, bque_sort_ent_t *temp,
+                       bque_u32_t lo, bque_u32_t hi,
+                       bque_sort_cb_t cb, bque_sort_order_t order) {
+    bque_sort_ent_t *src = ent;
+    bque_sort_ent_t *dst = temp;
+    bque_sort_ent_t *swap;
+    bque_u32_t run_size;
+    bque_u32_t a, b, c;
+
+    for (run_size = 1; run_size < hi - lo; run_size *= 2) {
+        for (a = lo; a < hi; a = c) {
+            b = run_size < hi - a ? a + run_size : hi;
+            c = run_size < hi - b ? b + run_size : hi;
+            sort_merge(src, dst, a, b, c, cb, order);
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != ent) {
+        memcpy(ent + lo, src + lo, sizeof(bque_sort_ent_t) * (size_t)(hi - lo));
+    }
+}
+
+/**
+ * @brief put the buffers of a queue in the order of the sorted entries.
+ * 
+ * @note the nodes are relinked, and the buffers of the packed mode are copied
+ *       into new chunks. the queue is left untouched when there is not enough
+ *       memory for the new chunks.
+ * 
+ * @param ctx context pointer.
+ * @param ent sorted entries, one for each buffer.
+*/
+static bque_res_t sort_apply(bque_ctx_t *ctx, const bque_sort_ent_t *ent) {
+    bque_u32_t node_num = ctx->cache.node_num;
+    bque_node_t *head_node = ctx->head_node;
+    bque_node_t *tail_node = ctx->tail_node;
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+    bque_chunk_t *chunk;
+    bque_u32_t i;
+    bque_res_t res;
+
+    if (!bque_is_packed(ctx)) {
+
+        /* relink the nodes. */
+        for (i = 0; i < node_num; i++) {
+            curt_node = ent[i].node;
+            curt_node->prev_node = i > 0 ? ent[i - 1].node : NULL;
+            curt_node->next_node = i + 1 < node_num ? ent[i + 1].node : NULL;
+        }
+        ctx->head_node = ent[0].node;
+        ctx->tail_node = ent[node_num - 1].node;
+
+        /* put the ring and the index in the new order. */
+        if (ctx->ring.slot != NULL) {
+            ring_rebuild(ctx);
+        }
+        if (ctx->index.head != NULL) {
+            index_rebuild(ctx);
+        }
+
+        /* update the fast indexing cache. */
+        finger_reset(ctx);
+
+        return BQUE_OK;
+    }
+
+    /* copy the buffers into new chunks. */
+    ctx->head_node = NULL;
+    ctx->tail_node = NULL;
+    for (i = 0; i < node_num; i++) {
+        if (ctx->tail_node == NULL ||
+            !chunk_fits(node_to_chunk(ctx->tail_node), ent[i].size)) {
+            res = packed_create(ctx, ctx->tail_node, &curt_node);
+            if (res != BQUE_OK) {
+
+                /* drop the new chunks and keep the old ones. */
+                for (curt_node = ctx->head_node; curt_node != NULL; curt_node = next_node) {
+                    next_node = curt_node->next_node;
+                    ctx->cache.mem_bytes -= node_mem_size(curt_node);
+                    destroy_node(ctx, curt_node);
+                }
+                ctx->head_node = head_node;
+                ctx->tail_node = tail_node;
+
+                return res;
+            }
+        }
+        chunk = node_to_chunk(ctx->tail_node);
+        chunk_put(chunk, chunk->entry_num, ent[i].buff, ent[i].size);
+    }
+
+    /* free the old chunks. */
+    for (curt_node = head_node; curt_node != NULL; curt_node = next_node) {
+        next_node = curt_node->next_node;
+        ctx->cache.mem_bytes -= node_mem_size(curt_node);
+        destroy_node(ctx, curt_node);
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief sort the buffers of a queue of the packed mode.
+ * 
+ * @note the buffers are listed in an array, sorted with a stable bottom-up
+ *       merge sort and copied into new chunks. the queue is left untouched
+ *       when there is not enough memory.
+ * 
+ * @param ctx context pointer.
+ * @param cb sorting callback.
+ * @param order sorting order.
+*/
+static bque_res_t sort_packed(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order) {
+    bque_u32_t node_num = ctx->cache.node_num;
+    bque_sort_ent_t *ent;
+    bque_res_t res;
+
+    ent = (bque_sort_ent_t *)mem_alloc(ctx, sizeof(bque_sort_ent_t) * 2 * (size_t)node_num);
+    if (ent == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+
+    sort_list_ent(ctx, ent);
+    sort_range(ent, ent + node_num, 0, node_num, cb, order);
+    res = sort_apply(ctx, ent);
+    mem_free(ctx, ent);
+
+    return res;
+}
+
+/**
+ * @brief check whether two buffers of a fixed size are out of the sorting
+ *        order.
+ * 
+ * @param cb sorting callback, used when `elem_cb` is NULL.
+ * @param elem_cb element sorting callback.
+ * @param order sorting order.
+ * @param elem_a the buffer which is currently before elem_b.
+ * @param elem_b buffer pointer.
+ * @param size size of the buffers.
+*/
+static inline int sort_elem_swapped(bque_sort_cb_t cb, bque_elem_sort_cb_t elem_cb,
+                                    bque_sort_order_t order, const void *elem_a,
+                                    const void *elem_b, bque_size_t size) {
+    bque_sort_res_t sort_res;
+
+    if (elem_cb != NULL) {
+        sort_res = elem_cb(elem_a, elem_b);
+    } else {
+        sort_res = cb(elem_a, size, elem_b, size);
+    }
+    if (order == BQUE_SORT_ASCENDING) {
+        return sort_res == BQUE_SORT_GREATER;
+    } else {
+        return sort_res == BQUE_SORT_LESS;
+    }
+}
+
+/**
+ * @brief copy the buffers of a queue of a fixed buffer size between the
+ *        queue and an array, in queue order.
+ * 
+ * @param ctx context pointer.
+ * @param elem array of as many buffers as the queue holds.
+ * @param to_que whether the array is copied into the queue.
+*/
+static void sort_elem_copy(bque_ctx_t *ctx, bque_u8_t *elem, int to_que) {
+    bque_u32_t size = conf_elem_size(ctx);
+    bque_node_t *curt_node;
+    bque_chunk_t *chunk;
+    bque_u32_t pos;
+
+    for (curt_node = ctx->head_node; curt_node != NULL; curt_node = curt_node->next_node) {
+        if (bque_is_packed(ctx)) {
+            chunk = node_to_chunk(curt_node);
+            for (pos = 0; pos < chunk->entry_num; pos++, elem += size) {
+                if (to_que) {
+                    memcpy(chunk_buff(chunk, pos), elem, size);
+                } else {
+                    memcpy(elem, chunk_buff(chunk, pos), size);
+                }
+            }
+        } else {
+            if (to_que) {
+                memcpy(curt_node->buff, elem, size);
+            } else {
+                memcpy(elem, curt_node->buff, size);
+            }
+            elem += size;
+        }
+    }
+}
+
+/**
+ * @brief sort the buffers of a queue of a fixed buffer size.
+ * 
+ * @note the buffers are copied into an array, sorted with a stable bottom-up
+ *       merge sort moving whole buffers, and copied back, so the nodes and
+ *       chunks stay where they are. the queue is left untouched when there
+ *       is not enough memory.
+ * 
+ * @param ctx context pointer.
+ * @param cb sorting callback, used when `elem_cb` is NULL.
+ * @param elem_cb element sorting callback.
+ * @param order sorting order.
+*/
+static bque_res_t sort_elem(bque_ctx_t *ctx, bque_sort_cb_t cb,
+                            bque_elem_sort_cb_t elem_cb, bque_sort_order_t order) {
+    bque_u32_t node_num = ctx->cache.node_num;
+    size_t size = conf_elem_size(ctx);
+    bque_u8_t *base;
+    bque_u8_t *src;
+    bque_u8_t *dst;
+    bque_u8_t *swap;
+    bque_u32_t run_size;
+    bque_u32_t a, b, c;
+    bque_u32_t x, y, i;
+
+    /* check whether the arrays overflow. */
+    if ((size_t)node_num > (size_t)-1 / 2 / size) {
+        return BQUE_ERR_NO_MEM;
+    }
+    base = (bque_u8_t *)mem_alloc(ctx, size * 2 * (size_t)node_num);
+    if (base == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+    src = base;
+    dst = base + size * node_num;
+    sort_elem_copy(ctx, src, 0);
+
+    /* merge runs of length 1, 2, 4 ... back and forth, the first run wins on
+       equal buffers. */
+    for (run_size = 1; run_size < node_num; run_size *= 2) {
+        for (a = 0; a < node_num; a = c) {
+            b = run_size < node_num - a ? a + run_size : node_num;
+            c = run_size < node_num - b ? b + run_size : node_num;
+            for (x = a, y = b, i = a; i < c; i++) {
+                if (x < b && (y >= c ||
+                    !sort_elem_swapped(cb, elem_cb, order, src + size * x,
+                                       src + size * y, (bque_size_t)size))) {
+                    memcpy(dst + size * i, src + size * x++, size);
+                } else {
+                    memcpy(dst + size * i, src + size * y++, size);
+                }
+            }
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    sort_elem_copy(ctx, src, 1);
+    mem_free(ctx, base);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief sort the buffer queue.
+ * 
+ * @note this function will sort the queue in specified order, and the callback
+ *       function will be called to compare two buffers, the callback function
+ *       should return BQUE_SORT_EQUAL if the two buffers are equal, and return
+ *       BQUE_SORT_GREATER if the first buffer is greater than the second one,
+ *       and return BQUE_SORT_LESS if the first buffer is less than the second
+ *       one. the sort is stable, equal buffers keep their relative order.
+ * 
+ * @param ctx context pointer.
+ * @param cb sorting callback, used to compare two buffers.
+ * @param order sorting order, BQUE_SORT_ASCENDING or BQUE_SORT_DESCENDING.
+*/
+BQUE_API bque_res_t bque_sort(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order) {
+    bque_u32_t node_num;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cb != NULL);
+    BQUE_ASSERT(order == BQUE_SORT_ASCENDING ||
+                order == BQUE_SORT_DESCENDING);
+
+    /* the queue is kept in priority order already, or the file backend keeps
+       the buffers in arrival order. */
+    if (ctx->conf.prio_cb != NULL || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    node_num = ctx->cache.node_num;
+    if (node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    } else if (node_num == 1) {
+        return BQUE_OK;
+    }
+
+    /* the chunks of a fixed buffer size are sorted in place. */
+    if (bque_is_packed(ctx)) {
+        if (conf_elem_size(ctx) != 0) {
+            return sort_elem(ctx, cb, NULL, order);
+        }
+
+        return sort_packed(ctx, cb, order);
+    }
+
+    /* sort the linked nodes by the specified order. */
+    sort_list(ctx, cb, order);
+
+    /* put the ring and the index in the new order. */
+    if (ctx->ring.slot != NULL) {
+        ring_rebuild(ctx);
+    }
+    if (ctx->index.head != NULL) {
+        index_rebuild(ctx);
+    }
+
+    /* update the fast indexing cache. */
+    finger_reset(ctx);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief sort a queue of a fixed buffer size.
+ * 
+ * @note like bque_sort(), but the callback only gets the buffers, which all
+ *       have `elem_size` bytes, and the buffers are moved instead of the
+ *       nodes. the sort is stable.
+ * 
+ * @param ctx context pointer.
+ * @param cb element sorting callback, used to compare two buffers.
+ * @param order sorting order, BQUE_SORT_ASCENDING or BQUE_SORT_DESCENDING.
+*/
+BQUE_API bque_res_t bque_sort_elem(bque_ctx_t *ctx, bque_elem_sort_cb_t cb,
+                                   bque_sort_order_t order) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cb != NULL);
+    BQUE_ASSERT(order == BQUE_SORT_ASCENDING ||
+                order == BQUE_SORT_DESCENDING);
+
+    /* the buffers need a fixed size, and the queue is kept in priority order
+       already, or the file backend keeps the buffers in arrival order. */
+    if (conf_elem_size(ctx) == 0 || ctx->conf.prio_cb != NULL || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    } else if (ctx->cache.node_num == 1) {
+        return BQUE_OK;
+    }
+
+    return sort_elem(ctx, NULL, cb, order);
+}
+
+/**
+ * @brief read an integer key from a buffer.
+ * 
+ * @param buff address of the key.
+ * @param key_size size of the key, 1, 2, 4 or 8.
+*/
+static bque_u64_t sort_key_get(const void *buff, bque_size_t key_size) {
+    bque_u8_t key_8;
+    bque_u16_t key_16;
+    bque_u32_t key_32;
+    bque_u64_t key_64;
+
+    switch (key_size) {
+    case 1:
+        memcpy(&key_8, buff, sizeof(key_8));
+        return key_8;
+    case 2:
+        memcpy(&key_16, buff, sizeof(key_16));
+        return key_16;
+    case 4:
+        memcpy(&key_32, buff, sizeof(key_32));
+        return key_32;
+    default:
+        memcpy(&key_64, buff, sizeof(key_64));
+        return key_64;
+    }
+}
+
+/**
+ * @brief sort the buffer queue by an integer key.
+ * 
+ * @note the key of a buffer is the unsigned integer of `key_size` bytes in
+ *       host byte order stored at `key_offs` of it. no sorting callback is
+ *       called, the buffers get sorted by a stable radix sort one byte of the
+ *       key at a time, and the bytes all keys share are skipped. the queue
+ *       is left untouched with BQUE_ERR_BAD_SIZE when `key_size` isn't 1, 2,
+ *       4 or 8 or a buffer is too short to hold the key, and with
+ *       BQUE_ERR_NO_MEM when there is not enough memory.
+ * 
+ * @param ctx context pointer.
+ * @param key_offs offset of the key in the buffers.
+ * @param key_size size of the key.
+ * @param order sorting order, BQUE_SORT_ASCENDING or BQUE_SORT_DESCENDING.
+*/
+BQUE_API bque_res_t bque_sort_key(bque_ctx_t *ctx, bque_size_t key_offs, bque_size_t key_size,
+                                  bque_sort_order_t order) {
+    bque_u32_t node_num;
+    bque_u64_t *base;
+    bque_u64_t *key;
+    bque_u64_t *temp_key;
+    bque_u64_t *swap_key;
+    bque_sort_ent_t *ent;
+    bque_sort_ent_t *temp_ent;
+    bque_sort_ent_t *swap_ent;
+    bque_u32_t count[256];
+    bque_u32_t shift;
+    bque_u32_t sum;
+    bque_u32_t byte;
+    bque_u32_t i;
+    bque_res_t res;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(order == BQUE_SORT_ASCENDING ||
+                order == BQUE_SORT_DESCENDING);
+
+    if (key_size != 1 && key_size != 2 && key_size != 4 && key_size != 8) {
+        return BQUE_ERR_BAD_SIZE;
+    }
+
+    /* the queue is kept in priority order already, or the file backend keeps
+       the buffers in arrival order. */
+    if (ctx->conf.prio_cb != NULL || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    node_num = ctx->cache.node_num;
+    if (node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    /* the keys and the entries share a block. */
+    base = (bque_u64_t *)mem_alloc(ctx, (sizeof(bque_u64_t) + sizeof(bque_sort_ent_t)) *
+                                        2 * (size_t)node_num);
+    if (base == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+    key = base;
+    temp_key = key + node_num;
+    ent = (bque_sort_ent_t *)(temp_key + node_num);
+    temp_ent = ent + node_num;
+
+    /* read the keys, the descending order sorts the inverted keys. */
+    sort_list_ent(ctx, ent);
+    for (i = 0; i < node_num; i++) {
+        if (key_offs > ent[i].size || ent[i].size - key_offs < key_size) {
+            mem_free(ctx, base);
+
+            return BQUE_ERR_BAD_SIZE;
+        }
+        key[i] = sort_key_get((bque_u8_t *)ent[i].buff + key_offs, key_size);
+        if (order == BQUE_SORT_DESCENDING) {
+            key[i] = ~key[i];
+        }
+    }
+
+    /* distribute the buffers by each byte of the keys, the lowest first. */
+    for (shift = 0; shift < key_size * 8; shift += 8) {
+        memset(count, 0, sizeof(count));
+        for (i = 0; i < node_num; i++) {
+            count[(key[i] >> shift) & 0xFF]++;
+        }
+        if (count[(key[0] >> shift) & 0xFF] == node_num) {
+            continue;
+        }
+
+        for (byte = 0, sum = 0; byte < 256; byte++) {
+            bque_u32_t num = count[byte];
+
+            count[byte] = sum;
+            sum += num;
+        }
+        for (i = 0; i < node_num; i++) {
+            bque_u32_t pos = count[(key[i] >> shift) & 0xFF]++;
+
+            temp_key[pos] = key[i];
+            temp_ent[pos] = ent[i];
+        }
+
+        swap_key = key;
+        key = temp_key;
+        temp_key = swap_key;
+        swap_ent = ent;
+        ent = temp_ent;
+        temp_ent = swap_ent;
+    }
+
+    res = sort_apply(ctx, ent);
+    mem_free(ctx, base);
+
+    return res;
+}
+
+#ifdef BQUE_THREADS
+
+/* part of the entries sorted or merged by one thread. */
+typedef struct _bque_sort_part {
+    bque_sort_ent_t *src;
+    bque_sort_ent_t *dst;
+    bque_u32_t lo;
+    bque_u32_t mid;
+    bque_u32_t hi;
+    bque_sort_cb_t cb;
+    bque_sort_order_t order;
+    int merge;
+    pthread_t thread;
+    int started;
+} bque_sort_part_t;
+
+/**
+ * @brief sort or merge a part of the entries in a thread.
+ * 
+ * @note the range [lo, hi) is either sorted in `src`, or gets its runs
+ *       [lo, mid) and [mid, hi) merged from `src` into `dst`.
+ * 
+ * @param arg part pointer.
+*/
+static void *sort_thread(void *arg) {
+    bque_sort_part_t *part = (bque_sort_part_t *)arg;
+
+    if (!part->merge) {
+        sort_range(part->src, part->dst, part->lo, part->hi, part->cb, part->order);
+    } else {
+        sort_merge(part->src, part->dst, part->lo, part->mid, part->hi,
+                   part->cb, part->order);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief work on a number of parts at the same time.
+ * 
+ * @note the calling thread takes the first part, and a part runs in the
+ *       calling thread when its thread can't be created.
+ * 
+ * @param part parts.
+ * @param part_num number of the parts.
+*/
+static void sort_spawn(bque_sort_part_t *part, bque_u32_t part_num) {
+    bque_u32_t i;
+
+    for (i = 1; i < part_num; i++) {
+        part[i].started = pthread_create(&part[i].thread, NULL,
+                                         sort_thread, &part[i]) == 0;
+        if (!part[i].started) {
+            sort_thread(&part[i]);
+        }
+    }
+    sort_thread(&part[0]);
+
+    for (i = 1; i < part_num; i++) {
+        if (part[i].started) {
+            pthread_join(part[i].thread, NULL);
+        }
+    }
+}
+
+/**
+ * @brief sort the buffer queue with several threads.
+ * 
+ * @note the buffers are listed in an array which is cut into one partition
+ *       for each thread, the partitions are sorted at the same time, then
+ *       merged in pairs, with the pairs of a round merged at the same time,
+ *       until the array is sorted. the sort is stable like bque_sort() and
+ *       the callback gets called by several threads at the same time. the
+ *       queue is left untouched when there is not enough memory.
+ * 
+ * @param ctx context pointer.
+ * @param cb sorting callback, used to compare two buffers.
+ * @param order sorting order, BQUE_SORT_ASCENDING or BQUE_SORT_DESCENDING.
+ * @param thread_num number of the threads, the calling thread included.
+*/
+BQUE_API bque_res_t bque_sort_parallel(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order,
+                                       bque_u32_t thread_num) {
+    bque_u32_t node_num;
+    bque_sort_ent_t *base;
+    bque_sort_ent_t *ent;
+    bque_sort_ent_t *temp;
+    bque_sort_ent_t *swap;
+    bque_sort_part_t *part;
+    bque_u32_t *bound;
+    bque_u32_t part_num;
+    bque_u32_t i;
+    bque_res_t res;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cb != NULL);
+    BQUE_ASSERT(order == BQUE_SORT_ASCENDING ||
+                order == BQUE_SORT_DESCENDING);
+
+    /* a partition takes a number of buffers at least. */
+    node_num = ctx->cache.node_num;
+    if (thread_num > node_num / BQUE_SORT_PART_SIZE_MIN) {
+        thread_num = node_num / BQUE_SORT_PART_SIZE_MIN;
+    }
+    if (thread_num <= 1 || ctx->conf.prio_cb != NULL || bque_is_file(ctx)) {
+        return bque_sort(ctx, cb, order);
+    }
+
+    /* the entries, the parts and the bounds of the partitions share a block. */
+    base = (bque_sort_ent_t *)mem_alloc(ctx, sizeof(bque_sort_ent_t) * 2 * (size_t)node_num +
+                                             (sizeof(bque_sort_part_t) + sizeof(bque_u32_t)) *
+                                             (size_t)thread_num + sizeof(bque_u32_t));
+    if (base == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+    ent = base;
+    temp = ent + node_num;
+    part = (bque_sort_part_t *)(temp + node_num);
+    bound = (bque_u32_t *)(part + thread_num);
+
+    sort_list_ent(ctx, ent);
+
+    /* sort the partitions. */
+    part_num = thread_num;
+    for (i = 0; i <= part_num; i++) {
+        bound[i] = (bque_u32_t)((bque_u64_t)node_num * i / part_num);
+    }
+    for (i = 0; i < part_num; i++) {
+        part[i].src = ent;
+        part[i].dst = temp;
+        part[i].lo = bound[i];
+        part[i].mid = bound[i];
+        part[i].hi = bound[i + 1];
+        part[i].cb = cb;
+        part[i].order = order;
+        part[i].merge = 0;
+    }
+    sort_spawn(part, part_num);
+
+    /* merge the partitions in pairs, a partition left alone gets copied. */
+    while (part_num > 1) {
+        for (i = 0; i < (part_num + 1) / 2; i++) {
+            part[i].src = ent;
+            part[i].dst = temp;
+            part[i].lo = bound[2 * i];
+            if (2 * i + 1 < part_num) {
+                part[i].mid = bound[2 * i + 1];
+                part[i].hi = bound[2 * i + 2];
+            } else {
+                part[i].mid = bound[2 * i + 1];
+                part[i].hi = bound[2 * i + 1];
+            }
+            part[i].merge = 1;
+        }
+        sort_spawn(part, (part_num + 1) / 2);
+
+        for (i = 0; i < (part_num + 1) / 2; i++) {
+            bound[i] = bound[2 * i];
+        }
+        bound[(part_num + 1) / 2] = node_num;
+        part_num = (part_num + 1) / 2;
+        swap = ent;
+        ent = temp;
+        temp = swap;
+    }
+
+    res = sort_apply(ctx, ent);
+    mem_free(ctx, base);
+
+    return res;
+}
+
+#endif
+
+/**
+ * @brief iterate through the queue in specified order.
+ * 
+ * @note this function will call the callback function for each buffer, note
+ *       that the callback function should return BQUE_OK to continue iterating,
+ *       then after all buffers are iterated, this function will return BQUE_OK,
+ *       or the callback function may return BQUE_ERR_ITER_STOP to stop
  *       iterating, then this function will return BQUE_ERR_ITER_STOP
  *       immediately.
  * 
  * @param ctx context pointer.
- * @param cb iterating callback.
- * @param order iterating order.
+ * @param cb iterating callback.
+ * @param order iterating order.
+*/
+BQUE_API bque_res_t bque_foreach(bque_ctx_t *ctx, bque_iter_cb_t cb, bque_iter_order_t order) {
+    bque_u32_t node_num;
+    bque_u32_t node_idx;
+    bque_node_t *curt_node;
+    bque_res_t res;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cb != NULL);
+    BQUE_ASSERT(order == BQUE_ITER_FORWARD ||
+                order == BQUE_ITER_BACKWARD);
+
+    /* the records of the file backend only lead forward. */
+    if (bque_is_file(ctx) && order == BQUE_ITER_BACKWARD) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* if there is no any node in this queue, return immediately. */
+    node_num = ctx->cache.node_num;
+    if (node_num == 0) {
+        return BQUE_OK;
+    }
+
+#ifdef BQUE_FILE
+    if (bque_is_file(ctx)) {
+        bque_file_rec_t *rec;
+        bque_u64_t offs = ctx->file.head;
+
+        for (node_idx = 0; node_idx < node_num; node_idx++) {
+            offs = file_skip_wrap(ctx, offs);
+            rec = (bque_file_rec_t *)(ctx->file.base + offs);
+            res = cb(node_idx, node_num, rec + 1, rec->size);
+            if (res == BQUE_ERR_ITER_STOP) {
+                return BQUE_ERR_ITER_STOP;
+            }
+            offs += file_rec_size(rec->size);
+        }
+
+        return BQUE_OK;
+    }
+#endif
+
+    /* the ring backend walks the slots instead of the links. */
+    if (ctx->ring.slot != NULL) {
+        bque_u32_t i;
+
+        for (i = 0; i < node_num; i++) {
+            node_idx = order == BQUE_ITER_FORWARD ? i : node_num - 1 - i;
+            curt_node = ctx->ring.slot[ring_pos(ctx, node_idx)];
+            res = cb(node_idx, node_num, curt_node->buff, curt_node->size);
+            if (res == BQUE_ERR_ITER_STOP) {
+                return BQUE_ERR_ITER_STOP;
+            }
+        }
+
+        return BQUE_OK;
+    }
+
+    /* the packed mode walks the entries of the chunks. */
+    if (bque_is_packed(ctx)) {
+        bque_chunk_t *chunk;
+        bque_u32_t pos;
+
+        if (order == BQUE_ITER_FORWARD) {
+            node_idx = 0;
+            for (curt_node = ctx->head_node; curt_node != NULL;
+                 curt_node = curt_node->next_node) {
+                chunk = node_to_chunk(curt_node);
+                for (pos = 0; pos < chunk->entry_num; pos++, node_idx++) {
+                    res = cb(node_idx, node_num, chunk_buff(chunk, pos),
+                             chunk_size(chunk, pos));
+                    if (res == BQUE_ERR_ITER_STOP) {
+                        return BQUE_ERR_ITER_STOP;
+                    }
+                }
+            }
+        } else {
+            node_idx = node_num;
+            for (curt_node = ctx->tail_node; curt_node != NULL;
+                 curt_node = curt_node->prev_node) {
+                chunk = node_to_chunk(curt_node);
+                for (pos = chunk->entry_num; pos-- > 0;) {
+                    node_idx--;
+                    res = cb(node_idx, node_num, chunk_buff(chunk, pos),
+                             chunk_size(chunk, pos));
+                    if (res == BQUE_ERR_ITER_STOP) {
+                        return BQUE_ERR_ITER_STOP;
+                    }
+                }
+            }
+        }
+
+        return BQUE_OK;
+    }
+
+    /* iterate through the queue in specified order. */
+    if (order == BQUE_ITER_FORWARD) {
+        curt_node = ctx->head_node;
+        node_idx = 0;
+        do {
+            res = cb(node_idx, node_num, curt_node->buff, curt_node->size);
+            if (res == BQUE_ERR_ITER_STOP) {
+                return BQUE_ERR_ITER_STOP;
+            }
+
+            curt_node = curt_node->next_node;
+            node_idx++;
+        } while (curt_node != NULL);
+    } else {
+        curt_node = ctx->tail_node;
+        node_idx = node_num - 1;
+        do {
+            res = cb(node_idx, node_num, curt_node->buff, curt_node->size);
+            if (res == BQUE_ERR_ITER_STOP) {
+                return BQUE_ERR_ITER_STOP;
+            }
+
+            curt_node = curt_node->prev_node;
+            node_idx--;
+        } while (curt_node != NULL);
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief call a chunked iterating callback for a range of buffers.
+ * 
+ * @param ctx context pointer.
+ * @param node node holding the first buffer.
+ * @param pos position of the first buffer in its chunk, only used by the
+ *            packed mode.
+ * @param idx index of the first buffer.
+ * @param num number of the buffers.
+ * @param cb chunked iterating callback.
+ * @param user argument of the callback.
+ * @param stop flag shared by the ranges iterated at the same time, set when a
+ *             callback stops iterating, can be NULL.
+*/
+static bque_res_t foreach_range(bque_ctx_t *ctx, bque_node_t *node, bque_u32_t pos,
+                                bque_u32_t idx, bque_u32_t num,
+                                bque_iter_vec_cb_t cb, void *user, int *stop) {
+    bque_vec_t vec[BQUE_ITER_VEC_NUM];
+    bque_u32_t vec_num = 0;
+    bque_u32_t i;
+#ifdef BQUE_FILE
+    bque_u64_t offs = bque_is_file(ctx) ? ctx->file.head : 0;
+#endif
+
+#ifndef BQUE_THREADS
+    /* only the parallel iteration shares a flag. */
+    (void)stop;
+#endif
+
+    for (i = 0; i < num; i++) {
+
+        /* describe the buffer and step to the next one. */
+        if (bque_is_packed(ctx)) {
+            bque_chunk_t *chunk = node_to_chunk(node);
+
+            vec[vec_num].base = chunk_buff(chunk, pos);
+            vec[vec_num].size = chunk_size(chunk, pos);
+            if (++pos == chunk->entry_num) {
+                node = node->next_node;
+                pos = 0;
+            }
+        } else if (ctx->ring.slot != NULL) {
+            bque_node_t *slot_node = ctx->ring.slot[ring_pos(ctx, idx + i)];
+
+            vec[vec_num].base = slot_node->buff;
+            vec[vec_num].size = slot_node->size;
+#ifdef BQUE_FILE
+        } else if (bque_is_file(ctx)) {
+            bque_file_rec_t *rec;
+
+            offs = file_skip_wrap(ctx, offs);
+            rec = (bque_file_rec_t *)(ctx->file.base + offs);
+            vec[vec_num].base = rec + 1;
+            vec[vec_num].size = rec->size;
+            offs += file_rec_size(rec->size);
+#endif
+        } else {
+            vec[vec_num].base = node->buff;
+            vec[vec_num].size = node->size;
+            node = node->next_node;
+        }
+
+        /* hand out the full chunk, or the rest at the end. */
+        if (++vec_num == BQUE_ITER_VEC_NUM || i + 1 == num) {
+            bque_u32_t first_idx = idx + i + 1 - vec_num;
+
+#ifdef BQUE_THREADS
+            if (stop != NULL && bque_atomic_load(stop)) {
+                return BQUE_ERR_ITER_STOP;
+            }
+#endif
+            if (cb(first_idx, vec, vec_num, user) == BQUE_ERR_ITER_STOP) {
+#ifdef BQUE_THREADS
+                if (stop != NULL) {
+                    bque_atomic_store(stop, 1);
+                }
+#endif
+                return BQUE_ERR_ITER_STOP;
+            }
+            vec_num = 0;
+        }
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief iterate through the queue forwardly, many buffers at a time.
+ * 
+ * @note the callback gets the descriptors of up to 64 buffers per call, which
+ *       saves most of the calls for small buffers. it may return
+ *       BQUE_ERR_ITER_STOP to stop iterating, which is returned then.
+ * 
+ * @param ctx context pointer.
+ * @param cb chunked iterating callback.
+ * @param user argument of the callback.
+*/
+BQUE_API bque_res_t bque_foreach_vec(bque_ctx_t *ctx, bque_iter_vec_cb_t cb, void *user) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cb != NULL);
+
+    return foreach_range(ctx, ctx->head_node, 0, 0, ctx->cache.node_num, cb, user, NULL);
+}
+
+#ifdef BQUE_THREADS
+
+/* range of the buffers iterated by one thread. */
+typedef struct _bque_range {
+    bque_ctx_t *ctx;
+    bque_node_t *node;
+    bque_u32_t pos;
+    bque_u32_t idx;
+    bque_u32_t num;
+    bque_iter_vec_cb_t cb;
+    void *user;
+    int *stop;
+    bque_res_t res;
+    pthread_t thread;
+    int started;
+} bque_range_t;
+
+/**
+ * @brief iterate through a range of buffers in a thread.
+ * 
+ * @param arg range pointer.
+*/
+static void *foreach_thread(void *arg) {
+    bque_range_t *range = (bque_range_t *)arg;
+
+    range->res = foreach_range(range->ctx, range->node, range->pos, range->idx,
+                               range->num, range->cb, range->user, range->stop);
+
+    return NULL;
+}
+
+/**
+ * @brief iterate through the queue with several threads.
+ * 
+ * @note the queue is cut into as many ranges of consecutive buffers as there
+ *       are threads, and each range is handed to the callback like
+ *       bque_foreach_vec() does, so the callback gets called by several
+ *       threads at the same time. the calling thread takes the first range.
+ *       finding the ranges walks the links once, except for the ring backend
+ *       and the indexed mode. the queue must not be modified meanwhile.
+ * 
+ * @param ctx context pointer.
+ * @param cb chunked iterating callback.
+ * @param user argument of the callback.
+ * @param thread_num number of the threads, the calling thread included.
+*/
+BQUE_API bque_res_t bque_foreach_parallel(bque_ctx_t *ctx, bque_iter_vec_cb_t cb, void *user,
+                                          bque_u32_t thread_num) {
+    bque_u32_t node_num;
+    bque_range_t *range;
+    bque_res_t res;
+    int stop = 0;
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cb != NULL);
+
+    /* a range takes a full chunk at least. */
+    node_num = ctx->cache.node_num;
+    if (thread_num > node_num / BQUE_ITER_VEC_NUM) {
+        thread_num = node_num / BQUE_ITER_VEC_NUM;
+    }
+    if (thread_num <= 1 || bque_is_file(ctx)) {
+        return bque_foreach_vec(ctx, cb, user);
+    }
+
+    range = (bque_range_t *)mem_alloc(ctx, sizeof(bque_range_t) * (size_t)thread_num);
+    if (range == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+
+    /* find the first buffer of each range. */
+    for (i = 0; i < thread_num; i++) {
+        range[i].ctx = ctx;
+        range[i].idx = (bque_u32_t)((bque_u64_t)node_num * i / thread_num);
+        range[i].num = (bque_u32_t)((bque_u64_t)node_num * (i + 1) / thread_num) -
+                       range[i].idx;
+        range[i].cb = cb;
+        range[i].user = user;
+        range[i].stop = &stop;
+        range[i].pos = 0;
+        if (bque_is_packed(ctx)) {
+            range[i].node = packed_find(ctx, range[i].idx, &range[i].pos);
+        } else {
+            range[i].node = find_node(ctx, range[i].idx);
+        }
+    }
+
+    /* start the threads, a range runs in the calling thread when its thread
+       can't be created. */
+    for (i = 1; i < thread_num; i++) {
+        range[i].started = pthread_create(&range[i].thread, NULL,
+                                          foreach_thread, &range[i]) == 0;
+        if (!range[i].started) {
+            foreach_thread(&range[i]);
+        }
+    }
+    foreach_thread(&range[0]);
+
+    /* wait for the threads. */
+    res = range[0].res;
+    for (i = 1; i < thread_num; i++) {
+        if (range[i].started) {
+            pthread_join(range[i].thread, NULL);
+        }
+        if (range[i].res != BQUE_OK) {
+            res = range[i].res;
+        }
+    }
+    mem_free(ctx, range);
+
+    return res;
+}
+
+#endif
+
+/**
+ * @brief place a cursor at the first buffer of the queue.
+ * 
+ * @note a cursor visits the buffers in both directions, and removes or adds
+ *       buffers where it is without looking them up by index, which takes
+ *       constant time in the plain list and the node pool. the cursor stays
+ *       valid as long as the queue is only changed through it. shared queues
+ *       and the file backend return BQUE_ERR_NOT_SUPP.
+ * 
+ * @param ctx context pointer.
+ * @param cur cursor pointer.
+*/
+BQUE_API bque_res_t bque_cursor_begin(bque_ctx_t *ctx, bque_cursor_t *cur) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cur != NULL);
+
+    cur->ctx = ctx;
+    cur->node = NULL;
+    cur->pos = 0;
+    cur->idx = 0;
+
+    if (bque_is_sync(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    cur->node = ctx->head_node;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief place a cursor at the last buffer of the queue.
+ * 
+ * @param ctx context pointer.
+ * @param cur cursor pointer.
+*/
+BQUE_API bque_res_t bque_cursor_end(bque_ctx_t *ctx, bque_cursor_t *cur) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cur != NULL);
+
+    cur->ctx = ctx;
+    cur->node = NULL;
+    cur->pos = 0;
+    cur->idx = 0;
+
+    if (bque_is_sync(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the queue is empty. */
+    if (ctx->cache.node_num == 0) {
+        return BQUE_ERR_EMPTY_QUE;
+    }
+
+    cur->node = ctx->tail_node;
+    if (bque_is_packed(ctx)) {
+        cur->pos = node_to_chunk(ctx->tail_node)->entry_num - 1u;
+    }
+    cur->idx = ctx->cache.node_num - 1;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief move a cursor to the next buffer.
+ * 
+ * @note the cursor leaves the queue with BQUE_ERR_ITER_STOP after the last
+ *       buffer, and can't be moved any more then.
+ * 
+ * @param cur cursor pointer.
+*/
+BQUE_API bque_res_t bque_cursor_next(bque_cursor_t *cur) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(cur != NULL);
+
+    curt_node = (bque_node_t *)cur->node;
+    if (curt_node == NULL) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    if (bque_is_packed(cur->ctx) &&
+        cur->pos + 1 < node_to_chunk(curt_node)->entry_num) {
+        cur->pos++;
+    } else {
+        cur->node = curt_node->next_node;
+        cur->pos = 0;
+    }
+    cur->idx++;
+
+    return cur->node != NULL ? BQUE_OK : BQUE_ERR_ITER_STOP;
+}
+
+/**
+ * @brief move a cursor to the previous buffer.
+ * 
+ * @note the cursor leaves the queue with BQUE_ERR_ITER_STOP before the first
+ *       buffer, and can't be moved any more then.
+ * 
+ * @param cur cursor pointer.
+*/
+BQUE_API bque_res_t bque_cursor_prev(bque_cursor_t *cur) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(cur != NULL);
+
+    curt_node = (bque_node_t *)cur->node;
+    if (curt_node == NULL) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    if (bque_is_packed(cur->ctx) && cur->pos > 0) {
+        cur->pos--;
+    } else {
+        curt_node = curt_node->prev_node;
+        cur->node = curt_node;
+        cur->pos = 0;
+        if (curt_node != NULL && bque_is_packed(cur->ctx)) {
+            cur->pos = node_to_chunk(curt_node)->entry_num - 1u;
+        }
+    }
+    cur->idx--;
+
+    return cur->node != NULL ? BQUE_OK : BQUE_ERR_ITER_STOP;
+}
+
+/**
+ * @brief get the buffer at a cursor.
+ * 
+ * @note the buffer stays in the queue.
+ * 
+ * @param cur cursor pointer.
+ * @param buff the address of the buffer pointer.
+ * @param size size pointer, when it's NULL, the size won't be output.
+*/
+BQUE_API bque_res_t bque_cursor_get(bque_cursor_t *cur, void **buff, bque_size_t *size) {
+    bque_node_t *curt_node;
+
+    BQUE_ASSERT(cur != NULL);
+    BQUE_ASSERT(buff != NULL);
+
+    curt_node = (bque_node_t *)cur->node;
+    if (curt_node == NULL) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    if (bque_is_packed(cur->ctx)) {
+        bque_chunk_t *chunk = node_to_chunk(curt_node);
+
+        *buff = chunk_buff(chunk, cur->pos);
+        if (size != NULL) {
+            *size = chunk_size(chunk, cur->pos);
+        }
+    } else {
+        *buff = curt_node->buff;
+        if (size != NULL) {
+            *size = curt_node->size;
+        }
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief remove the buffer at a cursor and move the cursor to the next one.
+ * 
+ * @note BQUE_ERR_ITER_STOP means the last buffer was removed, and the cursor
+ *       left the queue.
+ * 
+ * @param cur cursor pointer.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_cursor_erase(bque_cursor_t *cur, void *buff, bque_u32_t *size) {
+    bque_ctx_t *ctx;
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+    bque_u32_t next_pos = 0;
+
+    BQUE_ASSERT(cur != NULL);
+
+    ctx = cur->ctx;
+    curt_node = (bque_node_t *)cur->node;
+    if (curt_node == NULL) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    if (bque_is_packed(ctx)) {
+
+        /* the next buffer takes the position, unless the chunk ends. */
+        if (cur->pos + 1 < node_to_chunk(curt_node)->entry_num) {
+            next_node = curt_node;
+            next_pos = cur->pos;
+        } else {
+            next_node = curt_node->next_node;
+        }
+        packed_take(ctx, curt_node, cur->pos, buff, size, buff == NULL);
+        stats_pop(ctx, NULL);
+    } else {
+        next_node = curt_node->next_node;
+
+        /* if necessary, output the buffer and buffer size of the node. */
+        if (buff != NULL) {
+            memcpy(buff, curt_node->buff, curt_node->size);
+        }
+        if (size != NULL) {
+            *size = curt_node->size;
+        }
+
+        /* remove the node. */
+        detach_node(ctx, curt_node, cur->idx);
+        retire_node(ctx, curt_node, buff == NULL);
+    }
+    cur->node = next_node;
+    cur->pos = next_pos;
+
+    return next_node != NULL ? BQUE_OK : BQUE_ERR_ITER_STOP;
+}
+
+/**
+ * @brief add a buffer next to a cursor.
+ * 
+ * @note the cursor stays at its buffer. the chunks of the packed mode are
+ *       looked up again, since adding may split them.
+ * 
+ * @param cur cursor pointer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+ * @param after whether the buffer goes after the one at the cursor.
+*/
+static bque_res_t cursor_insert(bque_cursor_t *cur, const void *buff,
+                                bque_u32_t size, int after) {
+    bque_ctx_t *ctx = cur->ctx;
+    bque_node_t *curt_node;
+    bque_node_t *new_node;
+    bque_u32_t idx;
+    bque_res_t res;
+
+    curt_node = (bque_node_t *)cur->node;
+    if (curt_node == NULL) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    /* the position is given by the priority order. */
+    if (ctx->conf.prio_cb != NULL) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* check whether the buffer can be added. */
+    res = check_push(ctx, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    idx = after ? cur->idx + 1 : cur->idx;
+    if (bque_is_packed(ctx)) {
+        res = packed_push(ctx, idx, buff, size);
+        if (res != BQUE_OK) {
+            return res;
+        }
+        if (!after) {
+            cur->idx++;
+        }
+        cur->node = packed_find(ctx, cur->idx, &cur->pos);
+
+        return BQUE_OK;
+    }
+
+    /* create a new node. */
+    res = create_node(ctx, &new_node, size);
+    if (res != BQUE_OK) {
+        return res;
+    }
+
+    /* if necessary, copy the buffer. */
+    if (buff != NULL) {
+        memcpy(new_node->buff, buff, size);
+    }
+
+    /* link the node next to the one at the cursor. */
+    attach_node_before(ctx, new_node, idx, after ? curt_node->next_node : curt_node);
+    if (!after) {
+        cur->idx++;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief add a buffer before the one at a cursor.
+ * 
+ * @param cur cursor pointer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+*/
+BQUE_API bque_res_t bque_cursor_insert_before(bque_cursor_t *cur, const void *buff,
+                                              bque_u32_t size) {
+    BQUE_ASSERT(cur != NULL);
+
+    return cursor_insert(cur, buff, size, 0);
+}
+
+/**
+ * @brief add a buffer after the one at a cursor.
+ * 
+ * @param cur cursor pointer.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+*/
+BQUE_API bque_res_t bque_cursor_insert_after(bque_cursor_t *cur, const void *buff,
+                                             bque_u32_t size) {
+    BQUE_ASSERT(cur != NULL);
+
+    return cursor_insert(cur, buff, size, 1);
+}
+
+/**
+ * @brief remove the buffers matching a callback in one pass.
+ * 
+ * @note the removed buffers are released with the freeing callback. the ring
+ *       and the index are rebuilt once at the end, so the whole pass takes
+ *       linear time. the callback must not change the queue.
+ * 
+ * @param ctx context pointer.
+ * @param cb matching callback.
+ * @param user argument of the callback.
+ * @param out_num number of the removed buffers, can be NULL.
+*/
+BQUE_API bque_res_t bque_remove_if(bque_ctx_t *ctx, bque_match_cb_t cb, void *user,
+                                   bque_u32_t *out_num) {
+    bque_node_t *curt_node;
+    bque_node_t *next_node;
+    bque_u32_t remove_num = 0;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(cb != NULL);
+
+    if (out_num != NULL) {
+        *out_num = 0;
+    }
+
+    if (bque_is_sync(ctx) || bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    for (curt_node = ctx->head_node; curt_node != NULL; curt_node = next_node) {
+        next_node = curt_node->next_node;
+
+        if (bque_is_packed(ctx)) {
+            bque_chunk_t *chunk = node_to_chunk(curt_node);
+            bque_u32_t pos = 0;
+
+            while (pos < chunk->entry_num) {
+                if (!cb(chunk_buff(chunk, pos), chunk_size(chunk, pos), user)) {
+                    pos++;
+                    continue;
+                }
+                if (conf_free_buff_cb(ctx) != NULL) {
+                    conf_free_buff_cb(ctx)(chunk_buff(chunk, pos), chunk_size(chunk, pos));
+                }
+                ctx->cache.buff_bytes -= chunk_size(chunk, pos);
+                ctx->cache.node_num--;
+                stats_pop(ctx, NULL);
+                chunk_take(chunk, pos);
+                remove_num++;
+            }
+            if (chunk->entry_num == 0) {
+                packed_destroy(ctx, curt_node);
+            }
+            continue;
+        }
+
+        if (!cb(curt_node->buff, curt_node->size, user)) {
+            continue;
+        }
+
+        /* unlink the node, the ring and the index follow at the end. */
+        if (curt_node->prev_node != NULL) {
+            curt_node->prev_node->next_node = next_node;
+        } else {
+            ctx->head_node = next_node;
+        }
+        if (next_node != NULL) {
+            next_node->prev_node = curt_node->prev_node;
+        } else {
+            ctx->tail_node = curt_node->prev_node;
+        }
+        ctx->cache.node_num--;
+        ctx->cache.buff_bytes -= curt_node->size;
+        ctx->cache.mem_bytes -= node_mem_size(curt_node);
+        stats_pop(ctx, curt_node);
+        retire_node(ctx, curt_node, 1);
+        remove_num++;
+    }
+
+    if (remove_num > 0) {
+
+        /* put the ring and the index in the new order. */
+        if (ctx->ring.slot != NULL) {
+            ring_rebuild(ctx);
+        }
+        if (ctx->index.head != NULL) {
+            index_rebuild(ctx);
+        }
+
+        /* update the fast indexing cache. */
+        finger_reset(ctx);
+    }
+    if (out_num != NULL) {
+        *out_num = remove_num;
+    }
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief write a 32-bit field of the serialized format.
+ * 
+ * @param byte field pointer.
+ * @param val field value.
+*/
+static void serial_put(bque_u8_t *byte, bque_u32_t val) {
+    byte[0] = (bque_u8_t)val;
+    byte[1] = (bque_u8_t)(val >> 8);
+    byte[2] = (bque_u8_t)(val >> 16);
+    byte[3] = (bque_u8_t)(val >> 24);
+}
+
+/**
+ * @brief read a 32-bit field of the serialized format.
+ * 
+ * @param byte field pointer.
+*/
+static bque_u32_t serial_get(const bque_u8_t *byte) {
+    return (bque_u32_t)byte[0] | (bque_u32_t)byte[1] << 8 |
+           (bque_u32_t)byte[2] << 16 | (bque_u32_t)byte[3] << 24;
+}
+
+/**
+ * @brief collect the descriptors handed out by foreach_range().
+ * 
+ * @param idx index of the first buffer.
+ * @param vec buffer descriptors.
+ * @param vec_num number of the descriptors.
+ * @param user descriptors of the serialized queue.
+*/
+static bque_res_t serial_collect(bque_u32_t idx, const bque_vec_t *vec,
+                                 bque_u32_t vec_num, void *user) {
+    memcpy((bque_vec_t *)user + 1 + idx, vec, sizeof(bque_vec_t) * (size_t)vec_num);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief serialize the queue into a list of descriptors without copying the
+ *        buffers.
+ * 
+ * @note the first descriptor holds the header and the lengths of the buffers,
+ *       the others point at the buffers in the queue, so the whole list can be
+ *       passed to writev() directly. the queue must not be changed until the
+ *       list is given back with bque_serialize_free().
+ * 
+ * @param ctx context pointer.
+ * @param vec the address of the descriptor list pointer.
+ * @param vec_num number of the descriptors, the number of the buffers plus 1.
+*/
+BQUE_API bque_res_t bque_serialize(bque_ctx_t *ctx, bque_vec_t **vec, bque_u32_t *vec_num) {
+    bque_vec_t *alloc_vec;
+    bque_u8_t *hdr;
+    size_t hdr_size;
+    bque_u32_t num;
+    bque_u32_t i;
+
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(vec != NULL);
+    BQUE_ASSERT(vec_num != NULL);
+
+    /* shared queues change under the list. */
+    if (bque_is_sync(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    /* allocate the descriptors and the header in one block. */
+    num = ctx->cache.node_num;
+    hdr_size = BQUE_SERIAL_HDR_SIZE + 4 * (size_t)num;
+    alloc_vec = (bque_vec_t *)mem_alloc(ctx, sizeof(bque_vec_t) * ((size_t)num + 1) +
+                                             hdr_size);
+    if (alloc_vec == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+    hdr = (bque_u8_t *)(alloc_vec + num + 1);
+
+    /* describe the buffers, then write their lengths. */
+    foreach_range(ctx, ctx->head_node, 0, 0, num, serial_collect, alloc_vec, NULL);
+    serial_put(hdr, BQUE_SERIAL_MAGIC);
+    serial_put(hdr + 4, num);
+    for (i = 0; i < num; i++) {
+        serial_put(hdr + BQUE_SERIAL_HDR_SIZE + 4 * (size_t)i,
+                   (bque_u32_t)alloc_vec[i + 1].size);
+    }
+    alloc_vec[0].base = hdr;
+    alloc_vec[0].size = hdr_size;
+
+    *vec = alloc_vec;
+    *vec_num = num + 1;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief give back the descriptor list of bque_serialize().
+ * 
+ * @param ctx context pointer.
+ * @param vec descriptor list pointer.
 */
-bque_res_t bque_foreach(bque_ctx_t *ctx, bque_iter_cb_t cb, bque_iter_order_t order) {
-    bque_u32_t node_num;
-    bque_u32_t node_idx;
-    bque_node_t *curt_node;
+BQUE_API bque_res_t bque_serialize_free(bque_ctx_t *ctx, bque_vec_t *vec) {
+    BQUE_ASSERT(ctx != NULL);
+    BQUE_ASSERT(vec != NULL);
+
+    mem_free(ctx, vec);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief describe the buffers of a serialized queue without copying them.
+ * 
+ * @note the descriptors point into the serialized queue, which must be kept
+ *       as long as they are used. `out_num` receives the number of all the
+ *       buffers, even if only the first `num` ones are described, so it can
+ *       be queried with no descriptors.
+ * 
+ * @param blob serialized queue.
+ * @param size size of the serialized queue.
+ * @param vec descriptors receiving the buffers.
+ * @param num maximum number of the descriptors.
+ * @param out_num number of the buffers in the serialized queue.
+*/
+BQUE_API bque_res_t bque_deserialize_ref(const void *blob, size_t size, bque_vec_t *vec,
+                                         bque_u32_t num, bque_u32_t *out_num) {
+    const bque_u8_t *byte = (const bque_u8_t *)blob;
+    bque_u32_t buff_num;
+    size_t offs;
+    bque_u32_t i;
+
+    BQUE_ASSERT(blob != NULL || size == 0);
+    BQUE_ASSERT(vec != NULL || num == 0);
+    BQUE_ASSERT(out_num != NULL);
+
+    *out_num = 0;
+
+    /* check the header and the lengths. */
+    if (size < BQUE_SERIAL_HDR_SIZE || serial_get(byte) != BQUE_SERIAL_MAGIC) {
+        return BQUE_ERR;
+    }
+    buff_num = serial_get(byte + 4);
+    if ((size - BQUE_SERIAL_HDR_SIZE) / 4 < buff_num) {
+        return BQUE_ERR_BAD_SIZE;
+    }
+    offs = BQUE_SERIAL_HDR_SIZE + 4 * (size_t)buff_num;
+    for (i = 0; i < buff_num; i++) {
+        bque_u32_t buff_size = serial_get(byte + BQUE_SERIAL_HDR_SIZE + 4 * (size_t)i);
+
+        if (size - offs < buff_size) {
+            return BQUE_ERR_BAD_SIZE;
+        }
+        if (i < num) {
+            vec[i].base = (void *)(byte + offs);
+            vec[i].size = buff_size;
+        }
+        offs += buff_size;
+    }
+    if (offs != size) {
+        return BQUE_ERR_BAD_SIZE;
+    }
+
+    *out_num = buff_num;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief append the buffers of a serialized queue to the tail of the queue.
+ * 
+ * @note either all buffers are added or none of them, as bque_enqueue_batch()
+ *       does, and the head buffers dropped by BQUE_FLAG_OVERWRITE are only
+ *       dropped on success. the nodes of a plain queue are allocated in one block, which is
+ *       freed with the last of them.
+ * 
+ * @param ctx context pointer.
+ * @param blob serialized queue.
+ * @param size size of the serialized queue.
+*/
+BQUE_API bque_res_t bque_deserialize(bque_ctx_t *ctx, const void *blob, size_t size) {
+    bque_slab_t *slab = NULL;
+    bque_vec_t *vec;
+    bque_u32_t num;
     bque_res_t res;
+    bque_u32_t i;
 
     BQUE_ASSERT(ctx != NULL);
-    BQUE_ASSERT(cb != NULL);
-    BQUE_ASSERT(order == BQUE_ITER_FORWARD ||
-                order == BQUE_ITER_BACKWARD);
 
-    /* if there is no any node in this queue, return immediately. */
-    node_num = ctx->cache.node_num;
-    if (node_num == 0) {
-        return BQUE_OK;
+    res = bque_deserialize_ref(blob, size, NULL, 0, &num);
+    if (res != BQUE_OK || num == 0) {
+        return res;
     }
 
-    /* iterate through the queue in specified order. */
-    if (order == BQUE_ITER_FORWARD) {
-        curt_node = ctx->head_node;
-        node_idx = 0;
-        do {
-            res = cb(node_idx, node_num, curt_node->buff, curt_node->size);
-            if (res == BQUE_ERR_ITER_STOP) {
-                return BQUE_ERR_ITER_STOP;
-            }
+    vec = (bque_vec_t *)mem_alloc(ctx, sizeof(bque_vec_t) * (size_t)num);
+    if (vec == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+    bque_deserialize_ref(blob, size, vec, num, &num);
 
-            curt_node = curt_node->next_node;
-            node_idx++;
-        } while (curt_node != NULL);
-    } else {
-        curt_node = ctx->tail_node;
-        node_idx = node_num - 1;
-        do {
-            res = cb(node_idx, node_num, curt_node->buff, curt_node->size);
-            if (res == BQUE_ERR_ITER_STOP) {
-                return BQUE_ERR_ITER_STOP;
-            }
+    /* carve the nodes from one block, unless they come from the pool, don't
+       exist or are freed by other threads. */
+    if (!(ctx->conf.flags & (BQUE_FLAG_NODE_POOL | BQUE_FLAG_PACKED | BQUE_FLAG_FILE |
+                             BQUE_SYNC_FLAGS))) {
+        size_t slab_size = sizeof(bque_slab_t);
 
-            curt_node = curt_node->prev_node;
-            node_idx--;
-        } while (curt_node != NULL);
+        for (i = 0; i < num; i++) {
+            slab_size += bque_align_up(sizeof(bque_node_t) + vec[i].size);
+        }
+        slab = (bque_slab_t *)mem_alloc(ctx, slab_size);
+        if (slab == NULL) {
+            mem_free(ctx, vec);
+
+            return BQUE_ERR_NO_MEM;
+        }
+        slab->end = (bque_u8_t *)slab->data;
+        slab->node_num = 0;
     }
 
-    return BQUE_OK;
+    res = push_batch(ctx, vec, num, slab);
+
+    /* nothing is carved if adding fails, or all dropped nodes are reused. */
+    if (slab != NULL && slab->node_num == 0) {
+        mem_free(ctx, slab);
+    }
+    mem_free(ctx, vec);
+
+    return res;
+}
+
+#ifdef BQUE_FILE
+
+/**
+ * @brief write the buffers of the file backend back to the disk.
+ * 
+ * @note when this returns, the queue survives a crash or a power loss as it
+ *       is now. the buffers added since the last sync may survive as well,
+ *       and the buffers taken since then come back. the queue is synced every
+ *       `file_sync_num` buffers added or taken, and by bque_free(). with
+ *       BQUE_ERR, the queue is fine in memory but its file may lag behind.
+ * 
+ * @param ctx context pointer.
+*/
+BQUE_API bque_res_t bque_sync(bque_ctx_t *ctx) {
+    BQUE_ASSERT(ctx != NULL);
+
+    if (!bque_is_file(ctx)) {
+        return BQUE_ERR_NOT_SUPP;
+    }
+
+    return file_sync(ctx);
 }
 
+#endif
+
 /**
  * @brief Adjust option of the buffer queue.
  * 
@@ -905,37 +7399,191 @@ bque_res_t bque_foreach(bque_ctx_t *ctx, bque_iter_cb_t cb, bque_iter_order_t or
  * @param opt Specified Option.
  * @param arg Option argument.
  */
-bque_res_t bque_adjust(bque_ctx_t *ctx, bque_opt_t opt, void *arg) {
+BQUE_API bque_res_t bque_adjust(bque_ctx_t *ctx, bque_opt_t opt, void *arg) {
     BQUE_ASSERT(ctx != NULL);
 
     switch (opt) {
         case BQUE_OPT_GET_MAX_BUFF_NUM:
             if (arg != NULL) {
-                *(bque_size_t *)arg = ctx->conf.node_num_max;
+                *(bque_size_t *)arg = conf_node_num_max(ctx);
             }
             break;
 
         case BQUE_OPT_SET_MAX_BUFF_NUM:
+#ifdef BQUE_CONF_BUFF_NUM_MAX
+            /* the limit is fixed at compile time. */
+            return BQUE_ERR_NOT_SUPP;
+#else
             if (arg != NULL) {
+
+                /* the ring can't grow. */
+                if (ctx->ring.slot != NULL &&
+                    (*(bque_size_t *)arg == 0 ||
+                     *(bque_size_t *)arg > ctx->ring.slot_num)) {
+                    return BQUE_ERR_BAD_SIZE;
+                }
                 ctx->conf.node_num_max = *(bque_size_t *)arg;
             }
             break;
+#endif
 
         case BQUE_OPT_GET_MAX_BUFF_SIZE:
             if (arg != NULL) {
-                *(bque_size_t *)arg = ctx->conf.buff_size_max;
+                *(bque_size_t *)arg = conf_buff_size_max(ctx);
             }
             break;
 
         case BQUE_OPT_SET_MAX_BUFF_SIZE:
+#ifdef BQUE_CONF_BUFF_SIZE_MAX
+            /* the limit is fixed at compile time. */
+            return BQUE_ERR_NOT_SUPP;
+#else
             if (arg != NULL) {
+
+                /* a fixed buffer size is the limit. */
+                if (conf_elem_size(ctx) != 0) {
+                    return BQUE_ERR_NOT_SUPP;
+                }
+
+                /* the buffers of the packed mode must fit into a chunk. */
+                if (bque_is_packed(ctx) &&
+                    (*(bque_size_t *)arg == 0 ||
+                     *(bque_size_t *)arg > BQUE_CHUNK_BUFF_SIZE_MAX)) {
+                    return BQUE_ERR_BAD_SIZE;
+                }
                 ctx->conf.buff_size_max = *(bque_size_t *)arg;
             }
             break;
+#endif
 
         case BQUE_OPT_SET_FREE_BUFF_CB:
+#ifdef BQUE_CONF_FREE_BUFF_CB
+            /* the callback is fixed at compile time. */
+            return BQUE_ERR_NOT_SUPP;
+#else
+
+            /* the buffers of the file backend outlive the process. */
+            if (arg != NULL && bque_is_file(ctx)) {
+                return BQUE_ERR_NOT_SUPP;
+            }
             ctx->conf.free_buff_cb = (bque_free_buff_cb_t)arg;
             break;
+#endif
+
+        case BQUE_OPT_SET_PRIO_CB:
+        case BQUE_OPT_SET_PRIO_ORDER: {
+            bque_sort_cb_t prio_cb = ctx->conf.prio_cb;
+            bque_sort_order_t prio_order = ctx->conf.prio_order;
+            bque_res_t res;
+
+            if (opt == BQUE_OPT_SET_PRIO_CB) {
+                prio_cb = (bque_sort_cb_t)arg;
+            } else if (arg != NULL) {
+                prio_order = *(bque_sort_order_t *)arg;
+            }
+            if (prio_order != BQUE_SORT_ASCENDING &&
+                prio_order != BQUE_SORT_DESCENDING) {
+                return BQUE_ERR_BAD_OPT;
+            }
+
+            /* the shared queues and the file backend can only add buffers
+               to the tail. */
+            if (prio_cb != NULL && (bque_is_sync(ctx) || bque_is_file(ctx))) {
+                return BQUE_ERR_BAD_OPT;
+            }
+
+            /* put the buffers in the new order first. */
+            if (prio_cb != NULL && ctx->cache.node_num > 1) {
+                bque_sort_cb_t old_cb = ctx->conf.prio_cb;
+
+                ctx->conf.prio_cb = NULL;
+                res = bque_sort(ctx, prio_cb, prio_order);
+                if (res != BQUE_OK) {
+                    ctx->conf.prio_cb = old_cb;
+                    return res;
+                }
+            }
+            ctx->conf.prio_cb = prio_cb;
+            ctx->conf.prio_order = prio_order;
+        } break;
+
+        case BQUE_OPT_GET_MAX_TOTAL_BYTES:
+            if (arg != NULL) {
+                *(bque_u64_t *)arg = ctx->conf.total_bytes_max;
+            }
+            break;
+
+        case BQUE_OPT_SET_MAX_TOTAL_BYTES:
+            if (arg != NULL) {
+
+                /* the shared queues only count the buffers. */
+                if (*(bque_u64_t *)arg != 0 && bque_is_sync(ctx)) {
+                    return BQUE_ERR_BAD_OPT;
+                }
+                ctx->conf.total_bytes_max = *(bque_u64_t *)arg;
+            }
+            break;
+
+        case BQUE_OPT_GET_NODE_CACHE_NUM:
+            if (arg != NULL) {
+                *(bque_u32_t *)arg = ctx->mem.recycle.node_num_max;
+            }
+            break;
+
+        case BQUE_OPT_SET_NODE_CACHE_NUM:
+            if (arg != NULL) {
+
+                /* the shared queues don't have a node cache. */
+                if (*(bque_u32_t *)arg != 0 && bque_is_sync(ctx)) {
+                    return BQUE_ERR_BAD_OPT;
+                }
+                ctx->mem.recycle.node_num_max = *(bque_u32_t *)arg;
+                recycle_trim(ctx, ctx->mem.recycle.node_num_max);
+            }
+            break;
+
+        case BQUE_OPT_TRIM_NODE_CACHE:
+            recycle_trim(ctx, 0);
+            break;
+
+        case BQUE_OPT_GET_FILE_SYNC_NUM:
+        case BQUE_OPT_SET_FILE_SYNC_NUM:
+#ifdef BQUE_FILE
+            if (!bque_is_file(ctx)) {
+                return BQUE_ERR_NOT_SUPP;
+            }
+            if (arg != NULL) {
+                if (opt == BQUE_OPT_GET_FILE_SYNC_NUM) {
+                    *(bque_u32_t *)arg = ctx->file.sync_num;
+                } else {
+                    ctx->file.sync_num = *(bque_u32_t *)arg;
+                }
+            }
+            break;
+#else
+            return BQUE_ERR_NOT_SUPP;
+#endif
+
+        case BQUE_OPT_GET_NOTIFY_FD:
+#ifdef BQUE_THREADS
+            if (!bque_is_notify(ctx)) {
+                return BQUE_ERR_NOT_SUPP;
+            }
+            if (arg != NULL) {
+                *(int *)arg = ctx->sync.notify_fd[0];
+            }
+            break;
+#else
+            return BQUE_ERR_NOT_SUPP;
+#endif
+
+        case BQUE_OPT_RESET_STATS:
+#ifdef BQUE_STATS
+            memset(&ctx->stats, 0, sizeof(ctx->stats));
+            break;
+#else
+            return BQUE_ERR_NOT_SUPP;
+#endif
 
         default:
             return BQUE_ERR_BAD_OPT;
@@ -943,3 +7591,237 @@ bque_res_t bque_adjust(bque_ctx_t *ctx, bque_opt_t opt, void *arg) {
 
     return BQUE_OK;
 }
+
+#ifdef BQUE_THREADS
+
+/**
+ * @brief free a sharded queue and the queues of its first lanes.
+ * 
+ * @param shard sharded queue pointer.
+ * @param lane_num number of the lanes to free.
+*/
+static void shard_destroy(bque_shard_t *shard, bque_u32_t lane_num) {
+    bque_u32_t i;
+
+    for (i = 0; i < lane_num; i++) {
+        bque_free(shard->lane[i].ctx);
+        pthread_mutex_destroy(&shard->lane[i].lock);
+    }
+
+    if (shard->dealloc_cb != NULL) {
+        shard->dealloc_cb(shard->user, shard);
+    } else {
+        free(shard);
+    }
+}
+
+/**
+ * @brief create a sharded queue.
+ * 
+ * @note every lane is a queue created with `conf`, so the limits apply to
+ *       each lane. a thread adds buffers to its own lane, and takes them from
+ *       there, or from the tail of the other lanes when its own is empty, see
+ *       bque_shard_dequeue(). the order of the buffers is only kept within a
+ *       lane. the shared queues, the file backend and BQUE_FLAG_DEFER_FREE
+ *       return BQUE_ERR_BAD_OPT, since the lanes take locks of their own.
+ * 
+ * @param shard the address of the sharded queue pointer.
+ * @param lane_num number of the lanes, e.g. one per core.
+ * @param conf configuration of the lanes, NULL for the defaults.
+*/
+BQUE_API bque_res_t bque_shard_new(bque_shard_t **shard, bque_u32_t lane_num, bque_conf_t *conf) {
+    bque_shard_t *alloc_shard;
+    size_t size;
+    bque_u32_t i;
+    bque_res_t res;
+
+    BQUE_ASSERT(shard != NULL);
+
+    if (lane_num == 0) {
+        return BQUE_ERR_BAD_OPT;
+    }
+    if (conf != NULL && (conf->flags & (BQUE_SYNC_FLAGS | BQUE_FLAG_NOTIFY |
+                                        BQUE_FLAG_FILE | BQUE_FLAG_DEFER_FREE))) {
+        return BQUE_ERR_BAD_OPT;
+    }
+
+    /* allocate the sharded queue with its lanes. */
+    size = sizeof(bque_shard_t) + sizeof(bque_lane_t) * (size_t)lane_num;
+    if (conf != NULL && conf->alloc_cb != NULL) {
+        alloc_shard = (bque_shard_t *)conf->alloc_cb(conf->alloc_user, size);
+    } else {
+        alloc_shard = (bque_shard_t *)malloc(size);
+    }
+    if (alloc_shard == NULL) {
+        return BQUE_ERR_NO_MEM;
+    }
+    memset(alloc_shard, 0, size);
+    if (conf != NULL) {
+        alloc_shard->dealloc_cb = conf->dealloc_cb;
+        alloc_shard->user = conf->alloc_user;
+    }
+    alloc_shard->lane_num = lane_num;
+
+    /* create the lanes. */
+    for (i = 0; i < lane_num; i++) {
+        if (pthread_mutex_init(&alloc_shard->lane[i].lock, NULL) != 0) {
+            shard_destroy(alloc_shard, i);
+
+            return BQUE_ERR;
+        }
+        res = bque_new(&alloc_shard->lane[i].ctx, conf);
+        if (res != BQUE_OK) {
+            pthread_mutex_destroy(&alloc_shard->lane[i].lock);
+            shard_destroy(alloc_shard, i);
+
+            return res;
+        }
+    }
+
+    *shard = alloc_shard;
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief free a sharded queue, the buffers left are released like
+ *        bque_free() does.
+ * 
+ * @param shard sharded queue pointer.
+*/
+BQUE_API bque_res_t bque_shard_free(bque_shard_t *shard) {
+    BQUE_ASSERT(shard != NULL);
+
+    shard_destroy(shard, shard->lane_num);
+
+    return BQUE_OK;
+}
+
+/**
+ * @brief append a buffer to the tail of a lane of a sharded queue.
+ * 
+ * @note BQUE_ERR_FULL_QUE is returned when the lane is full, even if the
+ *       other lanes have room.
+ * 
+ * @param shard sharded queue pointer.
+ * @param lane lane of the calling thread.
+ * @param buff buffer pointer, can be NULL, which means the function will not
+ *             copy the buffer.
+ * @param size buffer size.
+*/
+BQUE_API bque_res_t bque_shard_enqueue(bque_shard_t *shard, bque_u32_t lane, const void *buff,
+                                       bque_u32_t size) {
+    bque_lane_t *curt_lane;
+    bque_res_t res;
+
+    BQUE_ASSERT(shard != NULL);
+
+    if (lane >= shard->lane_num) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    curt_lane = &shard->lane[lane];
+    pthread_mutex_lock(&curt_lane->lock);
+    res = bque_enqueue(curt_lane->ctx, buff, size);
+    __atomic_store_n(&curt_lane->buff_num, curt_lane->ctx->cache.node_num, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&curt_lane->lock);
+
+    return res;
+}
+
+/**
+ * @brief take a buffer from a sharded queue.
+ * 
+ * @note the head of the lane of the calling thread is taken first. when the
+ *       lane is empty, the tail of the next lanes is taken instead, which is
+ *       where their own threads are least likely to look soon.
+ *       BQUE_ERR_EMPTY_QUE is returned when no lane has a buffer.
+ * 
+ * @param shard sharded queue pointer.
+ * @param lane lane of the calling thread.
+ * @param buff buffer pointer, when it's NULL, the buffer won't be copied.
+ * @param size size pointer, when it's NULL, the size won't be copied.
+*/
+BQUE_API bque_res_t bque_shard_dequeue(bque_shard_t *shard, bque_u32_t lane, void *buff,
+                                       bque_u32_t *size) {
+    bque_lane_t *curt_lane;
+    bque_res_t res = BQUE_ERR_EMPTY_QUE;
+    bque_u32_t i;
+
+    BQUE_ASSERT(shard != NULL);
+
+    if (lane >= shard->lane_num) {
+        return BQUE_ERR_BAD_IDX;
+    }
+
+    for (i = 0; i < shard->lane_num && res == BQUE_ERR_EMPTY_QUE; i++) {
+        curt_lane = &shard->lane[(lane + i) % shard->lane_num];
+
+        /* don't lock the lanes which looked empty. */
+        if (__atomic_load_n(&curt_lane->buff_num, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&curt_lane->lock);
+        if (i == 0) {
+            res = bque_dequeue(curt_lane->ctx, buff, size);
+        } else {
+            res = bque_forfeit(curt_lane->ctx, buff, size);
+        }
+        __atomic_store_n(&curt_lane->buff_num, curt_lane->ctx->cache.node_num, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&curt_lane->lock);
+    }
+
+    return res;
+}
+
+/**
+ * @brief get the status information of a sharded queue, summed over its
+ *        lanes.
+ * 
+ * @note the lanes are visited one after another, so the sum isn't a snapshot
+ *       while other threads are using the queue. `peak_num` is the sum of the
+ *       peaks of the lanes.
+ * 
+ * @param shard sharded queue pointer.
+ * @param stat status pointer.
+*/
+BQUE_API bque_res_t bque_shard_stat(bque_shard_t *shard, bque_stat_t *stat) {
+    bque_stat_t lane_stat;
+    bque_u32_t i;
+#ifdef BQUE_STATS
+    bque_u32_t k;
+#endif
+
+    BQUE_ASSERT(shard != NULL);
+    BQUE_ASSERT(stat != NULL);
+
+    memset(stat, 0, sizeof(bque_stat_t));
+    for (i = 0; i < shard->lane_num; i++) {
+        pthread_mutex_lock(&shard->lane[i].lock);
+        bque_stat(shard->lane[i].ctx, &lane_stat);
+        pthread_mutex_unlock(&shard->lane[i].lock);
+
+        stat->buff_num += lane_stat.buff_num;
+        stat->drop_num += lane_stat.drop_num;
+        stat->buff_bytes += lane_stat.buff_bytes;
+        stat->mem_bytes += lane_stat.mem_bytes;
+        stat->retire_num += lane_stat.retire_num;
+#ifdef BQUE_STATS
+        stat->enq_num += lane_stat.enq_num;
+        stat->deq_num += lane_stat.deq_num;
+        stat->full_num += lane_stat.full_num;
+        stat->peak_num += lane_stat.peak_num;
+        stat->find_num += lane_stat.find_num;
+        stat->finger_hit_num += lane_stat.finger_hit_num;
+        stat->walk_num += lane_stat.walk_num;
+        for (k = 0; k < BQUE_STATS_DWELL_NUM; k++) {
+            stat->dwell_num[k] += lane_stat.dwell_num[k];
+        }
+#endif
+    }
+
+    return BQUE_OK;
+}
+
+#endif
@@ -25,6 +25,16 @@
 #ifndef __BQUE_H__
 #define __BQUE_H__
 
+/* the implementation is compiled into the including file with
+   BQUE_HEADER_ONLY, and needs clock_gettime() and the file functions when
+   compiling in strict standard mode. */
+#if defined(BQUE_HEADER_ONLY) && \
+    (defined(BQUE_THREADS) || defined(BQUE_FILE) || defined(BQUE_STATS)) && \
+    !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef BQUE_DEBUG
@@ -80,6 +90,9 @@ enum _bque_res {
 
     /* Invalid option. */
     BQUE_ERR_BAD_OPT    = -9,
+
+    /* operation not supported by the context. */
+    BQUE_ERR_NOT_SUPP   = -10,
 };
 
 /* Option enumeration type */
@@ -93,6 +106,38 @@ typedef enum _bque_opt {
        This is used when your buffer structure contains pointers
        that need to be freed before the buffer is deleted. */
     BQUE_OPT_SET_FREE_BUFF_CB,
+
+    /* Set the priority callback and order, see `prio_cb` of bque_conf_t.
+       The buffers already in the queue are sorted first. */
+    BQUE_OPT_SET_PRIO_CB,
+    BQUE_OPT_SET_PRIO_ORDER,
+
+    /* Get or set `total_bytes_max` of bque_conf_t, the argument points to
+       a bque_u64_t. */
+    BQUE_OPT_GET_MAX_TOTAL_BYTES,
+    BQUE_OPT_SET_MAX_TOTAL_BYTES,
+
+    /* Get or set the maximum number of the freed nodes kept for reuse, the
+       argument points to a bque_u32_t. 0 turns the node cache off, shared
+       queues don't have one. */
+    BQUE_OPT_GET_NODE_CACHE_NUM,
+    BQUE_OPT_SET_NODE_CACHE_NUM,
+
+    /* Give the nodes kept for reuse back to the allocator. */
+    BQUE_OPT_TRIM_NODE_CACHE,
+
+    /* Get or set `file_sync_num` of bque_conf_t, the argument points to a
+       bque_u32_t. only supported by BQUE_FLAG_FILE. */
+    BQUE_OPT_GET_FILE_SYNC_NUM,
+    BQUE_OPT_SET_FILE_SYNC_NUM,
+
+    /* Get the notification fd of BQUE_FLAG_NOTIFY, the argument points to
+       an int. the fd belongs to the queue and is closed by bque_free(). */
+    BQUE_OPT_GET_NOTIFY_FD,
+
+    /* Zero the counters of BQUE_STATS, the queue must not be used by other
+       threads meanwhile. */
+    BQUE_OPT_RESET_STATS,
 } bque_opt_t;
 
 /* iterating order. */
@@ -143,58 +188,396 @@ typedef bque_s32_t          bque_res_t;
 
 #endif
 
-/* Buffer freeing callback. */
+/* linkage of the APIs. defining BQUE_HEADER_ONLY makes this header include
+   the implementation with every API static inline, so a program can use the
+   queue without linking the library, and the compiler can inline the calls
+   into its loops. the settings below are folded into the inlined functions
+   as constants then. */
+#ifdef BQUE_HEADER_ONLY
+#define BQUE_API    static inline
+#else
+#define BQUE_API
+#endif
+
+/* Compile-time settings, each one replaces a setting of bque_conf_t for all
+   contexts, the setting passed to bque_new() is ignored, and changing it by
+   bque_adjust() returns BQUE_ERR_NOT_SUPP.
+
+   BQUE_CONF_BUFF_NUM_MAX   replaces `buff_num_max`.
+   BQUE_CONF_BUFF_SIZE_MAX  replaces `buff_size_max`.
+   BQUE_CONF_BUFF_SIZE      replaces `elem_size`.
+   BQUE_CONF_FREE_BUFF_CB   replaces `free_buff_cb` with the function of
+                            this name, which the program defines. */
+#if defined(BQUE_CONF_BUFF_SIZE) && defined(BQUE_CONF_BUFF_SIZE_MAX)
+#error "BQUE_CONF_BUFF_SIZE can't be combined with BQUE_CONF_BUFF_SIZE_MAX"
+#endif
+
+/* Buffer freeing callback, called for every buffer the queue discards,
+   i.e. removed without being copied out or handed to the caller, emptied or
+   dropped by BQUE_FLAG_OVERWRITE. */
 typedef bque_res_t (*bque_free_buff_cb_t)(void *buff, bque_size_t size);
 
+#ifdef BQUE_CONF_FREE_BUFF_CB
+bque_res_t BQUE_CONF_FREE_BUFF_CB(void *buff, bque_size_t size);
+#endif
+
+/* Memory allocating callback, returns NULL when out of memory. */
+typedef void *(*bque_alloc_cb_t)(void *user, size_t size);
+
+/* Memory deallocating callback. */
+typedef void (*bque_dealloc_cb_t)(void *user, void *ptr);
+
+/* Context flags. */
+typedef enum _bque_flag {
+
+    /* preallocate `buff_num_max` nodes of `buff_size_max` bytes in one
+       block at creation, both limits must be non-zero. */
+    BQUE_FLAG_NODE_POOL     = 1 << 0,
+
+    /* keep the nodes in a preallocated ring indexed by position, so
+       accessing a buffer by index takes constant time. the ring holds
+       pointers to the pool nodes rather than the buffers themselves, so
+       each buffer still takes a node of `buff_size_max` bytes, and the
+       nodes stay linked as well. both limits must be non-zero, implies
+       BQUE_FLAG_NODE_POOL. */
+    BQUE_FLAG_RING          = 1 << 1,
+
+    /* let one producer thread and one consumer thread use the queue at the
+       same time without locking, see bque_enqueue() and bque_dequeue().
+       only available when built with BQUE_THREADS, can't be combined with
+       the node pool. */
+    BQUE_FLAG_SPSC          = 1 << 2,
+
+    /* let any number of producer and consumer threads use the queue at the
+       same time, producers don't lock and consumers take turns on the head.
+       same restrictions as BQUE_FLAG_SPSC. */
+    BQUE_FLAG_MPMC          = 1 << 3,
+
+    /* keep a skip list over the nodes, so accessing, adding or removing a
+       buffer by index takes logarithmic time while both ends stay constant.
+       can't be combined with the ring backend or the shared queues. */
+    BQUE_FLAG_INDEXED       = 1 << 4,
+
+    /* pack several small buffers back to back into each node, which saves
+       memory and keeps iterating sequential. `buff_size_max` must not exceed
+       512 bytes, the buffers returned by bque_item() stay valid until the
+       queue is modified, and the functions handing out or adopting single
+       buffers return BQUE_ERR_NOT_SUPP. can't be combined with the flags
+       above. */
+    BQUE_FLAG_PACKED        = 1 << 5,
+
+    /* when the queue holds `buff_num_max` buffers, adding one to the tail
+       drops the head buffer instead of failing with BQUE_ERR_FULL_QUE, its
+       node is reused when the new buffer fits. the dropped buffers are
+       counted by bque_stat(). can't be combined with the shared queues. */
+    BQUE_FLAG_OVERWRITE     = 1 << 6,
+
+    /* keep the buffers in the memory-mapped file at `file_path`, so they
+       survive restarts and crashes, see bque_sync(). only available when
+       built with BQUE_FILE, supports adding to the tail, taking from the
+       head, iterating forwardly and indexing, the other functions return
+       BQUE_ERR_NOT_SUPP. can't be combined with other flags. */
+    BQUE_FLAG_FILE          = 1 << 7,
+
+    /* raise a pollable fd, see BQUE_OPT_GET_NOTIFY_FD, when the queue stops
+       being empty and when it stops being full. it stays readable until
+       bque_notify_ack(), so one wakeup covers any number of buffers. only
+       available for the shared queues. */
+    BQUE_FLAG_NOTIFY        = 1 << 8,
+
+    /* keep the nodes of the removed buffers on a retire list instead of
+       freeing them, so taking buffers doesn't pay for the allocator or the
+       freeing callback, see bque_reclaim(). the list grows until then. can't
+       be combined with the node pool, the ring backend, the packed mode or
+       the file backend. */
+    BQUE_FLAG_DEFER_FREE    = 1 << 9,
+} bque_flag_t;
+
+/* Sorting callback. */
+typedef bque_sort_res_t (*bque_sort_cb_t)(const void *buff_a, bque_size_t size_a,
+                                          const void *buff_b, bque_size_t size_b);
+
+/* Sorting callback of the buffers of `elem_size` bytes. */
+typedef bque_sort_res_t (*bque_elem_sort_cb_t)(const void *elem_a, const void *elem_b);
+
 /* Configuration of the buffer queue. */
 typedef struct _bque_conf {
     bque_u32_t buff_num_max;
     bque_u32_t buff_size_max;
     bque_free_buff_cb_t free_buff_cb;
+
+    /* Size of every buffer, 0 means any size up to `buff_size_max`. a fixed
+       size replaces `buff_size_max`, lets the buffers be sorted by
+       bque_sort_elem(), and makes the chunks of BQUE_FLAG_PACKED store the
+       buffers back to back without a size for each. the heads of the
+       buffers can't be consumed by bque_consume_bytes() then. */
+    bque_u32_t elem_size;
+
+    /* Memory allocator, libc malloc() and free() are used when both
+       callbacks are NULL. `alloc_user` is passed to the callbacks. */
+    bque_alloc_cb_t alloc_cb;
+    bque_dealloc_cb_t dealloc_cb;
+    void *alloc_user;
+
+    /* Bitwise OR of bque_flag_t. */
+    bque_u32_t flags;
+
+    /* Keep the buffers in this order as they are added, so dequeuing always
+       takes the first one, the queue is a plain FIFO when it's NULL. buffers
+       comparing equal keep their arrival order. */
+    bque_sort_cb_t prio_cb;
+    bque_sort_order_t prio_order;
+
+    /* Maximum number of the bytes held by all buffers together, 0 means
+       unlimited. a queue holding too many bytes is full like one holding
+       too many buffers. can't be combined with the shared queues. */
+    bque_u64_t total_bytes_max;
+
+    /* File of BQUE_FLAG_FILE, which is created with `file_size` bytes when
+       it doesn't exist, or opened with the buffers it holds. the file is
+       synced to the disk every `file_sync_num` buffers added or taken, 0
+       means only by bque_sync() and bque_free(). */
+    const char *file_path;
+    bque_u64_t file_size;
+    bque_u32_t file_sync_num;
 } bque_conf_t;
 
+#ifdef BQUE_STATS
+
+/* number of the buckets of the dwell time histogram of bque_stat_t. */
+#define BQUE_STATS_DWELL_NUM    32
+
+#endif
+
 /* status of the buffer queue. */
 typedef struct _bque_stat {
     bque_u32_t buff_num;
+
+    /* number of the buffers dropped by BQUE_FLAG_OVERWRITE. */
+    bque_u64_t drop_num;
+
+    /* number of the bytes held by the buffers, and of the memory taken by
+       the nodes holding them, headers and unused capacity included. */
+    bque_u64_t buff_bytes;
+    bque_u64_t mem_bytes;
+
+    /* number of the nodes waiting for bque_reclaim(). */
+    bque_u32_t retire_num;
+
+#ifdef BQUE_STATS
+    /* counters kept when built with BQUE_STATS, since the queue was created
+       or BQUE_OPT_RESET_STATS. buffers added and taken, moving buffers
+       between queues and emptying them aside, and tries to add refused with
+       BQUE_ERR_FULL_QUE. the buffers dropped by BQUE_FLAG_OVERWRITE only
+       count in `drop_num`. */
+    bque_u64_t enq_num;
+    bque_u64_t deq_num;
+    bque_u64_t full_num;
+
+    /* largest number of the buffers in the queue. */
+    bque_u32_t peak_num;
+
+    /* lookups by index walking the nodes, the ones starting from a node of
+       the fast indexing cache, and the nodes walked in total. */
+    bque_u64_t find_num;
+    bque_u64_t finger_hit_num;
+    bque_u64_t walk_num;
+
+    /* histogram of the time the buffers stayed in the queue, bucket k counts
+       the buffers taken after 2^k to 2^(k+1) - 1 microseconds, bucket 0 the
+       faster ones too and the last bucket the slower ones too. the packed
+       mode and the file backend don't time their buffers. */
+    bque_u64_t dwell_num[BQUE_STATS_DWELL_NUM];
+#endif
 } bque_stat_t;
 
+/* buffer descriptor, laid out like struct iovec. */
+typedef struct _bque_vec {
+    void *base;
+    size_t size;
+} bque_vec_t;
+
 /* context of the buffer queue. */
 typedef struct _bque_ctx    bque_ctx_t;
 
+/* sharded queue, a set of lanes each holding a queue of its own, see
+   bque_shard_new(). */
+typedef struct _bque_shard  bque_shard_t;
+
 /* Iterating callback. */
 typedef bque_res_t (*bque_iter_cb_t)(bque_u32_t idx, bque_u32_t num,
                                      void *buff, bque_size_t size);
 
-/* Sorting callback. */
-typedef bque_sort_res_t (*bque_sort_cb_t)(const void *buff_a, bque_size_t size_a,
-                                          const void *buff_b, bque_size_t size_b);
+/* Chunked iterating callback, called with the descriptors of `vec_num`
+   buffers in queue order, the first of which has the index `idx`. */
+typedef bque_res_t (*bque_iter_vec_cb_t)(bque_u32_t idx, const bque_vec_t *vec,
+                                         bque_u32_t vec_num, void *user);
+
+/* Matching callback of bque_remove_if(), returns non-zero for the buffers
+   to remove. */
+typedef int (*bque_match_cb_t)(const void *buff, bque_size_t size, void *user);
+
+/* cursor over the buffers of a queue, see bque_cursor_begin(). the fields
+   are private. */
+typedef struct _bque_cursor {
+    bque_ctx_t *ctx;
+    void *node;
+    bque_u32_t pos;
+    bque_u32_t idx;
+} bque_cursor_t;
+
+BQUE_API bque_res_t bque_new(bque_ctx_t **ctx, bque_conf_t *conf);
+
+BQUE_API bque_res_t bque_free(bque_ctx_t *ctx);
+
+BQUE_API bque_res_t bque_stat(bque_ctx_t *ctx, bque_stat_t *stat);
+
+BQUE_API bque_res_t bque_enqueue(bque_ctx_t *ctx, const void *buff, bque_u32_t size);
+
+BQUE_API bque_res_t bque_preempt(bque_ctx_t *ctx, const void *buff, bque_u32_t size);
+
+BQUE_API bque_res_t bque_insert(bque_ctx_t *ctx, bque_u32_t idx, const void *buff, bque_u32_t size);
+
+BQUE_API bque_res_t bque_alloc(bque_ctx_t *ctx, bque_u32_t size, void **buff);
+
+BQUE_API bque_res_t bque_enqueue_adopt(bque_ctx_t *ctx, void *buff, bque_u32_t size);
+
+BQUE_API bque_res_t bque_reserve(bque_ctx_t *ctx, bque_u32_t size, void **buff);
+
+BQUE_API bque_res_t bque_commit(bque_ctx_t *ctx, bque_u32_t size);
+
+BQUE_API bque_res_t bque_dequeue(bque_ctx_t *ctx, void *buff, bque_u32_t *size);
+
+#ifdef BQUE_THREADS
+
+BQUE_API bque_res_t bque_enqueue_wait(bque_ctx_t *ctx, const void *buff, bque_u32_t size,
+                                      bque_s32_t timeout);
+
+BQUE_API bque_res_t bque_dequeue_wait(bque_ctx_t *ctx, void *buff, bque_u32_t *size,
+                                      bque_s32_t timeout);
+
+BQUE_API bque_res_t bque_notify_ack(bque_ctx_t *ctx);
 
-bque_res_t bque_new(bque_ctx_t **ctx, bque_conf_t *conf);
+#endif
+
+BQUE_API bque_res_t bque_forfeit(bque_ctx_t *ctx, void *buff, bque_u32_t *size);
+
+BQUE_API bque_res_t bque_drop(bque_ctx_t *ctx, bque_u32_t idx, void *buff, bque_u32_t *size);
+
+BQUE_API bque_res_t bque_dequeue_ref(bque_ctx_t *ctx, void **buff, bque_u32_t *size);
+
+BQUE_API bque_res_t bque_forfeit_ref(bque_ctx_t *ctx, void **buff, bque_u32_t *size);
+
+BQUE_API bque_res_t bque_drop_ref(bque_ctx_t *ctx, bque_u32_t idx, void **buff, bque_u32_t *size);
+
+BQUE_API bque_res_t bque_release(bque_ctx_t *ctx, void *buff);
+
+BQUE_API bque_res_t bque_enqueue_batch(bque_ctx_t *ctx, const bque_vec_t *vec, bque_u32_t num);
+
+BQUE_API bque_res_t bque_dequeue_batch(bque_ctx_t *ctx, bque_vec_t *vec, bque_u32_t num,
+                                       bque_u32_t *out_num);
+
+BQUE_API bque_res_t bque_release_batch(bque_ctx_t *ctx, const bque_vec_t *vec, bque_u32_t num);
+
+BQUE_API bque_res_t bque_reclaim(bque_ctx_t *ctx, bque_u32_t *out_num);
+
+BQUE_API bque_res_t bque_peek_bytes(bque_ctx_t *ctx, size_t offs, void *buff, size_t size);
+
+BQUE_API bque_res_t bque_peek_vec(bque_ctx_t *ctx, size_t size, bque_vec_t *vec, bque_u32_t num,
+                                  bque_u32_t *out_num);
+
+BQUE_API bque_res_t bque_consume_bytes(bque_ctx_t *ctx, size_t size);
+
+BQUE_API bque_res_t bque_splice(bque_ctx_t *dst, bque_ctx_t *src);
+
+BQUE_API bque_res_t bque_split(bque_ctx_t *ctx, bque_u32_t idx, bque_ctx_t **new_ctx);
+
+BQUE_API bque_res_t bque_empty(bque_ctx_t *ctx);
+
+BQUE_API bque_res_t bque_item(bque_ctx_t *ctx, bque_s32_t idx, void **buff, bque_size_t *size);
+
+BQUE_API bque_res_t bque_sort(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order);
+
+BQUE_API bque_res_t bque_sort_elem(bque_ctx_t *ctx, bque_elem_sort_cb_t cb,
+                                   bque_sort_order_t order);
+
+BQUE_API bque_res_t bque_sort_key(bque_ctx_t *ctx, bque_size_t key_offs, bque_size_t key_size,
+                                  bque_sort_order_t order);
+
+#ifdef BQUE_THREADS
+
+BQUE_API bque_res_t bque_sort_parallel(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order,
+                                       bque_u32_t thread_num);
 
-bque_res_t bque_free(bque_ctx_t *ctx);
+#endif
+
+BQUE_API bque_res_t bque_foreach(bque_ctx_t *ctx, bque_iter_cb_t cb, bque_iter_order_t order);
+
+BQUE_API bque_res_t bque_foreach_vec(bque_ctx_t *ctx, bque_iter_vec_cb_t cb, void *user);
+
+#ifdef BQUE_THREADS
+
+BQUE_API bque_res_t bque_foreach_parallel(bque_ctx_t *ctx, bque_iter_vec_cb_t cb, void *user,
+                                          bque_u32_t thread_num);
+
+#endif
+
+BQUE_API bque_res_t bque_cursor_begin(bque_ctx_t *ctx, bque_cursor_t *cur);
+
+BQUE_API bque_res_t bque_cursor_end(bque_ctx_t *ctx, bque_cursor_t *cur);
 
-bque_res_t bque_stat(bque_ctx_t *ctx, bque_stat_t *stat);
+BQUE_API bque_res_t bque_cursor_next(bque_cursor_t *cur);
 
-bque_res_t bque_enqueue(bque_ctx_t *ctx, const void *buff, bque_u32_t size);
+BQUE_API bque_res_t bque_cursor_prev(bque_cursor_t *cur);
 
-bque_res_t bque_preempt(bque_ctx_t *ctx, const void *buff, bque_u32_t size);
+BQUE_API bque_res_t bque_cursor_get(bque_cursor_t *cur, void **buff, bque_size_t *size);
 
-bque_res_t bque_insert(bque_ctx_t *ctx, bque_u32_t idx, const void *buff, bque_u32_t size);
+BQUE_API bque_res_t bque_cursor_erase(bque_cursor_t *cur, void *buff, bque_u32_t *size);
 
-bque_res_t bque_dequeue(bque_ctx_t *ctx, void *buff, bque_u32_t *size);
+BQUE_API bque_res_t bque_cursor_insert_before(bque_cursor_t *cur, const void *buff,
+                                              bque_u32_t size);
 
-bque_res_t bque_forfeit(bque_ctx_t *ctx, void *buff, bque_u32_t *size);
+BQUE_API bque_res_t bque_cursor_insert_after(bque_cursor_t *cur, const void *buff,
+                                             bque_u32_t size);
 
-bque_res_t bque_drop(bque_ctx_t *ctx, bque_u32_t idx, void *buff, bque_u32_t *size);
+BQUE_API bque_res_t bque_remove_if(bque_ctx_t *ctx, bque_match_cb_t cb, void *user,
+                                   bque_u32_t *out_num);
 
-bque_res_t bque_empty(bque_ctx_t *ctx);
+BQUE_API bque_res_t bque_serialize(bque_ctx_t *ctx, bque_vec_t **vec, bque_u32_t *vec_num);
 
-bque_res_t bque_item(bque_ctx_t *ctx, bque_s32_t idx, void **buff, bque_size_t *size);
+BQUE_API bque_res_t bque_serialize_free(bque_ctx_t *ctx, bque_vec_t *vec);
 
-bque_res_t bque_sort(bque_ctx_t *ctx, bque_sort_cb_t cb, bque_sort_order_t order);
+BQUE_API bque_res_t bque_deserialize(bque_ctx_t *ctx, const void *blob, size_t size);
 
-bque_res_t bque_foreach(bque_ctx_t *ctx, bque_iter_cb_t cb, bque_iter_order_t order);
+BQUE_API bque_res_t bque_deserialize_ref(const void *blob, size_t size, bque_vec_t *vec,
+                                         bque_u32_t num, bque_u32_t *out_num);
 
-bque_res_t bque_adjust(bque_ctx_t *ctx, bque_opt_t opt, void *arg);
+#ifdef BQUE_FILE
+
+BQUE_API bque_res_t bque_sync(bque_ctx_t *ctx);
+
+#endif
+
+BQUE_API bque_res_t bque_adjust(bque_ctx_t *ctx, bque_opt_t opt, void *arg);
+
+#ifdef BQUE_THREADS
+
+BQUE_API bque_res_t bque_shard_new(bque_shard_t **shard, bque_u32_t lane_num, bque_conf_t *conf);
+
+BQUE_API bque_res_t bque_shard_free(bque_shard_t *shard);
+
+BQUE_API bque_res_t bque_shard_enqueue(bque_shard_t *shard, bque_u32_t lane, const void *buff,
+                                       bque_u32_t size);
+
+BQUE_API bque_res_t bque_shard_dequeue(bque_shard_t *shard, bque_u32_t lane, void *buff,
+                                       bque_u32_t *size);
+
+BQUE_API bque_res_t bque_shard_stat(bque_shard_t *shard, bque_stat_t *stat);
+
+#endif
+
+#ifdef BQUE_HEADER_ONLY
+#include "bufferqueue.c"
+#endif
 
 #endif
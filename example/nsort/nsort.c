@@ -16,13 +16,12 @@
 
 static bque_sort_order_t sort_order = BQUE_SORT_ASCENDING;
 
-static bque_sort_res_t num_sort_cb(const void *buff_a, bque_size_t size_a,
-                                   const void *buff_b, bque_size_t size_b) {
+static bque_sort_res_t num_sort_cb(const void *elem_a, const void *elem_b) {
     long int num_a;
     long int num_b;
 
-    num_a = *(long int *)buff_a;
-    num_b = *(long int *)buff_b;
+    num_a = *(const long int *)elem_a;
+    num_b = *(const long int *)elem_b;
 
     if (num_a < num_b) {
         return BQUE_SORT_LESS;
@@ -61,11 +60,11 @@ static bque_res_t num_iter_cb(bque_u32_t idx, bque_u32_t num,
 }
 
 int main(int argc, char **argv) {
+    bque_conf_t conf = {0};
     bque_ctx_t *ctx;
     bque_res_t res;
     int num_num;
     int opt;
-    int arg;
 
     /* Parse the command line arguments. */
     while ((opt = getopt(argc, argv, NSORT_OPT_STR)) != -1) {
@@ -92,28 +91,18 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    /* Create a new buffer queue. */
-    res = bque_new(&ctx, NULL);
+    /* Create a new buffer queue, with no limit on the number of buffers
+       and each buffer of the size of a long int. The numbers are packed
+       back to back into chunks, since a node per number would take more
+       memory than the number itself. */
+    conf.buff_num_max = 0;
+    conf.elem_size = sizeof(long int);
+    conf.flags = BQUE_FLAG_PACKED;
+    res = bque_new(&ctx, &conf);
     if (res != BQUE_OK) {
         goto error_exit;
     }
 
-    /* Configure the buffer queue. */
-
-    /* No limit on the number of buffers. */
-    arg = 0;
-    res = bque_adjust(ctx, BQUE_OPT_SET_MAX_BUFF_NUM, &arg);
-    if (res != BQUE_OK) {
-        goto free_bque;
-    }
-
-    /* Limit the size of each buffer to the size of a long int. */
-    arg = (int)sizeof(long int);
-    res = bque_adjust(ctx, BQUE_OPT_SET_MAX_BUFF_SIZE, &arg);
-    if (res != BQUE_OK) {
-        goto free_bque;
-    }
-
     for (int i = optind; i < argc; i++) {
         long int num;
         char *endptr;
@@ -132,7 +121,7 @@ int main(int argc, char **argv) {
     }
 
     /* Sort the numbers. */
-    res = bque_sort(ctx, num_sort_cb, sort_order);
+    res = bque_sort_elem(ctx, num_sort_cb, sort_order);
     if (res != BQUE_OK) {
         goto free_bque;
     }
@@ -0,0 +1,93 @@
+#ifndef __BQUE_TEST_H__
+#define __BQUE_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bufferqueue.h"
+
+/* largest buffer made by test_make(). */
+#define TEST_BUFF_SIZE_MAX  320
+
+/* fail the test when a condition doesn't hold. */
+#define TEST_CHECK(cond)                                                        \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,   \
+                    #cond);                                                     \
+            exit(1);                                                            \
+        }                                                                       \
+    } while (0)
+
+/* size of the buffer numbered `id`, at least 4 bytes. */
+static inline bque_u32_t test_size(bque_u32_t id) {
+    return 4 + (id * 7) % (TEST_BUFF_SIZE_MAX - 4);
+}
+
+/* fill the buffer numbered `id`, which starts with the number itself. */
+static inline bque_u32_t test_make(bque_u32_t id, void *buff) {
+    bque_u8_t *byte = (bque_u8_t *)buff;
+    bque_u32_t size = test_size(id);
+    bque_u32_t i;
+
+    for (i = 0; i < size; i++) {
+        byte[i] = (bque_u8_t)(id * 31 + i);
+    }
+    memcpy(byte, &id, sizeof(id));
+
+    return size;
+}
+
+/* get the number of a buffer made by test_make() after checking it. */
+static inline bque_u32_t test_verify(const void *buff, bque_u32_t size) {
+    bque_u8_t expect[TEST_BUFF_SIZE_MAX];
+    bque_u32_t id;
+
+    TEST_CHECK(size >= sizeof(id));
+    memcpy(&id, buff, sizeof(id));
+    TEST_CHECK(size == test_make(id, expect));
+    TEST_CHECK(memcmp(buff, expect, size) == 0);
+
+    return id;
+}
+
+/* add the buffers numbered `first` to `first + num - 1` to a queue. */
+static inline void test_fill(bque_ctx_t *ctx, bque_u32_t first, bque_u32_t num) {
+    bque_u8_t buff[TEST_BUFF_SIZE_MAX];
+    bque_u32_t i;
+
+    for (i = 0; i < num; i++) {
+        TEST_CHECK(bque_enqueue(ctx, buff, test_make(first + i, buff)) == BQUE_OK);
+    }
+}
+
+/* take `num` buffers from a queue, which must be numbered from `first`. */
+static inline void test_drain(bque_ctx_t *ctx, bque_u32_t first, bque_u32_t num) {
+    bque_u8_t buff[TEST_BUFF_SIZE_MAX];
+    bque_u32_t size;
+    bque_u32_t i;
+
+    for (i = 0; i < num; i++) {
+        TEST_CHECK(bque_dequeue(ctx, buff, &size) == BQUE_OK);
+        TEST_CHECK(test_verify(buff, size) == first + i);
+    }
+}
+
+/* check that a queue holds exactly the buffers numbered `first` to
+   `first + num - 1`, without taking them. */
+static inline void test_expect(bque_ctx_t *ctx, bque_u32_t first, bque_u32_t num) {
+    bque_stat_t stat;
+    bque_size_t size;
+    void *buff;
+    bque_u32_t i;
+
+    TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK);
+    TEST_CHECK(stat.buff_num == num);
+    for (i = 0; i < num; i++) {
+        TEST_CHECK(bque_item(ctx, (bque_s32_t)i, &buff, &size) == BQUE_OK);
+        TEST_CHECK(test_verify(buff, (bque_u32_t)size) == first + i);
+    }
+}
+
+#endif
@@ -0,0 +1,179 @@
+/* needed by fork() and waitpid() when compiling in strict standard mode. */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test.h"
+
+/* size of the small file, which the records wrap around many times. */
+#define TEST_SMALL_FILE_SIZE    (64 * 1024)
+
+/* number of the crashes of the wrapping test. */
+#define TEST_CRASH_NUM          200
+
+static const char *file_path;
+
+static bque_ctx_t *test_open(bque_u64_t file_size) {
+    bque_conf_t conf = {0};
+    bque_ctx_t *ctx;
+
+    conf.flags = BQUE_FLAG_FILE;
+    conf.file_path = file_path;
+    conf.file_size = file_size;
+    TEST_CHECK(bque_new(&ctx, &conf) == BQUE_OK);
+
+    return ctx;
+}
+
+/* wait for a child which exited without closing its queue. */
+static void test_wait(pid_t pid) {
+    int status;
+
+    TEST_CHECK(pid > 0);
+    TEST_CHECK(waitpid(pid, &status, 0) == pid);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+/* a queue closed by bque_free() comes back as it was. */
+static void test_reopen(void) {
+    bque_ctx_t *ctx;
+
+    unlink(file_path);
+    ctx = test_open(0);
+    test_fill(ctx, 0, 1000);
+    test_drain(ctx, 0, 300);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+
+    ctx = test_open(0);
+    test_expect(ctx, 300, 700);
+    test_drain(ctx, 300, 200);
+    test_fill(ctx, 1000, 100);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+
+    ctx = test_open(0);
+    test_expect(ctx, 500, 600);
+    TEST_CHECK(bque_insert(ctx, 0, "x", 1) == BQUE_ERR_NOT_SUPP);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+/* a process dying before bque_sync() leaves the queue of the last sync,
+   plus the buffers added since then, the ones taken come back. */
+static void test_crash_before_sync(void) {
+    bque_ctx_t *ctx;
+    pid_t pid;
+
+    unlink(file_path);
+    ctx = test_open(0);
+    test_fill(ctx, 0, 100);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+
+    pid = fork();
+    if (pid == 0) {
+        ctx = test_open(0);
+        test_drain(ctx, 0, 40);
+        test_fill(ctx, 100, 50);
+        _exit(0);
+    }
+    test_wait(pid);
+
+    ctx = test_open(0);
+    test_expect(ctx, 0, 150);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+/* a process dying right after bque_sync() leaves the queue of the sync. */
+static void test_crash_after_sync(void) {
+    bque_ctx_t *ctx;
+    pid_t pid;
+
+    unlink(file_path);
+    pid = fork();
+    if (pid == 0) {
+        ctx = test_open(0);
+        test_fill(ctx, 0, 100);
+        test_drain(ctx, 0, 40);
+        TEST_CHECK(bque_sync(ctx) == BQUE_OK);
+        _exit(0);
+    }
+    test_wait(pid);
+
+    ctx = test_open(0);
+    test_expect(ctx, 40, 60);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+/* crash over and over in a small file, with buffers both taken and added
+   before and after the sync. more are added than taken, so the records
+   wrap around and the file fills up. */
+static void test_crash_wrap(void) {
+    bque_u32_t head = 0;
+    bque_u32_t tail = 0;
+    bque_u32_t synced;
+    bque_stat_t stat;
+    bque_ctx_t *ctx;
+    int fd[2];
+    pid_t pid;
+    int n;
+
+    unlink(file_path);
+    srand(1);
+    for (n = 0; n < TEST_CRASH_NUM; n++) {
+        bque_u32_t drain_num = (bque_u32_t)rand() % 50;
+        bque_u32_t fill_num = (bque_u32_t)rand() % 60;
+
+        TEST_CHECK(pipe(fd) == 0);
+        pid = fork();
+        if (pid == 0) {
+            bque_u8_t buff[TEST_BUFF_SIZE_MAX];
+            bque_u32_t id = tail;
+            bque_u32_t size;
+            bque_u32_t i;
+
+            close(fd[0]);
+            ctx = test_open(TEST_SMALL_FILE_SIZE);
+            for (i = 0; i < fill_num; i++, id++) {
+                if (bque_enqueue(ctx, buff, test_make(id, buff)) != BQUE_OK) {
+                    break;
+                }
+            }
+            test_drain(ctx, head, drain_num < tail - head ? drain_num : tail - head);
+            TEST_CHECK(bque_sync(ctx) == BQUE_OK);
+            TEST_CHECK(write(fd[1], &id, sizeof(id)) == sizeof(id));
+
+            /* without a sync, the buffer might be added and is taken again,
+               adding doesn't sync as nothing was taken since the sync. */
+            bque_enqueue(ctx, buff, test_make(id, buff));
+            bque_dequeue(ctx, buff, &size);
+            _exit(0);
+        }
+        close(fd[1]);
+        TEST_CHECK(read(fd[0], &synced, sizeof(synced)) == sizeof(synced));
+        close(fd[0]);
+        test_wait(pid);
+
+        head += drain_num < tail - head ? drain_num : tail - head;
+        ctx = test_open(0);
+        TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK);
+        TEST_CHECK(stat.buff_num == synced - head || stat.buff_num == synced + 1 - head);
+        tail = head + stat.buff_num;
+        test_expect(ctx, head, tail - head);
+        TEST_CHECK(bque_free(ctx) == BQUE_OK);
+    }
+}
+
+int main(int argc, char **argv) {
+    TEST_CHECK(argc == 2);
+    file_path = argv[1];
+
+    test_reopen();
+    test_crash_before_sync();
+    test_crash_after_sync();
+    test_crash_wrap();
+    unlink(file_path);
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "test.h"
+
+#define TEST_PRODUCER_NUM   4
+#define TEST_CONSUMER_NUM   3
+
+/* number of the buffers added by each producer. */
+#define TEST_BUFF_NUM       50000
+
+/* buffer passed between the threads, `check` is the complement of `seq`. */
+typedef struct _test_item {
+    bque_u32_t producer;
+    bque_u32_t seq;
+    bque_u32_t check;
+} test_item_t;
+
+typedef struct _test_thread {
+    bque_ctx_t *ctx;
+    bque_u32_t id;
+    bque_u64_t sum;
+    bque_u32_t num;
+} test_thread_t;
+
+/* set once the housekeeping thread of test_reclaim() is to stop. */
+static int reclaim_stop;
+
+/* a producer adds its buffers copied, blocking while the queue is full, or
+   adopted, retrying. */
+static void *test_produce(void *arg) {
+    test_thread_t *thread = (test_thread_t *)arg;
+    test_item_t item;
+    bque_res_t res;
+    void *buff;
+    bque_u32_t i;
+
+    /* the reservation of a context can't be shared by its producers. */
+    TEST_CHECK(bque_reserve(thread->ctx, sizeof(item), &buff) == BQUE_ERR_NOT_SUPP);
+    TEST_CHECK(bque_commit(thread->ctx, sizeof(item)) == BQUE_ERR_NOT_SUPP);
+
+    item.producer = thread->id;
+    for (i = 0; i < TEST_BUFF_NUM; i++) {
+        item.seq = i;
+        item.check = ~i;
+        if (i % 4 != 0) {
+            TEST_CHECK(bque_enqueue_wait(thread->ctx, &item, sizeof(item), -1) == BQUE_OK);
+            continue;
+        }
+
+        TEST_CHECK(bque_alloc(thread->ctx, sizeof(item), &buff) == BQUE_OK);
+        memcpy(buff, &item, sizeof(item));
+        while ((res = bque_enqueue_adopt(thread->ctx, buff, sizeof(item))) != BQUE_OK) {
+            TEST_CHECK(res == BQUE_ERR_FULL_QUE);
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/* a consumer takes buffers until it gets a single byte, the buffers of each
+   producer have to come in order. */
+static void *test_consume(void *arg) {
+    test_thread_t *thread = (test_thread_t *)arg;
+    bque_u32_t next[TEST_PRODUCER_NUM] = {0};
+    test_item_t item;
+    bque_u32_t size;
+
+    for (;;) {
+        TEST_CHECK(bque_dequeue_wait(thread->ctx, &item, &size, -1) == BQUE_OK);
+        if (size == 1) {
+            break;
+        }
+        TEST_CHECK(size == sizeof(item));
+        TEST_CHECK(item.producer < TEST_PRODUCER_NUM);
+        TEST_CHECK(item.seq >= next[item.producer] && item.check == ~item.seq);
+        next[item.producer] = item.seq + 1;
+        thread->sum += item.seq;
+        thread->num++;
+    }
+
+    return NULL;
+}
+
+/* with BQUE_FLAG_DEFER_FREE, a housekeeping thread frees the nodes taken so
+   far until reclaim_stop is set, the count it sees must stay within bounds. */
+static void *test_reclaim(void *arg) {
+    test_thread_t *thread = (test_thread_t *)arg;
+    bque_stat_t stat;
+    bque_u32_t num;
+
+    while (!__atomic_load_n(&reclaim_stop, __ATOMIC_ACQUIRE)) {
+        TEST_CHECK(bque_reclaim(thread->ctx, &num) == BQUE_OK);
+        TEST_CHECK(bque_stat(thread->ctx, &stat) == BQUE_OK);
+        TEST_CHECK(stat.retire_num <= TEST_PRODUCER_NUM * TEST_BUFF_NUM + TEST_CONSUMER_NUM);
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+static void test_run(bque_u32_t buff_num_max, bque_u32_t flags) {
+    test_thread_t producer[TEST_PRODUCER_NUM];
+    test_thread_t consumer[TEST_CONSUMER_NUM];
+    pthread_t thread[TEST_PRODUCER_NUM + TEST_CONSUMER_NUM + 1];
+    test_thread_t reclaimer = {0};
+    bque_conf_t conf = {0};
+    bque_u64_t sum = 0;
+    bque_u32_t num = 0;
+    bque_stat_t stat;
+    bque_ctx_t *ctx;
+    bque_u32_t i;
+
+    reclaim_stop = 0;
+    conf.buff_num_max = buff_num_max;
+    conf.flags = BQUE_FLAG_MPMC | flags;
+    TEST_CHECK(bque_new(&ctx, &conf) == BQUE_OK);
+    if (flags & BQUE_FLAG_DEFER_FREE) {
+        reclaimer.ctx = ctx;
+        TEST_CHECK(pthread_create(&thread[TEST_PRODUCER_NUM + TEST_CONSUMER_NUM], NULL,
+                                  test_reclaim, &reclaimer) == 0);
+    }
+
+    for (i = 0; i < TEST_CONSUMER_NUM; i++) {
+        memset(&consumer[i], 0, sizeof(consumer[i]));
+        consumer[i].ctx = ctx;
+        TEST_CHECK(pthread_create(&thread[i], NULL, test_consume, &consumer[i]) == 0);
+    }
+    for (i = 0; i < TEST_PRODUCER_NUM; i++) {
+        memset(&producer[i], 0, sizeof(producer[i]));
+        producer[i].ctx = ctx;
+        producer[i].id = i;
+        TEST_CHECK(pthread_create(&thread[TEST_CONSUMER_NUM + i], NULL, test_produce,
+                                  &producer[i]) == 0);
+    }
+
+    /* once the producers are done, stop each consumer by a single byte. */
+    for (i = 0; i < TEST_PRODUCER_NUM; i++) {
+        TEST_CHECK(pthread_join(thread[TEST_CONSUMER_NUM + i], NULL) == 0);
+    }
+    for (i = 0; i < TEST_CONSUMER_NUM; i++) {
+        TEST_CHECK(bque_enqueue_wait(ctx, "", 1, -1) == BQUE_OK);
+    }
+    for (i = 0; i < TEST_CONSUMER_NUM; i++) {
+        TEST_CHECK(pthread_join(thread[i], NULL) == 0);
+        sum += consumer[i].sum;
+        num += consumer[i].num;
+    }
+    if (flags & BQUE_FLAG_DEFER_FREE) {
+        __atomic_store_n(&reclaim_stop, 1, __ATOMIC_RELEASE);
+        TEST_CHECK(pthread_join(thread[TEST_PRODUCER_NUM + TEST_CONSUMER_NUM], NULL) == 0);
+        TEST_CHECK(bque_reclaim(ctx, NULL) == BQUE_OK);
+        TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK && stat.retire_num == 0);
+    }
+
+    TEST_CHECK(num == TEST_PRODUCER_NUM * TEST_BUFF_NUM);
+    TEST_CHECK(sum == (bque_u64_t)TEST_PRODUCER_NUM * TEST_BUFF_NUM * (TEST_BUFF_NUM - 1) / 2);
+    TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK);
+    TEST_CHECK(stat.buff_num == 0);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+int main(void) {
+    test_run(0, 0);
+    test_run(64, 0);
+    test_run(64, BQUE_FLAG_DEFER_FREE);
+
+    return 0;
+}
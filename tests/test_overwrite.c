@@ -0,0 +1,130 @@
+#include "test.h"
+
+#define TEST_BUFF_NUM_MAX   10
+
+/* number of the allocations test_alloc() lets through, -1 means any. */
+static int alloc_left = -1;
+
+static void *test_alloc(void *user, size_t size) {
+    (void)user;
+    if (alloc_left == 0) {
+        return NULL;
+    }
+    if (alloc_left > 0) {
+        alloc_left--;
+    }
+
+    return malloc(size);
+}
+
+static void test_dealloc(void *user, void *ptr) {
+    (void)user;
+    free(ptr);
+}
+
+static bque_ctx_t *test_new(bque_u32_t flags) {
+    bque_conf_t conf = {0};
+    bque_ctx_t *ctx;
+
+    conf.buff_num_max = TEST_BUFF_NUM_MAX;
+    conf.buff_size_max = TEST_BUFF_SIZE_MAX;
+    conf.flags = BQUE_FLAG_OVERWRITE | flags;
+    conf.alloc_cb = test_alloc;
+    conf.dealloc_cb = test_dealloc;
+    alloc_left = -1;
+    TEST_CHECK(bque_new(&ctx, &conf) == BQUE_OK);
+
+    return ctx;
+}
+
+/* add the buffers numbered `first` to `first + num - 1` in one batch. */
+static bque_res_t test_batch(bque_ctx_t *ctx, bque_u32_t first, bque_u32_t num) {
+    bque_u8_t buff[4][TEST_BUFF_SIZE_MAX];
+    bque_vec_t vec[4];
+    bque_u32_t i;
+
+    for (i = 0; i < num; i++) {
+        vec[i].base = buff[i];
+        vec[i].size = test_make(first + i, buff[i]);
+    }
+
+    return bque_enqueue_batch(ctx, vec, num);
+}
+
+/* single buffers past the limit drop the oldest ones. */
+static void test_single(bque_u32_t flags) {
+    bque_stat_t stat;
+    bque_ctx_t *ctx;
+
+    ctx = test_new(flags);
+    test_fill(ctx, 0, 100);
+    test_expect(ctx, 100 - TEST_BUFF_NUM_MAX, TEST_BUFF_NUM_MAX);
+    TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK);
+    TEST_CHECK(stat.drop_num == 100 - TEST_BUFF_NUM_MAX);
+#ifdef BQUE_STATS
+    TEST_CHECK(stat.enq_num == 100 && stat.deq_num == 0);
+#endif
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+/* a batch which can't be added drops nothing, one which can drops just
+   enough. the packed mode isn't covered, as its chunks mostly have room for
+   the new buffers without allocating. */
+static void test_batch_fail(bque_u32_t flags) {
+    bque_stat_t stat;
+    bque_ctx_t *ctx;
+
+    ctx = test_new(flags);
+    test_fill(ctx, 0, TEST_BUFF_NUM_MAX);
+
+    /* the new buffers grow, so some of them don't fit the dropped nodes. */
+    alloc_left = 0;
+    TEST_CHECK(test_batch(ctx, 3 * TEST_BUFF_NUM_MAX - 4, 4) == BQUE_ERR_NO_MEM);
+    test_expect(ctx, 0, TEST_BUFF_NUM_MAX);
+    TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK && stat.drop_num == 0);
+
+    alloc_left = -1;
+    TEST_CHECK(test_batch(ctx, TEST_BUFF_NUM_MAX, 4) == BQUE_OK);
+    test_expect(ctx, 4, TEST_BUFF_NUM_MAX);
+    TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK && stat.drop_num == 4);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+/* a batch whose buffers fit the nodes of the dropped ones doesn't allocate,
+   the sizes of test_size() repeat every 316 buffers. */
+static void test_batch_reuse(bque_u32_t flags) {
+    bque_size_t size;
+    bque_ctx_t *ctx;
+    void *buff;
+    bque_u32_t i;
+
+    ctx = test_new(flags);
+    test_fill(ctx, 0, TEST_BUFF_NUM_MAX);
+
+    alloc_left = 0;
+    TEST_CHECK(test_batch(ctx, 316, 4) == BQUE_OK);
+    for (i = 0; i < TEST_BUFF_NUM_MAX; i++) {
+        TEST_CHECK(bque_item(ctx, (bque_s32_t)i, &buff, &size) == BQUE_OK);
+        TEST_CHECK(test_verify(buff, (bque_u32_t)size) ==
+                   (i < TEST_BUFF_NUM_MAX - 4 ? i + 4 : i - (TEST_BUFF_NUM_MAX - 4) + 316));
+    }
+    alloc_left = -1;
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+int main(void) {
+    test_single(0);
+    test_single(BQUE_FLAG_RING);
+    test_single(BQUE_FLAG_INDEXED);
+    test_single(BQUE_FLAG_PACKED);
+    test_single(BQUE_FLAG_DEFER_FREE);
+
+    test_batch_fail(0);
+    test_batch_fail(BQUE_FLAG_INDEXED);
+    test_batch_fail(BQUE_FLAG_DEFER_FREE);
+
+    test_batch_reuse(0);
+    test_batch_reuse(BQUE_FLAG_RING);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <unistd.h>
+
+#include "test.h"
+
+/* number of the buffers of a queue, and the limit of the bounded ones. */
+#define TEST_BUFF_NUM       500
+#define TEST_BUFF_NUM_MAX   1000
+
+/* flags of the modes, one of each backend. */
+static const bque_u32_t test_modes[] = {
+    0,
+    BQUE_FLAG_NODE_POOL,
+    BQUE_FLAG_RING,
+    BQUE_FLAG_INDEXED,
+    BQUE_FLAG_PACKED,
+    BQUE_FLAG_OVERWRITE,
+    BQUE_FLAG_DEFER_FREE,
+#ifdef BQUE_FILE
+    BQUE_FLAG_FILE,
+#endif
+#ifdef BQUE_THREADS
+    BQUE_FLAG_SPSC,
+    BQUE_FLAG_MPMC,
+#endif
+};
+
+#define TEST_MODE_NUM       (sizeof(test_modes) / sizeof(test_modes[0]))
+
+static const char *file_path[2];
+
+static bque_ctx_t *test_new(bque_u32_t flags, int k) {
+    bque_conf_t conf = {0};
+    bque_ctx_t *ctx;
+
+    conf.buff_num_max = TEST_BUFF_NUM_MAX;
+    conf.buff_size_max = TEST_BUFF_SIZE_MAX;
+    conf.flags = flags;
+    if (flags & BQUE_FLAG_FILE) {
+        unlink(file_path[k]);
+        conf.file_path = file_path[k];
+    }
+    TEST_CHECK(bque_new(&ctx, &conf) == BQUE_OK);
+
+    return ctx;
+}
+
+/* serialize a queue into one block. */
+static bque_u8_t *test_serialize(bque_ctx_t *ctx, size_t *size) {
+    bque_vec_t *vec;
+    bque_u32_t num;
+    bque_u8_t *blob;
+    size_t offs = 0;
+    bque_u32_t i;
+
+    TEST_CHECK(bque_serialize(ctx, &vec, &num) == BQUE_OK);
+    *size = 0;
+    for (i = 0; i < num; i++) {
+        *size += vec[i].size;
+    }
+    blob = (bque_u8_t *)malloc(*size);
+    TEST_CHECK(blob != NULL);
+    for (i = 0; i < num; i++) {
+        memcpy(blob + offs, vec[i].base, vec[i].size);
+        offs += vec[i].size;
+    }
+    TEST_CHECK(bque_serialize_free(ctx, vec) == BQUE_OK);
+
+    return blob;
+}
+
+/* the buffers of a serialized queue come back in any mode, and serializing
+   them again gives the same bytes. */
+static void test_round_trip(bque_u32_t flags) {
+    bque_u32_t src_flags = flags & ~(bque_u32_t)(BQUE_FLAG_SPSC | BQUE_FLAG_MPMC);
+    bque_ctx_t *src;
+    bque_ctx_t *dst;
+    bque_u8_t *blob;
+    bque_u8_t *copy;
+    bque_vec_t *vec;
+    size_t blob_size;
+    size_t copy_size;
+    bque_u32_t num;
+    bque_stat_t stat;
+
+    /* the shared queues can't be serialized, they are filled from a plain
+       one. taking some buffers first moves the head of the ring. */
+    src = test_new(src_flags, 0);
+    test_fill(src, 0, TEST_BUFF_NUM);
+    test_drain(src, 0, 10);
+    test_fill(src, TEST_BUFF_NUM, 10);
+    blob = test_serialize(src, &blob_size);
+
+    TEST_CHECK(bque_deserialize_ref(blob, blob_size, NULL, 0, &num) == BQUE_OK);
+    TEST_CHECK(num == TEST_BUFF_NUM);
+    TEST_CHECK(bque_deserialize_ref(blob, blob_size - 1, NULL, 0, &num) == BQUE_ERR_BAD_SIZE);
+    blob[0] ^= 1;
+    TEST_CHECK(bque_deserialize_ref(blob, blob_size, NULL, 0, &num) == BQUE_ERR);
+    TEST_CHECK(bque_deserialize(src, blob, blob_size) == BQUE_ERR);
+    blob[0] ^= 1;
+
+    dst = test_new(flags, 1);
+    TEST_CHECK(bque_deserialize(dst, blob, blob_size) == BQUE_OK);
+
+    /* the source can go before the buffers taken from it. */
+    TEST_CHECK(bque_free(src) == BQUE_OK);
+
+    if (flags & (BQUE_FLAG_SPSC | BQUE_FLAG_MPMC)) {
+        TEST_CHECK(bque_serialize(dst, &vec, &num) == BQUE_ERR_NOT_SUPP);
+        TEST_CHECK(bque_stat(dst, &stat) == BQUE_OK && stat.buff_num == TEST_BUFF_NUM);
+    } else {
+        test_expect(dst, 10, TEST_BUFF_NUM);
+        copy = test_serialize(dst, &copy_size);
+        TEST_CHECK(copy_size == blob_size && memcmp(copy, blob, blob_size) == 0);
+        free(copy);
+    }
+
+    /* adding past the limit takes all buffers or none, except for the
+       overwriting queue, which drops the oldest ones. */
+    TEST_CHECK(bque_deserialize(dst, blob, blob_size) == BQUE_OK);
+    TEST_CHECK(bque_deserialize(dst, blob, blob_size) ==
+               (flags & BQUE_FLAG_OVERWRITE ? BQUE_OK : BQUE_ERR_FULL_QUE));
+    TEST_CHECK(bque_stat(dst, &stat) == BQUE_OK && stat.buff_num == 2 * TEST_BUFF_NUM);
+    test_drain(dst, 10, TEST_BUFF_NUM);
+    test_drain(dst, 10, TEST_BUFF_NUM);
+    TEST_CHECK(bque_free(dst) == BQUE_OK);
+    free(blob);
+}
+
+/* the nodes of a deserialized queue share a block, which still lets them
+   move between queues. */
+static void test_move(void) {
+    bque_ctx_t *src;
+    bque_ctx_t *dst;
+    bque_ctx_t *tail;
+    bque_u8_t *blob;
+    size_t blob_size;
+
+    src = test_new(0, 0);
+    test_fill(src, 0, TEST_BUFF_NUM);
+    blob = test_serialize(src, &blob_size);
+
+    dst = test_new(0, 1);
+    TEST_CHECK(bque_deserialize(dst, blob, blob_size) == BQUE_OK);
+    TEST_CHECK(bque_split(dst, 100, &tail) == BQUE_OK);
+    test_expect(dst, 0, 100);
+    test_expect(tail, 100, TEST_BUFF_NUM - 100);
+    TEST_CHECK(bque_splice(src, tail) == BQUE_OK);
+    TEST_CHECK(bque_free(tail) == BQUE_OK);
+    TEST_CHECK(bque_free(dst) == BQUE_OK);
+
+    test_drain(src, 0, TEST_BUFF_NUM);
+    test_drain(src, 100, TEST_BUFF_NUM - 100);
+    TEST_CHECK(bque_free(src) == BQUE_OK);
+    free(blob);
+}
+
+int main(int argc, char **argv) {
+    size_t i;
+
+    TEST_CHECK(argc == 3);
+    file_path[0] = argv[1];
+    file_path[1] = argv[2];
+
+    for (i = 0; i < TEST_MODE_NUM; i++) {
+        test_round_trip(test_modes[i]);
+    }
+    test_move();
+    unlink(file_path[0]);
+    unlink(file_path[1]);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "test.h"
+
+/* number of the lanes, one thread each. */
+#define TEST_LANE_NUM       6
+
+/* number of the buffers added by each thread. */
+#define TEST_BUFF_NUM       50000
+
+/* buffer passed between the lanes, `check` is the complement of `id`. */
+typedef struct _test_item {
+    bque_u32_t id;
+    bque_u32_t check;
+} test_item_t;
+
+typedef struct _test_thread {
+    bque_shard_t *shard;
+    bque_u32_t lane;
+    bque_u64_t sum;
+} test_thread_t;
+
+static bque_u8_t taken[TEST_LANE_NUM * TEST_BUFF_NUM];
+
+static bque_u32_t taken_num;
+
+/* every thread takes from its own lane, the odd ones add to it less often,
+   so they run dry and steal from the others. */
+static void *test_work(void *arg) {
+    test_thread_t *thread = (test_thread_t *)arg;
+    bque_u32_t id = thread->lane * TEST_BUFF_NUM;
+    bque_u32_t turn = 0;
+    bque_u32_t i = 0;
+    test_item_t item;
+    bque_u32_t size;
+    bque_res_t res;
+
+    while (__atomic_load_n(&taken_num, __ATOMIC_RELAXED) < TEST_LANE_NUM * TEST_BUFF_NUM) {
+        if (i < TEST_BUFF_NUM && (thread->lane % 2 == 0 || turn++ % 3 == 0)) {
+            item.id = id + i;
+            item.check = ~item.id;
+            res = bque_shard_enqueue(thread->shard, thread->lane, &item, sizeof(item));
+            if (res == BQUE_OK) {
+                i++;
+            } else {
+                TEST_CHECK(res == BQUE_ERR_FULL_QUE);
+            }
+        }
+
+        res = bque_shard_dequeue(thread->shard, thread->lane, &item, &size);
+        if (res != BQUE_OK) {
+            TEST_CHECK(res == BQUE_ERR_EMPTY_QUE);
+            sched_yield();
+            continue;
+        }
+        TEST_CHECK(size == sizeof(item) && item.check == ~item.id);
+        TEST_CHECK(item.id < TEST_LANE_NUM * TEST_BUFF_NUM);
+        TEST_CHECK(__atomic_exchange_n(&taken[item.id], 1, __ATOMIC_RELAXED) == 0);
+        __atomic_fetch_add(&taken_num, 1, __ATOMIC_RELAXED);
+        thread->sum += item.id;
+    }
+
+    return NULL;
+}
+
+int main(void) {
+    test_thread_t thread[TEST_LANE_NUM];
+    pthread_t handle[TEST_LANE_NUM];
+    bque_conf_t conf = {0};
+    bque_shard_t *shard;
+    bque_u64_t sum = 0;
+    bque_u32_t value;
+    bque_u32_t size;
+    bque_stat_t stat;
+    bque_u32_t i;
+
+    conf.buff_num_max = 500;
+    conf.buff_size_max = sizeof(test_item_t);
+
+    /* the lanes lock on their own. */
+    conf.flags = BQUE_FLAG_MPMC;
+    TEST_CHECK(bque_shard_new(&shard, TEST_LANE_NUM, &conf) == BQUE_ERR_BAD_OPT);
+    conf.flags = 0;
+    TEST_CHECK(bque_shard_new(&shard, 0, &conf) == BQUE_ERR_BAD_OPT);
+    TEST_CHECK(bque_shard_new(&shard, TEST_LANE_NUM, &conf) == BQUE_OK);
+    TEST_CHECK(bque_shard_enqueue(shard, TEST_LANE_NUM, &value, sizeof(value)) == BQUE_ERR_BAD_IDX);
+
+    /* a lane takes its own buffers from the head, and steals from the
+       tail of another. */
+    for (value = 0; value < 5; value++) {
+        TEST_CHECK(bque_shard_enqueue(shard, 2, &value, sizeof(value)) == BQUE_OK);
+    }
+    TEST_CHECK(bque_shard_dequeue(shard, 1, &value, &size) == BQUE_OK && value == 4);
+    TEST_CHECK(bque_shard_dequeue(shard, 2, &value, &size) == BQUE_OK && value == 0);
+    TEST_CHECK(bque_shard_stat(shard, &stat) == BQUE_OK && stat.buff_num == 3);
+    for (i = 0; i < 3; i++) {
+        TEST_CHECK(bque_shard_dequeue(shard, 5, &value, &size) == BQUE_OK);
+    }
+    TEST_CHECK(bque_shard_dequeue(shard, 0, &value, &size) == BQUE_ERR_EMPTY_QUE);
+
+    for (i = 0; i < TEST_LANE_NUM; i++) {
+        thread[i].shard = shard;
+        thread[i].lane = i;
+        thread[i].sum = 0;
+        TEST_CHECK(pthread_create(&handle[i], NULL, test_work, &thread[i]) == 0);
+    }
+    for (i = 0; i < TEST_LANE_NUM; i++) {
+        TEST_CHECK(pthread_join(handle[i], NULL) == 0);
+        sum += thread[i].sum;
+    }
+
+    for (i = 0; i < TEST_LANE_NUM * TEST_BUFF_NUM; i++) {
+        TEST_CHECK(taken[i] == 1);
+    }
+    TEST_CHECK(sum == (bque_u64_t)TEST_LANE_NUM * TEST_BUFF_NUM *
+                      (TEST_LANE_NUM * TEST_BUFF_NUM - 1) / 2);
+    TEST_CHECK(bque_shard_stat(shard, &stat) == BQUE_OK && stat.buff_num == 0);
+    TEST_CHECK(bque_shard_free(shard) == BQUE_OK);
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "test.h"
+
+/* number of the buffers passed per run. */
+#define TEST_BUFF_NUM       200000
+
+/* buffer passed between the threads, `check` is the complement of `id`. */
+typedef struct _test_item {
+    bque_u32_t id;
+    bque_u32_t check;
+} test_item_t;
+
+/* the producer adds every buffer by one of the functions allowed to it. */
+static void *test_produce(void *arg) {
+    bque_ctx_t *ctx = (bque_ctx_t *)arg;
+    test_item_t item;
+    bque_res_t res;
+    void *buff;
+    bque_u32_t i;
+
+    for (i = 0; i < TEST_BUFF_NUM;) {
+        item.id = i;
+        item.check = ~i;
+        switch (i % 3) {
+        case 0:
+            res = bque_enqueue(ctx, &item, sizeof(item));
+            break;
+        case 1:
+            TEST_CHECK(bque_alloc(ctx, sizeof(item), &buff) == BQUE_OK);
+            memcpy(buff, &item, sizeof(item));
+            res = bque_enqueue_adopt(ctx, buff, sizeof(item));
+            if (res != BQUE_OK) {
+                TEST_CHECK(bque_release(ctx, buff) == BQUE_OK);
+            }
+            break;
+        default:
+            TEST_CHECK(bque_reserve(ctx, sizeof(item), &buff) == BQUE_OK);
+            memcpy(buff, &item, sizeof(item));
+            res = bque_commit(ctx, sizeof(item));
+            if (res != BQUE_OK) {
+                TEST_CHECK(bque_commit(ctx, 0) == BQUE_OK);
+            }
+            break;
+        }
+        if (res == BQUE_OK) {
+            i++;
+        } else {
+            TEST_CHECK(res == BQUE_ERR_FULL_QUE);
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/* the consumer takes the buffers in order, copied or by reference. both
+   threads yield while they can't go on, which matters on a single CPU. */
+static void test_run(bque_u32_t buff_num_max) {
+    bque_conf_t conf = {0};
+    bque_u64_t sum = 0;
+    test_item_t item;
+    bque_stat_t stat;
+    pthread_t thread;
+    bque_ctx_t *ctx;
+    bque_u32_t size;
+    bque_res_t res;
+    void *buff;
+    bque_u32_t i;
+
+    conf.buff_num_max = buff_num_max;
+    conf.flags = BQUE_FLAG_SPSC;
+    TEST_CHECK(bque_new(&ctx, &conf) == BQUE_OK);
+    TEST_CHECK(pthread_create(&thread, NULL, test_produce, ctx) == 0);
+
+    for (i = 0; i < TEST_BUFF_NUM;) {
+        if (i % 2 == 0) {
+            res = bque_dequeue(ctx, &item, &size);
+        } else {
+            res = bque_dequeue_ref(ctx, &buff, &size);
+            if (res == BQUE_OK) {
+                memcpy(&item, buff, sizeof(item));
+                TEST_CHECK(bque_release(ctx, buff) == BQUE_OK);
+            }
+        }
+        if (res != BQUE_OK) {
+            TEST_CHECK(res == BQUE_ERR_EMPTY_QUE);
+            sched_yield();
+            continue;
+        }
+        TEST_CHECK(size == sizeof(item));
+        TEST_CHECK(item.id == i && item.check == ~i);
+        sum += item.id;
+        i++;
+    }
+
+    TEST_CHECK(pthread_join(thread, NULL) == 0);
+    TEST_CHECK(sum == (bque_u64_t)TEST_BUFF_NUM * (TEST_BUFF_NUM - 1) / 2);
+    TEST_CHECK(bque_stat(ctx, &stat) == BQUE_OK);
+    TEST_CHECK(stat.buff_num == 0);
+    TEST_CHECK(bque_free(ctx) == BQUE_OK);
+}
+
+int main(void) {
+    test_run(0);
+    test_run(64);
+    test_run(1);
+
+    return 0;
+}